@@ -0,0 +1,66 @@
+#include "arena.h"
+#include <cassert>
+
+namespace arena {
+    Arena::Arena(): current_block_(nullptr), memory_usage_(0)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        current_block_ = NewBlock(kBlockSize);
+    }
+
+    char *Arena::Allocate(size_t bytes, size_t align)
+    {
+        assert(bytes > 0 && (align & (align - 1)) == 0);
+        if(bytes > kBlockSize / 4) {
+            // 大对象单独占用一个块，避免浪费当前块的剩余空间
+            std::lock_guard<std::mutex> lock(mutex_);
+            return AllocateFromBlock(NewBlock(bytes + align), bytes, align);
+        }
+
+        while(true) {
+            Block *block = current_block_.load(std::memory_order_acquire);
+            char *result = AllocateFromBlock(block, bytes, align);
+            if(result) {
+                return result;
+            }
+            std::lock_guard<std::mutex> lock(mutex_);
+            if(current_block_.load(std::memory_order_relaxed) == block) {
+                // 其他线程尚未替换当前块
+                current_block_.store(NewBlock(kBlockSize), std::memory_order_release);
+            }
+        }
+    }
+
+    char *Arena::AllocateFromBlock(Block *block, size_t bytes, size_t align)
+    {
+        // 按最坏情况预留对齐填充，保证一次原子加法即可完成分配
+        size_t reserved = bytes + align - 1;
+        size_t start = block->used.fetch_add(reserved, std::memory_order_relaxed);
+        if(start + reserved > block->size) {
+            return nullptr;
+        }
+        uintptr_t address = reinterpret_cast<uintptr_t>(block->data.get() + start);
+        address = (address + align - 1) & ~(static_cast<uintptr_t>(align) - 1);
+        return reinterpret_cast<char*>(address);
+    }
+
+    Arena::Block *Arena::NewBlock(size_t size)
+    {
+        blocks_.push_back(std::make_unique<Block>(size));
+        memory_usage_ += size;
+        return blocks_.back().get();
+    }
+
+    void Arena::Reset()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        blocks_.clear();
+        memory_usage_ = 0;
+        current_block_ = NewBlock(kBlockSize);
+    }
+
+    size_t Arena::memory_usage() const
+    {
+        return memory_usage_;
+    }
+}
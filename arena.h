@@ -0,0 +1,71 @@
+#ifndef LSMKV_HANDOUT_ARENA_H
+#define LSMKV_HANDOUT_ARENA_H
+
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <memory>
+
+namespace arena {
+    /**
+     * @brief 线程安全的bump分配器
+     * @details 从大块内存中顺序切分，分配只需一次原子加法，只有当前块用尽时才加锁申请新块。
+     * 分配出的内存不能单独释放，Arena析构或Reset时一次性释放全部内存。
+     */
+    class Arena
+    {
+    public:
+        static const size_t kBlockSize = 64 * 1024;
+
+        Arena();
+        ~Arena() = default;
+        Arena(const Arena &) = delete;
+        Arena &operator=(const Arena &) = delete;
+
+        /**
+         * @brief 分配bytes字节，起始地址按align对齐
+         * @param bytes 字节数，须大于0
+         * @param align 对齐字节数，须为2的幂且不超过alignof(std::max_align_t)
+         */
+        char *Allocate(size_t bytes, size_t align = 1);
+
+        /**
+         * @brief 释放全部内存，调用者须保证没有并发分配且不再使用已分配的内存
+         */
+        void Reset();
+
+        /**
+         * @brief 已向系统申请的字节数
+         */
+        size_t memory_usage() const;
+
+    private:
+        struct Block
+        {
+            std::unique_ptr<char[]> data;
+            size_t size;
+            std::atomic<size_t> used;
+
+            explicit Block(size_t size): data(new char[size]), size(size), used(0) {}
+        };
+
+        /**
+         * @brief 尝试在块中分配，块剩余空间不足时返回nullptr
+         */
+        static char *AllocateFromBlock(Block *block, size_t bytes, size_t align);
+
+        /**
+         * @brief 申请一个新块，调用者须持有mutex_
+         */
+        Block *NewBlock(size_t size);
+
+        std::atomic<Block*> current_block_;
+        std::vector<std::unique_ptr<Block>> blocks_;
+        std::atomic<size_t> memory_usage_;
+        std::mutex mutex_; // 申请新块时加锁
+    };
+}
+
+#endif //LSMKV_HANDOUT_ARENA_H
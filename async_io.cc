@@ -0,0 +1,324 @@
+#include "async_io.h"
+#include "utils/logger.h"
+
+#include <atomic>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cerrno>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace async_io {
+    // pread线程池的最大线程数
+    static const unsigned kMaxThreadPoolSize = 16;
+
+    bool PreadFully(int fd, char *buffer, uint32_t len, uint64_t offset)
+    {
+        size_t read_size = 0;
+        while(read_size < len) {
+            ssize_t res = pread(fd, buffer + read_size, len - read_size, offset + read_size);
+            if(res < 0 && errno == EINTR) {
+                continue;
+            }
+            if(res <= 0) {
+                return false;
+            }
+            read_size += res;
+        }
+        return true;
+    }
+
+    /**
+     * @brief 通过io_uring系统调用直接操作提交与完成队列，不依赖liburing
+     */
+    class IoUringReader: public AsyncReader
+    {
+    public:
+        ~IoUringReader() override
+        {
+            if(sqes_ != MAP_FAILED) {
+                munmap(sqes_, sqes_size_);
+            }
+            if(cq_ptr_ != MAP_FAILED && cq_ptr_ != sq_ptr_) {
+                munmap(cq_ptr_, cq_size_);
+            }
+            if(sq_ptr_ != MAP_FAILED) {
+                munmap(sq_ptr_, sq_size_);
+            }
+            if(ring_fd_ >= 0) {
+                close(ring_fd_);
+            }
+        }
+
+        /**
+         * @brief 创建并映射队列
+         * @return false 内核不支持io_uring或创建失败
+         */
+        bool Init(unsigned queue_depth)
+        {
+            io_uring_params params;
+            memset(&params, 0, sizeof(params));
+            ring_fd_ = syscall(__NR_io_uring_setup, queue_depth, &params);
+            if(ring_fd_ < 0) {
+                return false;
+            }
+            entries_ = params.sq_entries;
+
+            sq_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+            cq_size_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+            bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+            if(single_mmap) {
+                sq_size_ = cq_size_ = std::max(sq_size_, cq_size_);
+            }
+            sq_ptr_ = mmap(nullptr, sq_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                ring_fd_, IORING_OFF_SQ_RING);
+            if(sq_ptr_ == MAP_FAILED) {
+                return false;
+            }
+            cq_ptr_ = single_mmap ? sq_ptr_ : mmap(nullptr, cq_size_, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_CQ_RING);
+            if(cq_ptr_ == MAP_FAILED) {
+                return false;
+            }
+            sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+            sqes_ = mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                ring_fd_, IORING_OFF_SQES);
+            if(sqes_ == MAP_FAILED) {
+                return false;
+            }
+
+            char *sq = static_cast<char*>(sq_ptr_);
+            char *cq = static_cast<char*>(cq_ptr_);
+            sq_tail_ = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+            sq_ring_mask_ = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+            sq_array_ = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+            cq_head_ = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+            cq_tail_ = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+            cq_ring_mask_ = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+            cqes_ = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+            return true;
+        }
+
+        void ReadAll(std::vector<ReadRequest> &requests) override
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            // 读到的字节数，短读在全部完成后用pread补齐
+            std::vector<uint32_t> read_sizes(requests.size(), 0);
+            std::vector<bool> done(requests.size(), false);
+            size_t submitted = 0, completed = 0;
+            unsigned in_flight = 0, to_submit = 0;
+            bool failed = false;
+            while(completed < submitted || submitted < requests.size()) {
+                // 填满提交队列，本线程是唯一的生产者
+                unsigned sq_tail = *sq_tail_;
+                while(submitted < requests.size() && in_flight + to_submit < entries_) {
+                    const ReadRequest &request = requests[submitted];
+                    unsigned index = sq_tail & sq_ring_mask_;
+                    io_uring_sqe *sqe = static_cast<io_uring_sqe*>(sqes_) + index;
+                    memset(sqe, 0, sizeof(*sqe));
+                    sqe->opcode = IORING_OP_READ;
+                    sqe->fd = request.fd;
+                    sqe->off = request.offset;
+                    sqe->addr = reinterpret_cast<uint64_t>(request.buffer);
+                    sqe->len = request.len;
+                    sqe->user_data = submitted;
+                    sq_array_[index] = index;
+                    ++ sq_tail;
+                    ++ submitted;
+                    ++ to_submit;
+                }
+                __atomic_store_n(sq_tail_, sq_tail, __ATOMIC_RELEASE);
+
+                // 提交新请求，并至少等待一个完成
+                int res = syscall(__NR_io_uring_enter, ring_fd_, to_submit, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+                if(res < 0) {
+                    if(errno == EINTR || errno == EAGAIN || errno == EBUSY) {
+                        continue;
+                    }
+                    LOG_ERROR("io_uring_enter failed: %s", strerror(errno));
+                    failed = true;
+                    break;
+                }
+                to_submit -= res;
+                in_flight += res;
+
+                unsigned reaped = ReapCompletions(read_sizes, done);
+                completed += reaped;
+                in_flight -= reaped;
+            }
+
+            if(failed) {
+                // 撤回尚未被内核取走的提交项，避免之后的调用把它们提交出去
+                __atomic_store_n(sq_tail_, *sq_tail_ - to_submit, __ATOMIC_RELEASE);
+                // 等待已提交的读取全部完成，之后缓冲区才能交还调用者，完成队列也不会残留本批的结果
+                while(in_flight > 0) {
+                    int res = syscall(__NR_io_uring_enter, ring_fd_, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+                    if(res < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+                        // 无法在内核中等待时，完成项仍会在返回用户态时写入，轮询完成队列
+                        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                    }
+                    in_flight -= ReapCompletions(read_sizes, done);
+                }
+            }
+
+            for(size_t i = 0; i < requests.size(); ++i) {
+                ReadRequest &request = requests[i];
+                if(failed && !done[i]) {
+                    // 队列不可用时同步读取剩余的请求
+                    request.ok = PreadFully(request.fd, request.buffer, request.len, request.offset);
+                    continue;
+                }
+                uint32_t read_size = read_sizes[i];
+                request.ok = read_size == request.len
+                    || (read_size && PreadFully(request.fd, request.buffer + read_size,
+                        request.len - read_size, request.offset + read_size));
+            }
+        }
+
+        const char *name() const override { return "io_uring"; }
+
+    private:
+        /**
+         * @brief 收割完成队列中的所有完成项
+         * @return 收割的完成项数
+         */
+        unsigned ReapCompletions(std::vector<uint32_t> &read_sizes, std::vector<bool> &done)
+        {
+            unsigned cq_head = *cq_head_;
+            unsigned cq_tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+            unsigned reaped = 0;
+            while(cq_head != cq_tail) {
+                const io_uring_cqe &cqe = cqes_[cq_head & cq_ring_mask_];
+                if(cqe.res > 0) {
+                    read_sizes[cqe.user_data] = cqe.res;
+                }
+                done[cqe.user_data] = true;
+                ++ cq_head;
+                ++ reaped;
+            }
+            __atomic_store_n(cq_head_, cq_head, __ATOMIC_RELEASE);
+            return reaped;
+        }
+
+        int ring_fd_ = -1;
+        unsigned entries_ = 0;
+        void *sq_ptr_ = MAP_FAILED;
+        void *cq_ptr_ = MAP_FAILED;
+        void *sqes_ = MAP_FAILED;
+        size_t sq_size_ = 0, cq_size_ = 0, sqes_size_ = 0;
+        unsigned *sq_tail_ = nullptr;
+        unsigned sq_ring_mask_ = 0;
+        unsigned *sq_array_ = nullptr;
+        unsigned *cq_head_ = nullptr;
+        unsigned *cq_tail_ = nullptr;
+        unsigned cq_ring_mask_ = 0;
+        io_uring_cqe *cqes_ = nullptr;
+        std::mutex mutex_; // 队列只能由一个线程提交与收割
+    };
+
+    /**
+     * @brief 由常驻线程并发调用pread，调用ReadAll的线程也参与读取
+     */
+    class ThreadPoolReader: public AsyncReader
+    {
+    public:
+        explicit ThreadPoolReader(unsigned thread_count)
+        {
+            for(unsigned i = 0; i < thread_count; ++i) {
+                threads_.emplace_back(&ThreadPoolReader::WorkerLoop, this);
+            }
+        }
+
+        ~ThreadPoolReader() override
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                stopping_ = true;
+            }
+            work_cv_.notify_all();
+            for(auto &thread: threads_) {
+                thread.join();
+            }
+        }
+
+        void ReadAll(std::vector<ReadRequest> &requests) override
+        {
+            std::lock_guard<std::mutex> read_all_lock(read_all_mutex_);
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                requests_ = &requests;
+                next_ = 0;
+                idle_workers_ = 0;
+                ++ generation_;
+            }
+            work_cv_.notify_all();
+            ReadRequests();
+
+            // 等待所有工作线程放弃本批请求，之后requests才能被调用者释放
+            std::unique_lock<std::mutex> lock(mutex_);
+            done_cv_.wait(lock, [this] { return idle_workers_ == threads_.size(); });
+            requests_ = nullptr;
+        }
+
+        const char *name() const override { return "thread_pool"; }
+
+    private:
+        void WorkerLoop()
+        {
+            uint64_t seen_generation = 0;
+            std::unique_lock<std::mutex> lock(mutex_);
+            while(true) {
+                work_cv_.wait(lock, [this, seen_generation] { return stopping_ || generation_ != seen_generation; });
+                if(stopping_) {
+                    return ;
+                }
+                seen_generation = generation_;
+                lock.unlock();
+                ReadRequests();
+                lock.lock();
+                if(++ idle_workers_ == threads_.size()) {
+                    done_cv_.notify_one();
+                }
+            }
+        }
+
+        /**
+         * @brief 不断领取当前批次中的下一个请求，直到全部领取完毕
+         */
+        void ReadRequests()
+        {
+            std::vector<ReadRequest> &requests = *requests_;
+            for(size_t i = next_++; i < requests.size(); i = next_++) {
+                ReadRequest &request = requests[i];
+                request.ok = PreadFully(request.fd, request.buffer, request.len, request.offset);
+            }
+        }
+
+        std::vector<std::thread> threads_;
+        std::mutex read_all_mutex_; // 一次只处理一个批次
+        std::mutex mutex_;
+        std::condition_variable work_cv_;
+        std::condition_variable done_cv_;
+        std::vector<ReadRequest> *requests_ = nullptr;
+        std::atomic<size_t> next_ = 0;
+        uint64_t generation_ = 0;
+        size_t idle_workers_ = 0;
+        bool stopping_ = false;
+    };
+
+    std::unique_ptr<AsyncReader> NewAsyncReader(unsigned queue_depth)
+    {
+        auto io_uring_reader = std::make_unique<IoUringReader>();
+        if(io_uring_reader->Init(queue_depth)) {
+            return io_uring_reader;
+        }
+        LOG_INFO("io_uring is unavailable (%s), fall back to thread pool", strerror(errno));
+        return std::make_unique<ThreadPoolReader>(std::min(queue_depth, kMaxThreadPoolSize));
+    }
+}
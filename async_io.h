@@ -0,0 +1,58 @@
+#ifndef LSMKV_HANDOUT_ASYNC_IO_H
+#define LSMKV_HANDOUT_ASYNC_IO_H
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace async_io {
+    /**
+     * @brief 一次读取请求
+     */
+    struct ReadRequest
+    {
+        int fd;
+        uint64_t offset;
+        uint32_t len;
+        char *buffer;       // 至少len字节的缓冲区
+        bool ok = false;    // 返回时是否读满len字节
+    };
+
+    /**
+     * @brief 批量异步读取引擎
+     * @details 一次提交多个读取，最多保持queue_depth个请求同时在途，全部完成后返回。
+     * 优先使用io_uring；内核不支持或被禁止时（如容器的seccomp策略）退化为pread线程池。
+     */
+    class AsyncReader
+    {
+    public:
+        virtual ~AsyncReader() = default;
+
+        /**
+         * @brief 读取所有请求，返回时每个请求的ok已设置
+         * @details 线程安全，并发的调用依次执行
+         */
+        virtual void ReadAll(std::vector<ReadRequest> &requests) = 0;
+
+        /**
+         * @brief 实现的名称，"io_uring"或"thread_pool"
+         */
+        virtual const char *name() const = 0;
+    };
+
+    /**
+     * @brief 创建读取引擎，优先使用io_uring
+     * 
+     * @param queue_depth 同时在途的最大请求数
+     */
+    std::unique_ptr<AsyncReader> NewAsyncReader(unsigned queue_depth);
+
+    /**
+     * @brief 使用pread读满len字节，处理EINTR与短读
+     * @return true 读取成功
+     * @return false 读取失败或超出文件末尾
+     */
+    bool PreadFully(int fd, char *buffer, uint32_t len, uint64_t offset);
+}
+
+#endif //LSMKV_HANDOUT_ASYNC_IO_H
@@ -1,92 +1,102 @@
 //
 // Created by creeper on 24-3-12.
 //
-#include <hash_map>
 #include <cstring>
 #include <iostream>
+#include <algorithm>
 #include "bloom_filter.h"
 #include "MurmurHash3.h"
 namespace bloom_filter {
-    BloomFilter::BloomFilter(int vector_size)
-            : vector_size_(vector_size) {
-        hash_vector_ = new bool[vector_size];
-        memset(hash_vector_, 0, vector_size);
+    static const uint32_t kMagic = 0x314b4c42; // "BLK1"
+
+    // 每个字使用不同的奇数乘子，从同一个32位哈希值中得到8个相互独立的位
+    static const uint32_t kSalt[8] = {
+        0x47b6137bU, 0x44974d91U, 0x8824ad5bU, 0xa2b7289dU,
+        0x705495c7U, 0x2df1424bU, 0x9efc4947U, 0x5c6bfb31U
+    };
+
+    static uint64_t Hash(uint64_t key) {
+        uint64_t hash[2] = {};
+        MurmurHash3_x64_128(&key, sizeof(key), 1, hash);
+        return hash[0];
+    }
+
+    BloomFilter::BloomFilter(uint32_t block_count)
+            : block_count_(std::max<uint32_t>(block_count, 1)),
+              blocks_(new Block[block_count_]) {
+        memset(blocks_.get(), 0, block_count_ * sizeof(Block));
     }
 
+    BloomFilter::BloomFilter(uint64_t key_count, int bits_per_key)
+            : BloomFilter(static_cast<uint32_t>(
+                (key_count * std::max(bits_per_key, 1) + sizeof(Block) * 8 - 1) / (sizeof(Block) * 8))) { }
+
+    uint32_t BloomFilter::BlockIndex(uint64_t hash) const {
+        // 高32位决定块号，用乘法代替取模
+        return ((hash >> 32) * block_count_) >> 32;
+    }
 
     void BloomFilter::Insert(uint64_t key) {
-        uint32_t hash[4] = {};
-        MurmurHash3_x64_128(&key, sizeof(key), 1, hash);
-        for(uint32_t res : hash) {
-            hash_vector_[res % vector_size_] = true;
+        uint64_t hash = Hash(key);
+        uint32_t low = static_cast<uint32_t>(hash);
+        Block &block = blocks_[BlockIndex(hash)];
+        for(int i = 0; i < 8; ++i) {
+            block.words[i] |= 1ULL << ((low * kSalt[i]) >> 26);
         }
     }
 
-    bool BloomFilter::Search(uint64_t key) {
-        uint32_t hash[4] = {};
-        MurmurHash3_x64_128(&key, sizeof(key), 1, hash);
-        for(uint32_t res: hash) {
-            if(!hash_vector_[res % vector_size_]) {
-                return false;
-            }
+    bool BloomFilter::Search(uint64_t key) const {
+        uint64_t hash = Hash(key);
+        uint32_t low = static_cast<uint32_t>(hash);
+        const Block &block = blocks_[BlockIndex(hash)];
+        // 无分支地累积缺失的位，便于编译器向量化
+        uint64_t missing = 0;
+        for(int i = 0; i < 8; ++i) {
+            missing |= (1ULL << ((low * kSalt[i]) >> 26)) & ~block.words[i];
         }
-        return true;
+        return missing == 0;
     }
 
-    BloomFilter::~BloomFilter() {
-        delete [] hash_vector_;
+    BloomFilter *BloomFilter::Decode(const char *data, size_t size) {
+        if(size < sizeof(Trailer) || (size - sizeof(Trailer)) % sizeof(Block) != 0) {
+            return nullptr;
+        }
+        Trailer trailer;
+        memcpy(&trailer, data + size - sizeof(Trailer), sizeof(Trailer));
+        if(trailer.magic != kMagic
+            || trailer.block_count == 0
+            || trailer.block_count != (size - sizeof(Trailer)) / sizeof(Block)) {
+            return nullptr;
+        }
+        BloomFilter *bloom_filter = new BloomFilter(trailer.block_count);
+        memcpy(bloom_filter->blocks_.get(), data, trailer.block_count * sizeof(Block));
+        return bloom_filter;
     }
 
-    void BloomFilter::WriteToFile(std::ofstream& fout) {
-        // 将bool数组转换为比特流
-        bool* cur = hash_vector_;
-        int count = 0;
-        unsigned char byte = 0;
-        while(count < vector_size_) {
-            if(*cur) {
-                byte = byte | (1 << (count % 8));
-            }
-            if(count % 8 == 7) {
-                // 一个字节中的最后一个bit
-                fout.write(reinterpret_cast<const char*>(&byte), 1);
-                byte = 0;
-            }
-            ++count;
-            ++cur;
-        }
+    void BloomFilter::WriteToFile(std::ofstream& fout) const {
+        Trailer trailer = {block_count_, kMagic};
+        fout.write(reinterpret_cast<const char*>(blocks_.get()), block_count_ * sizeof(Block));
+        fout.write(reinterpret_cast<const char*>(&trailer), sizeof(Trailer));
     }
 
-    void BloomFilter::ReadFromFile(std::ifstream &fin) {
-        // 将比特流转换为bool数组
-        bool* cur = hash_vector_;
-        int count = 0;
-        char byte = 0;
+    size_t BloomFilter::encoded_size() const {
+        return block_count_ * sizeof(Block) + sizeof(Trailer);
+    }
 
-        while(count < vector_size_) {
-            if(count % 8 == 0) {
-                // 一个字节中的第一个bit
-                fin.read(&byte, 1);
-            }
-            *cur = (byte >> (count % 8)) & 0x1;
-            ++count;
-            ++cur;
-        }
+    size_t BloomFilter::memory_usage() const {
+        return block_count_ * sizeof(Block);
     }
 
     bool BloomFilter::operator==(const BloomFilter &other) const {
-        if(this->vector_size_ != other.vector_size_) {
-            std::cerr << "difference vector size" << std::endl;
+        if(this->block_count_ != other.block_count_) {
+            std::cerr << "difference block count" << std::endl;
             return false;
         }
-        for(int i = 0;i < vector_size_;++i) {
-            if(this->hash_vector_[i] != other.hash_vector_[i]) {
-                std::cerr << "two bloom filter differs at " << i << std::endl;
-                return false;
-            }
+        if(memcmp(blocks_.get(), other.blocks_.get(), block_count_ * sizeof(Block)) != 0) {
+            std::cerr << "two bloom filter differs" << std::endl;
+            return false;
         }
         return true;
     }
 
 }
-
-
@@ -5,12 +5,25 @@
 #ifndef HW2_BLOOM_FILTER_H
 #define HW2_BLOOM_FILTER_H
 #include <cstdint>
+#include <cstddef>
 #include <fstream>
+#include <memory>
 namespace bloom_filter {
+    /**
+     * @brief 按缓存行分块的Bloom过滤器
+     * @details 过滤器由若干64字节的块组成，每个键只映射到一个块，
+     * 在块的8个64位字中各置一位，因此一次查找只访问一个缓存行。
+     * 文件中的格式为所有块的原始字节，后接8字节尾部（块数与魔数），可以一次memcpy载入。
+     */
     class BloomFilter {
     public:
-        explicit BloomFilter(int vector_size);
-        ~BloomFilter();
+        /**
+         * @brief 按键数和每个键占用的比特数确定过滤器大小
+         * @param key_count 键数
+         * @param bits_per_key 每个键占用的比特数
+         */
+        BloomFilter(uint64_t key_count, int bits_per_key);
+        ~BloomFilter() = default;
     public:
 
         /**
@@ -23,25 +36,51 @@ namespace bloom_filter {
          * @param key
          * @return
          */
-        bool Search(uint64_t key);
+        bool Search(uint64_t key) const;
         /**
-         * @brief 从文件中读取Bloom过滤器
-         * @param fin 文件输入流
+         * @brief 从内存中的文件数据解码Bloom过滤器
+         * @param data 过滤器数据起始地址
+         * @param size 过滤器数据的字节数（包括尾部）
+         * @return 解码失败（长度或魔数不符）返回nullptr
          */
-        void ReadFromFile(std::ifstream &fin);
+        static BloomFilter *Decode(const char *data, size_t size);
         /**
-         * 将Bloom 过滤器的向量写入文件
+         * 将Bloom 过滤器写入文件
          * @param fout 文件输出流
          */
-        void WriteToFile(std::ofstream &fout);
+        void WriteToFile(std::ofstream &fout) const;
+
+        /**
+         * @brief 过滤器在文件中占用的字节数
+         */
+        size_t encoded_size() const;
+
+        /**
+         * @brief 过滤器占用的内存字节数
+         */
+        size_t memory_usage() const;
 
     public:
         bool operator==(const BloomFilter& other) const;
 
     private:
-        int vector_size_;
-        bool* hash_vector_;
+        struct alignas(64) Block {
+            uint64_t words[8];
+        };
+        struct Trailer {
+            uint32_t block_count;
+            uint32_t magic;
+        };
+
+        explicit BloomFilter(uint32_t block_count);
+
+        /**
+         * @brief 键的哈希值映射到的块号
+         */
+        uint32_t BlockIndex(uint64_t hash) const;
 
+        uint32_t block_count_;
+        std::unique_ptr<Block[]> blocks_;
     };
 }
 
@@ -2,8 +2,20 @@
 #include <cstdint>
 #include <string>
 #include <assert.h>
+#include <map>
+#include <random>
+#include <algorithm>
+#include <thread>
+#include <filesystem>
+#include <cmath>
 
 #include "test.h"
+#include "write_batch.h"
+#include "kvstore_iterator.h"
+#include "statistics.h"
+#include "ss_table_manager.h"
+#include "histogram.h"
+#include "perf_context.h"
 
 class CorrectnessTest : public Test
 {
@@ -11,6 +23,12 @@ private:
 	const uint64_t SIMPLE_TEST_MAX = 512;
 	const uint64_t LARGE_TEST_MAX = 1024 * 64;
 	const uint64_t GC_TEST_MAX = 1024 * 48;
+	const uint64_t BATCH_TEST_MAX = 1024 * 4;
+	const uint64_t MULTIGET_TEST_MAX = 1024 * 8;
+	const uint64_t PROPERTY_TEST_MAX = 1024 * 8;
+	const uint64_t ITERATOR_TEST_MAX = 1024 * 16;
+	const uint64_t PERF_CONTEXT_TEST_MAX = 1024 * 4;
+	const uint64_t REMAP_TEST_MAX = 1024 * 16;
 
 	void regular_test(uint64_t max)
 	{
@@ -191,11 +209,534 @@ private:
 		report();
 	}
 
+	void check_model(const std::map<uint64_t, std::string> &model, uint64_t max)
+	{
+		for (uint64_t i = 0; i < max; ++i)
+		{
+			auto it = model.find(i);
+			EXPECT(it == model.end() ? not_found : it->second, store.get(i));
+		}
+	}
+
+	void batch_test(uint64_t max)
+	{
+		uint64_t i;
+		std::map<uint64_t, std::string> model;
+		WriteBatch batch;
+
+		// Interleave small batches with single-key operations on overlapping keys
+		for (i = 0; i < max; i += 8)
+		{
+			store.put(i, std::string(i % 64 + 1, 'p'));
+			model[i] = std::string(i % 64 + 1, 'p');
+
+			batch.Clear();
+			batch.Put(i, std::string(i % 64 + 1, 'b'));
+			batch.Put(i + 1, std::string(i % 64 + 1, 'b'));
+			batch.Delete(i + 2);
+			batch.Put(i + 3, std::string(i % 64 + 1, 'b'));
+			batch.Delete(i + 3);
+			batch.Delete(i + 4);
+			batch.Put(i + 4, std::string(i % 64 + 1, 'c'));
+			store.Write(batch);
+			model[i] = std::string(i % 64 + 1, 'b');
+			model[i + 1] = std::string(i % 64 + 1, 'b');
+			model.erase(i + 2);
+			model.erase(i + 3);
+			model[i + 4] = std::string(i % 64 + 1, 'c');
+
+			if (i % 16 == 0)
+			{
+				EXPECT(true, store.del(i + 1));
+				model.erase(i + 1);
+			}
+			EXPECT(false, store.del(i + 2));
+		}
+		check_model(model, max);
+		phase();
+
+		// Batches that do not fit in the remaining memtable capacity
+		for (i = 0; i < MEM_TABLE_CAPACITY / 2; ++i)
+		{
+			store.put(i, std::string(i + 1, 's'));
+			model[i] = std::string(i + 1, 's');
+		}
+		batch.Clear();
+		for (i = 0; i < MEM_TABLE_CAPACITY * 2; ++i)
+		{
+			if (i % 5 == 0)
+			{
+				batch.Delete(i);
+				model.erase(i);
+			}
+			else
+			{
+				batch.Put(i, std::string(i % 128 + 1, 'l'));
+				model[i] = std::string(i % 128 + 1, 'l');
+			}
+		}
+		store.Write(batch);
+		check_model(model, max);
+
+		batch.Clear();
+		for (i = 0; i < MEM_TABLE_CAPACITY; ++i)
+		{
+			batch.Put(max - 1 - i, std::string(24 * 1024 + i, 'h'));
+			model[max - 1 - i] = std::string(24 * 1024 + i, 'h');
+		}
+		store.Write(batch);
+		for (i = 0; i < max; i += 3)
+		{
+			EXPECT(model.count(i) == 1, store.del(i));
+			model.erase(i);
+		}
+		check_model(model, max);
+		phase();
+
+		// Scan must agree with the model as well
+		std::list<std::pair<uint64_t, std::string>> list_stu;
+		store.scan(0, max - 1, list_stu);
+		EXPECT(model.size(), list_stu.size());
+		auto mp = model.begin();
+		auto sp = list_stu.begin();
+		while (mp != model.end() && sp != list_stu.end())
+		{
+			EXPECT(mp->first, sp->first);
+			EXPECT(mp->second, sp->second);
+			mp++;
+			sp++;
+		}
+		phase();
+
+		report();
+	}
+
+	void multiget_test(uint64_t max)
+	{
+		uint64_t i;
+		std::map<uint64_t, std::string> model;
+
+		// Even keys only, so odd keys inside the range are missing
+		for (i = 0; i < max; i += 2)
+		{
+			store.put(i, std::string(i % 256 + 1, 'm'));
+			model[i] = std::string(i % 256 + 1, 'm');
+		}
+		// Deletes that reach the SSTables
+		for (i = 0; i < max; i += 6)
+		{
+			EXPECT(true, store.del(i));
+			model.erase(i);
+		}
+		// Recent writes and deletes that stay in the memtable
+		for (i = max - 64; i < max; ++i)
+		{
+			if (i % 4 == 0)
+			{
+				store.put(i, std::string(i % 256 + 1, 'n'));
+				model[i] = std::string(i % 256 + 1, 'n');
+			}
+			else if (i % 4 == 2 && model.count(i))
+			{
+				EXPECT(true, store.del(i));
+				model.erase(i);
+			}
+		}
+
+		std::vector<uint64_t> keys;
+		for (i = 0; i < max + 64; ++i)
+			keys.push_back(i);
+		for (i = 0; i < max; i += 7)
+			keys.push_back(i);
+		for (i = max - 64; i < max; ++i)
+			keys.push_back(i);
+		std::mt19937_64 rng(max);
+		std::shuffle(keys.begin(), keys.end(), rng);
+
+		std::vector<std::string> values = store.MultiGet(keys);
+		EXPECT(keys.size(), values.size());
+		for (i = 0; i < keys.size() && i < values.size(); ++i)
+		{
+			auto it = model.find(keys[i]);
+			std::string value = values[i];
+			EXPECT(it == model.end() ? not_found : it->second, value);
+			EXPECT(store.get(keys[i]), value);
+		}
+		phase();
+
+		// Empty and single-key requests
+		EXPECT(size_t(0), store.MultiGet({}).size());
+		std::vector<std::string> single = store.MultiGet({max - 4});
+		EXPECT(size_t(1), single.size());
+		if (!single.empty())
+		{
+			std::string value = single[0];
+			EXPECT(store.get(max - 4), value);
+		}
+		phase();
+
+		report();
+	}
+
+	// Walk the whole store and compare it with the model
+	void check_iteration(const std::map<uint64_t, std::string> &model)
+	{
+		auto iterator = store.NewIterator();
+		auto mp = model.begin();
+		for (iterator->SeekToFirst(); iterator->Valid() && mp != model.end(); iterator->Next(), ++mp)
+		{
+			EXPECT(mp->first, iterator->key());
+			EXPECT(mp->second, iterator->value());
+		}
+		EXPECT(true, mp == model.end());
+		EXPECT(false, iterator->Valid());
+	}
+
+	void iterator_test(uint64_t max)
+	{
+		uint64_t i;
+		std::map<uint64_t, std::string> model;
+
+		// Only multiples of 4, so most seek targets fall between keys and between SSTables
+		for (i = 0; i < max; i += 4)
+		{
+			store.put(i, std::string(i % 256 + 1, 'a'));
+			model[i] = std::string(i % 256 + 1, 'a');
+		}
+		// Overwrites and deletes that reach L0 and the levels below
+		for (i = 0; i < max; i += 16)
+		{
+			store.put(i, std::string(i % 128 + 1, 'b'));
+			model[i] = std::string(i % 128 + 1, 'b');
+		}
+		for (i = 0; i < max; i += 12)
+		{
+			EXPECT(true, store.del(i));
+			model.erase(i);
+		}
+		// Recent overwrites and deletes that stay in memory
+		for (i = max / 2; i < max / 2 + 256; i += 4)
+		{
+			if (i % 8 == 0)
+			{
+				store.put(i, std::string(i % 64 + 1, 'c'));
+				model[i] = std::string(i % 64 + 1, 'c');
+			}
+			else
+			{
+				store.del(i);
+				model.erase(i);
+			}
+		}
+		check_iteration(model);
+		phase();
+
+		auto iterator = store.NewIterator();
+		for (i = 0; i < max + 8; ++i)
+		{
+			iterator->Seek(i);
+			auto mp = model.lower_bound(i);
+			EXPECT(mp != model.end(), iterator->Valid());
+			if (mp != model.end() && iterator->Valid())
+			{
+				EXPECT(mp->first, iterator->key());
+				EXPECT(mp->second, iterator->value());
+			}
+		}
+		iterator.reset();
+		phase();
+
+		// Compactions replace the files of a pinned iterator; writes after the seek
+		// go to odd keys, which the iterator may or may not see
+		uint64_t compaction_count = store.statistics().ticker(statistics::Ticker::kCompactionCount);
+		iterator = store.NewIterator();
+		iterator->SeekToFirst();
+		for (i = 1; i < max; i += 2)
+			store.put(i, std::string(i % 256 + 1, 'o'));
+		EXPECT(true, store.statistics().ticker(statistics::Ticker::kCompactionCount) > compaction_count);
+		auto mp = model.begin();
+		for (; iterator->Valid(); iterator->Next())
+		{
+			uint64_t key = iterator->key();
+			if (key % 2)
+			{
+				EXPECT(std::string(key % 256 + 1, 'o'), iterator->value());
+				continue;
+			}
+			if (mp == model.end())
+			{
+				EXPECT(uint64_t(-1), key);
+				continue;
+			}
+			EXPECT(mp->first, key);
+			EXPECT(mp->second, iterator->value());
+			++mp;
+		}
+		EXPECT(true, mp == model.end());
+		iterator.reset();
+		for (i = 1; i < max; i += 2)
+			model[i] = std::string(i % 256 + 1, 'o');
+		check_iteration(model);
+		phase();
+
+		// GC moves the tail past the values the iterator points to
+		store.reset();
+		model.clear();
+		for (i = 0; i < max; ++i)
+		{
+			store.put(i, std::string(i % 256 + 1, 'g'));
+			model[i] = std::string(i % 256 + 1, 'g');
+		}
+		iterator = store.NewIterator();
+		iterator->SeekToFirst();
+		check_gc(MB / 2);
+		mp = model.begin();
+		for (; iterator->Valid() && mp != model.end(); iterator->Next(), ++mp)
+		{
+			EXPECT(mp->first, iterator->key());
+			EXPECT(mp->second, iterator->value());
+		}
+		EXPECT(true, mp == model.end());
+		iterator.reset();
+		phase();
+
+		report();
+	}
+
+	void property_test(uint64_t max)
+	{
+		uint64_t i;
+		std::string value;
+
+		// Stats are read while another thread writes and flushes
+		std::thread reader([this, &value] {
+			std::string stats;
+			for (int j = 0; j < 64; ++j)
+				store.GetProperty("lsmkv.stats", stats);
+		});
+		for (i = 0; i < max; ++i)
+			store.put(i, std::string(i % 512 + 1, 'p'));
+		reader.join();
+
+		EXPECT(true, store.GetProperty("lsmkv.stats", value));
+		EXPECT(true, value.find("** Level stats **") != std::string::npos);
+		EXPECT(true, store.GetProperty("lsmkv.levelstats", value));
+		phase();
+
+		// Every existing level reports a count, the first missing level does not
+		int level_count = 0;
+		uint64_t file_count = 0;
+		while (store.GetProperty("lsmkv.num-files-at-level" + std::to_string(level_count), value))
+		{
+			file_count += std::stoull(value);
+			++level_count;
+		}
+		EXPECT(true, level_count > 1);
+		EXPECT(true, file_count > 0);
+		EXPECT(std::string(), value);
+		phase();
+
+		// Malformed and out-of-range names are rejected without throwing
+		const char *invalid_properties[] = {
+			"lsmkv.num-files-at-level",
+			"lsmkv.num-files-at-level99999999999",
+			"lsmkv.num-files-at-level-1",
+			"lsmkv.num-files-at-level+1",
+			"lsmkv.num-files-at-level1x",
+			"lsmkv.num-files-at-level 1",
+			"lsmkv.unknown",
+			"",
+		};
+		for (const char *property : invalid_properties)
+			EXPECT(false, store.GetProperty(property, value));
+		EXPECT(false, store.GetProperty("lsmkv.num-files-at-level" + std::to_string(level_count), value));
+		phase();
+
+		report();
+	}
+
+	// Within the relative error of one histogram sub-bucket
+	bool near(uint64_t got, double expected)
+	{
+		return std::abs(static_cast<double>(got) - expected) <= expected / histogram::Histogram::kSubBucketCount + 1;
+	}
+
+	void histogram_test()
+	{
+		uint64_t i;
+
+		// Uniform 1..10000
+		histogram::Histogram uniform;
+		for (i = 1; i <= 10000; ++i)
+			uniform.Record(i);
+		EXPECT(uint64_t(10000), uniform.count());
+		EXPECT(uint64_t(50005000), uniform.sum());
+		EXPECT(uint64_t(1), uniform.min());
+		EXPECT(uint64_t(10000), uniform.max());
+		EXPECT(true, near(uniform.Percentile(50), 5000));
+		EXPECT(true, near(uniform.Percentile(90), 9000));
+		EXPECT(true, near(uniform.Percentile(99), 9900));
+		EXPECT(uint64_t(10000), uniform.Percentile(100));
+		phase();
+
+		// A single value is reported exactly, whatever its bucket
+		histogram::Histogram constant;
+		for (i = 0; i < 1000; ++i)
+			constant.Record(1000);
+		EXPECT(uint64_t(1000), constant.Percentile(50));
+		EXPECT(uint64_t(1000), constant.Percentile(99));
+		EXPECT(uint64_t(1000), constant.max());
+
+		// Values below the sub-bucket count have one bucket each
+		histogram::Histogram small;
+		for (i = 0; i < 16; ++i)
+			small.Record(i);
+		EXPECT(uint64_t(7), small.Percentile(50));
+		EXPECT(uint64_t(15), small.Percentile(100));
+		phase();
+
+		// 99% fast requests and a slow tail
+		histogram::Histogram bimodal;
+		for (i = 0; i < 9900; ++i)
+			bimodal.Record(100);
+		for (i = 0; i < 100; ++i)
+			bimodal.Record(1000000);
+		EXPECT(true, near(bimodal.Percentile(50), 100));
+		EXPECT(true, near(bimodal.Percentile(90), 100));
+		EXPECT(true, near(bimodal.Percentile(99.9), 1000000));
+		EXPECT(uint64_t(1000000), bimodal.max());
+		EXPECT(true, std::abs(bimodal.Average() - 10099.0) < 1e-6);
+
+		// Merging keeps counts and extremes
+		uniform.Merge(bimodal);
+		EXPECT(uint64_t(20000), uniform.count());
+		EXPECT(uint64_t(1), uniform.min());
+		EXPECT(uint64_t(1000000), uniform.max());
+		uniform.Clear();
+		EXPECT(uint64_t(0), uniform.count());
+		EXPECT(uint64_t(0), uniform.Percentile(99));
+		phase();
+
+		report();
+	}
+
+	void perf_context_test(uint64_t max)
+	{
+		uint64_t i;
+		auto *context = perf_context::get_perf_context();
+
+		for (i = 0; i < max; ++i)
+			store.put(i, std::string(i % 64 + 1, 'q'));
+
+		// A get that reaches an SSTable and the vLog
+		perf_context::SetPerfLevel(perf_context::PerfLevel::kEnableTime);
+		context->Reset();
+		EXPECT(std::string(1, 'q'), store.get(0));
+		uint64_t bloom_filter_probe_count = 0;
+		for (i = 0; i < perf_context::PerfContext::kMaxLevels; ++i)
+			bloom_filter_probe_count += context->bloom_filter_probe_count[i];
+		EXPECT(true, context->get_nanos > 0);
+		EXPECT(true, context->memtable_get_count > 0);
+		EXPECT(true, bloom_filter_probe_count > 0);
+		EXPECT(true, context->binary_search_count > 0);
+		EXPECT(uint64_t(1), context->v_log_read_count);
+		EXPECT(uint64_t(1), context->v_log_read_bytes);
+		EXPECT(true, context->v_log_read_nanos > 0);
+		phase();
+
+		// Puts are not broken down, and leave the counters of the get alone
+		std::string before = context->ToString();
+		store.put(max, std::string(8, 'q'));
+		EXPECT(before, context->ToString());
+
+		// A get served by the memtable does not touch SSTables or the vLog
+		context->Reset();
+		EXPECT(std::string(8, 'q'), store.get(max));
+		EXPECT(true, context->memtable_get_count > 0);
+		EXPECT(uint64_t(0), context->binary_search_count);
+		EXPECT(uint64_t(0), context->v_log_read_count);
+		phase();
+
+		// Counting only does not read the clock, and disabled records nothing
+		perf_context::SetPerfLevel(perf_context::PerfLevel::kEnableCount);
+		context->Reset();
+		store.get(0);
+		EXPECT(uint64_t(1), context->v_log_read_count);
+		EXPECT(uint64_t(0), context->get_nanos);
+		perf_context::SetPerfLevel(perf_context::PerfLevel::kDisable);
+		context->Reset();
+		store.get(0);
+		EXPECT(std::string(), context->ToString(true));
+		phase();
+
+		report();
+	}
+
+	// Reads through the vLog after GC punched holes at the tail and the head moved on
+	void remap_test(uint64_t max)
+	{
+		uint64_t i;
+
+		for (i = 0; i < max; ++i)
+			store.put(i, std::string(i % 256 + 1, 'm'));
+		for (i = 0; i < max; ++i)
+			store.put(i, std::string(i % 256 + 1, 'n'));
+		check_gc(MB);
+		for (i = 0; i < max; ++i)
+			EXPECT(std::string(i % 256 + 1, 'n'), store.get(i));
+		phase();
+
+		// Another round after the mapping was rebuilt
+		for (i = 0; i < max; i += 2)
+			store.put(i, std::string(i % 128 + 1, 'r'));
+		check_gc(MB / 2);
+		std::list<std::pair<uint64_t, std::string>> list_stu;
+		store.scan(0, max - 1, list_stu);
+		EXPECT(max, list_stu.size());
+		i = 0;
+		for (auto sp = list_stu.begin(); sp != list_stu.end(); ++sp, ++i)
+		{
+			EXPECT(i, sp->first);
+			EXPECT(i % 2 ? std::string(i % 256 + 1, 'n') : std::string(i % 128 + 1, 'r'), sp->second);
+		}
+		std::vector<uint64_t> keys;
+		for (i = 0; i < max; i += 5)
+			keys.push_back(i);
+		std::vector<std::string> values = store.MultiGet(keys);
+		for (i = 0; i < keys.size() && i < values.size(); ++i)
+		{
+			std::string value = values[i];
+			EXPECT(store.get(keys[i]), value);
+		}
+		phase();
+
+		report();
+	}
+
 public:
-	CorrectnessTest(const std::string &dir, const std::string &vlog, bool v = true) : Test(dir, vlog, v)
+	CorrectnessTest(const std::string &dir, const std::string &vlog, bool v = true, const KVStoreOptions &options = KVStoreOptions())
+		: Test(dir, vlog, v, options)
 	{
 	}
 
+	/**
+	 * GC and reads on a store whose vLog is read through a memory mapping.
+	 */
+	void start_mmap_test()
+	{
+		std::cout << "KVStore mmap Test" << std::endl;
+
+		store.reset();
+
+		std::cout << "[GC Test]" << std::endl;
+		gc_test(GC_TEST_MAX);
+
+		store.reset();
+
+		std::cout << "[Remap Test]" << std::endl;
+		remap_test(REMAP_TEST_MAX);
+	}
+
 	void start_test(void *args = NULL) override
 	{
 		std::cout << "KVStore Correctness Test" << std::endl;
@@ -214,6 +755,450 @@ public:
 
 		std::cout << "[GC Test]" << std::endl;
 		gc_test(GC_TEST_MAX);
+
+		store.reset();
+
+		std::cout << "[Batch Test]" << std::endl;
+		batch_test(BATCH_TEST_MAX);
+
+		store.reset();
+
+		std::cout << "[MultiGet Test]" << std::endl;
+		multiget_test(MULTIGET_TEST_MAX);
+
+		store.reset();
+
+		std::cout << "[Property Test]" << std::endl;
+		property_test(PROPERTY_TEST_MAX);
+
+		store.reset();
+
+		std::cout << "[Iterator Test]" << std::endl;
+		iterator_test(ITERATOR_TEST_MAX);
+
+		std::cout << "[Histogram Test]" << std::endl;
+		histogram_test();
+
+		store.reset();
+
+		std::cout << "[Perf Context Test]" << std::endl;
+		perf_context_test(PERF_CONTEXT_TEST_MAX);
+	}
+};
+
+class InlineValueTest : public Test
+{
+private:
+	const uint64_t TEST_MAX = 1024 * 16;
+
+	// Spread over both sides of min_blob_size, and tagged with the key
+	std::string value(uint64_t i, char c, size_t size)
+	{
+		std::string val = std::to_string(i);
+		val.resize(std::max(size, val.size()), c);
+		return val;
+	}
+
+	size_t size(uint64_t i)
+	{
+		return i * 37 % 256 + 1;
+	}
+
+	std::string expected(uint64_t i)
+	{
+		if (i % 5 == 0)
+			return not_found;
+		if (i % 4 == 1)
+			return value(i, 'c', 257 - size(i));
+		if (i % 2 == 0)
+			return value(i, 'b', size(i));
+		return value(i, 'a', size(i));
+	}
+
+	void check_all()
+	{
+		uint64_t i;
+
+		for (i = 0; i < TEST_MAX; ++i)
+			EXPECT(expected(i), store.get(i));
+		phase();
+
+		std::list<std::pair<uint64_t, std::string>> list_stu;
+		store.scan(0, TEST_MAX - 1, list_stu);
+		auto sp = list_stu.begin();
+		for (i = 0; i < TEST_MAX; ++i)
+		{
+			if (expected(i) == not_found)
+				continue;
+			if (sp == list_stu.end())
+			{
+				EXPECT(i, uint64_t(-1));
+				continue;
+			}
+			EXPECT(i, sp->first);
+			EXPECT(expected(i), sp->second);
+			sp++;
+		}
+		EXPECT(true, sp == list_stu.end());
+		phase();
+
+		std::vector<uint64_t> keys;
+		for (i = 0; i < TEST_MAX; i += 3)
+			keys.push_back(i);
+		std::vector<std::string> values = store.MultiGet(keys);
+		EXPECT(keys.size(), values.size());
+		for (i = 0; i < keys.size() && i < values.size(); ++i)
+		{
+			std::string value = values[i];
+			EXPECT(expected(keys[i]), value);
+		}
+		phase();
+	}
+
+public:
+	/**
+	 * Flush, compact and collect garbage with values stored both inline and in the vLog.
+	 */
+	void prepare()
+	{
+		std::cout << "<<Preparation Mode>>" << std::endl;
+		uint64_t i;
+
+		store.reset();
+
+		for (i = 0; i < TEST_MAX; ++i)
+			store.put(i, value(i, 'a', size(i)));
+		for (i = 0; i < TEST_MAX; ++i)
+			EXPECT(value(i, 'a', size(i)), store.get(i));
+		phase();
+
+		// Overwrites move keys between inline and vLog storage
+		for (i = 0; i < TEST_MAX; ++i)
+		{
+			if (i % 4 == 1)
+				store.put(i, value(i, 'c', 257 - size(i)));
+			else if (i % 2 == 0)
+				store.put(i, value(i, 'b', size(i)));
+
+			if (i % 4096 == 4095) [[unlikely]]
+				check_gc(MB / 2);
+		}
+		for (i = 0; i < TEST_MAX; i += 5)
+			EXPECT(true, store.del(i));
+		check_gc(MB / 2);
+
+		check_all();
+
+		report();
+	}
+
+	/**
+	 * Check the same data after reopening the store.
+	 */
+	void test()
+	{
+		std::cout << "<<Test Mode>>" << std::endl;
+
+		check_all();
+
+		report();
+	}
+
+	InlineValueTest(const std::string &dir, const std::string &vlog, bool v, const KVStoreOptions &options)
+		: Test(dir, vlog, v, options)
+	{
+	}
+};
+
+class CacheTest : public Test
+{
+private:
+	const uint64_t TEST_MAX = 1024 * 16;
+	const int TABLE_COUNT = 16;
+	const uint64_t TABLE_KEYS = 256;
+	const std::string table_dir = "./cache";
+
+	std::string table_file_name(int t)
+	{
+		return table_dir + "/" + std::to_string(t) + ".sst";
+	}
+
+	std::vector<ss_table::KeyOffsetVlenTuple> table_tuples(int t)
+	{
+		std::vector<ss_table::KeyOffsetVlenTuple> tuples;
+		for (uint64_t j = 0; j < TABLE_KEYS; ++j)
+			tuples.emplace_back(t * TABLE_KEYS + j, j * 64, 64);
+		return tuples;
+	}
+
+	void check_tuples(int t, const std::shared_ptr<ss_table::SSTable> &ss_table)
+	{
+		EXPECT(true, ss_table != nullptr);
+		if (!ss_table)
+			return;
+		auto tuples = table_tuples(t);
+		const auto &loaded = ss_table->key_offset_vlen_tuple_list();
+		EXPECT(tuples.size(), loaded.size());
+		for (size_t j = 0; j < tuples.size() && j < loaded.size(); ++j)
+		{
+			EXPECT(tuples[j].key, loaded[j].key);
+			EXPECT(tuples[j].offset, loaded[j].offset);
+			EXPECT(tuples[j].vlen, loaded[j].vlen);
+		}
+	}
+
+	// The number after `name: ` in the text returned by GetProperty
+	uint64_t stat(const std::string &stats, const std::string &name)
+	{
+		size_t pos = stats.find(name + ": ");
+		return pos == std::string::npos ? 0 : std::stoull(stats.substr(pos + name.size() + 2));
+	}
+
+public:
+	/**
+	 * A cache that holds three tables, with the first table pinned by the caller.
+	 */
+	void manager_test()
+	{
+		utils::mkdir(table_dir);
+		size_t charge;
+		{
+			ss_table::SSTableManager probe(SS_TABLE_CACHE_CAPACITY, BLOOM_FILTER_BITS_PER_KEY);
+			charge = probe.NewSSTable(table_file_name(0), 0, table_tuples(0))->ApproximateMemoryUsage();
+		}
+		const size_t capacity = 3 * charge;
+		ss_table::SSTableManager manager(capacity, BLOOM_FILTER_BITS_PER_KEY);
+
+		std::shared_ptr<ss_table::SSTable> pinned;
+		for (int t = 0; t < TABLE_COUNT; ++t)
+		{
+			auto ss_table = manager.NewSSTable(table_file_name(t), t, table_tuples(t));
+			manager.WriteSSTableToFile(ss_table);
+			if (t == 0)
+				pinned = ss_table;
+		}
+		ss_table::CacheStatistics statistics = manager.cache_statistics();
+		EXPECT(true, statistics.evictions >= uint64_t(TABLE_COUNT - 3));
+		EXPECT(true, statistics.usage <= capacity);
+		EXPECT(capacity, statistics.capacity);
+		phase();
+
+		// The oldest table stays cached while it is pinned
+		EXPECT(true, manager.FromFile(table_file_name(0)) == pinned);
+		EXPECT(statistics.hits + 1, manager.cache_statistics().hits);
+		phase();
+
+		// Evicted tables are read back from their files
+		for (int t = 1; t < TABLE_COUNT; ++t)
+			check_tuples(t, manager.FromFile(table_file_name(t)));
+		statistics = manager.cache_statistics();
+		EXPECT(true, statistics.misses >= uint64_t(TABLE_COUNT - 3));
+		EXPECT(true, statistics.usage <= capacity);
+		phase();
+
+		std::vector<std::string> file_name_list;
+		for (int t = 0; t < TABLE_COUNT; ++t)
+			file_name_list.push_back(table_file_name(t));
+		utils::rmfiles(file_name_list);
+		utils::rmdir(table_dir);
+
+		report();
+	}
+
+	/**
+	 * Reads through a store whose cache holds only a few SSTables.
+	 */
+	void store_test()
+	{
+		uint64_t i;
+
+		store.reset();
+		for (i = 0; i < TEST_MAX; ++i)
+			store.put(i, std::string(i % 128 + 1, 'k'));
+
+		// An iterator pins its current table while gets evict the others
+		auto iterator = store.NewIterator();
+		iterator->SeekToFirst();
+		for (i = 0; i < TEST_MAX; ++i)
+		{
+			EXPECT(std::string((TEST_MAX - 1 - i) % 128 + 1, 'k'), store.get(TEST_MAX - 1 - i));
+			if (iterator->Valid())
+			{
+				EXPECT(i, iterator->key());
+				EXPECT(std::string(i % 128 + 1, 'k'), iterator->value());
+				iterator->Next();
+			}
+		}
+		EXPECT(false, iterator->Valid());
+		iterator.reset();
+		phase();
+
+		std::string stats;
+		EXPECT(true, store.GetProperty("lsmkv.stats", stats));
+		EXPECT(true, stat(stats, "evictions") > 0);
+		EXPECT(true, stat(stats, "misses") > 0);
+		phase();
+
+		report();
+	}
+
+	CacheTest(const std::string &dir, const std::string &vlog, bool v, const KVStoreOptions &options)
+		: Test(dir, vlog, v, options)
+	{
+	}
+};
+
+class CompactionTest : public Test
+{
+private:
+	const uint64_t TEST_MAX = 1024 * 32;
+	const std::string dir;
+
+	std::string expected(uint64_t i)
+	{
+		if (i % 9 == 0)
+			return not_found;
+		return std::string(i % 64 + 1, i % 2 ? 'a' : 'b');
+	}
+
+	// Levels >= 1 read from the files on disk; the store must be idle
+	void check_levels()
+	{
+		int non_empty_levels = 0;
+		for (int level = 1; utils::dirExists(ss_table::SSTable::BuildSSTableDirName(dir, level)); ++level)
+		{
+			std::vector<std::string> base_file_name_list;
+			utils::scanDir(ss_table::SSTable::BuildSSTableDirName(dir, level), base_file_name_list);
+			std::vector<ss_table::Header> headers;
+			for (const auto &base_file_name : base_file_name_list)
+			{
+				if (base_file_name.ends_with(".sst"))
+					headers.push_back(ss_table::SSTable::ReadSSTableHeaderDirectly(
+						ss_table::SSTable::BuildSSTableFileName(dir, level, base_file_name)));
+			}
+			std::sort(headers.begin(), headers.end(), [](const ss_table::Header &a, const ss_table::Header &b) {
+				return a.min_key < b.min_key;
+			});
+			for (size_t j = 1; j < headers.size(); ++j)
+				EXPECT(true, headers[j - 1].max_key < headers[j].min_key);
+			if (!headers.empty())
+				++non_empty_levels;
+		}
+		EXPECT(true, non_empty_levels > 1);
+	}
+
+public:
+	/**
+	 * Random-order writes, so that compactions merge overlapping ranges instead of moving files.
+	 */
+	void prepare()
+	{
+		std::cout << "<<Preparation Mode>>" << std::endl;
+		uint64_t i;
+
+		store.reset();
+
+		std::vector<uint64_t> keys;
+		for (i = 0; i < TEST_MAX; ++i)
+			keys.push_back(i);
+		std::mt19937_64 rng(TEST_MAX);
+		std::shuffle(keys.begin(), keys.end(), rng);
+		for (uint64_t key : keys)
+			store.put(key, std::string(key % 64 + 1, 'a'));
+		std::shuffle(keys.begin(), keys.end(), rng);
+		for (uint64_t key : keys)
+		{
+			if (key % 2 == 0)
+				store.put(key, std::string(key % 64 + 1, 'b'));
+		}
+		for (i = 0; i < TEST_MAX; i += 9)
+			EXPECT(true, store.del(i));
+		for (i = 0; i < TEST_MAX; ++i)
+			EXPECT(expected(i), store.get(i));
+		phase();
+
+		report();
+	}
+
+	/**
+	 * Called on a reopened store without the write-ahead log, which finished
+	 * every compaction before closing and has no background work to do.
+	 */
+	void test()
+	{
+		std::cout << "<<Test Mode>>" << std::endl;
+
+		check_levels();
+		phase();
+
+		for (uint64_t i = 0; i < TEST_MAX; ++i)
+			EXPECT(expected(i), store.get(i));
+		phase();
+
+		report();
+	}
+
+	/**
+	 * The same writes against a store that never splits compactions; both stores
+	 * must end up with the same contents.
+	 */
+	void subcompaction_test()
+	{
+		std::cout << "<<Subcompaction Mode>>" << std::endl;
+		uint64_t i;
+
+		const std::string reference_dir = dir + "/reference";
+		{
+			KVStoreOptions reference_options;
+			reference_options.use_wal = false;
+			reference_options.max_subcompactions = 1;
+			KVStore reference(reference_dir, reference_dir + "/vlog", reference_options);
+			store.reset();
+			reference.reset();
+
+			std::mt19937_64 rng(TEST_MAX + 1);
+			for (i = 0; i < TEST_MAX * 2; ++i)
+			{
+				uint64_t key = rng() % TEST_MAX;
+				if (i % 7 == 0)
+				{
+					store.del(key);
+					reference.del(key);
+				}
+				else
+				{
+					std::string val(i % 128 + 1, 'a' + i % 26);
+					store.put(key, val);
+					reference.put(key, val);
+				}
+			}
+
+			for (i = 0; i < TEST_MAX; ++i)
+				EXPECT(reference.get(i), store.get(i));
+			phase();
+
+			std::list<std::pair<uint64_t, std::string>> list_ans;
+			std::list<std::pair<uint64_t, std::string>> list_stu;
+			reference.scan(0, TEST_MAX - 1, list_ans);
+			store.scan(0, TEST_MAX - 1, list_stu);
+			EXPECT(list_ans.size(), list_stu.size());
+			auto ap = list_ans.begin();
+			auto sp = list_stu.begin();
+			for (; ap != list_ans.end() && sp != list_stu.end(); ++ap, ++sp)
+			{
+				EXPECT(ap->first, sp->first);
+				EXPECT(ap->second, sp->second);
+			}
+			phase();
+		}
+		std::filesystem::remove_all(reference_dir);
+
+		report();
+	}
+
+	CompactionTest(const std::string &dir, const std::string &vlog, bool v, const KVStoreOptions &options)
+		: Test(dir, vlog, v, options), dir(dir)
+	{
 	}
 };
 
@@ -227,9 +1212,54 @@ int main(int argc, char *argv[])
 	std::cout << std::endl;
 	std::cout.flush();
 
-	CorrectnessTest test("./data", "./data/vlog", verbose);
+	{
+		CorrectnessTest test("./data", "./data/vlog", verbose);
+
+		test.start_test();
+	}
+
+	KVStoreOptions options;
+	options.v_log_use_mmap = true;
+	{
+		CorrectnessTest test("./data", "./data/vlog", verbose, options);
+
+		test.start_mmap_test();
+	}
 
-	test.start_test();
+	std::cout << "[Inline Value Test]" << std::endl;
+	options = KVStoreOptions();
+	options.min_blob_size = 128;
+	{
+		InlineValueTest test("./data", "./data/vlog", verbose, options);
+		test.prepare();
+	}
+	{
+		InlineValueTest test("./data", "./data/vlog", verbose, options);
+		test.test();
+	}
+
+	std::cout << "[Cache Test]" << std::endl;
+	options = KVStoreOptions();
+	options.ss_table_cache_capacity = 64 * 1024;
+	{
+		CacheTest test("./data", "./data/vlog", verbose, options);
+		test.manager_test();
+		test.store_test();
+	}
+
+	std::cout << "[Compaction Test]" << std::endl;
+	options = KVStoreOptions();
+	options.use_wal = false;
+	options.max_subcompactions = 4;
+	{
+		CompactionTest test("./data", "./data/vlog", verbose, options);
+		test.prepare();
+	}
+	{
+		CompactionTest test("./data", "./data/vlog", verbose, options);
+		test.test();
+		test.subcompaction_test();
+	}
 
 	return 0;
 }
@@ -0,0 +1,146 @@
+#include "histogram.h"
+
+#include <limits>
+#include <cstdio>
+
+namespace histogram {
+    Histogram::Histogram()
+    {
+        Clear();
+    }
+
+    void Histogram::Record(uint64_t value)
+    {
+        buckets_[BucketIndex(value)].fetch_add(1, std::memory_order_relaxed);
+        sum_.fetch_add(value, std::memory_order_relaxed);
+
+        // 多数记录既不是最小值也不是最大值，只需一次读取
+        uint64_t cur_min = min_.load(std::memory_order_relaxed);
+        while(value < cur_min && !min_.compare_exchange_weak(cur_min, value, std::memory_order_relaxed)) { }
+        uint64_t cur_max = max_.load(std::memory_order_relaxed);
+        while(value > cur_max && !max_.compare_exchange_weak(cur_max, value, std::memory_order_relaxed)) { }
+    }
+
+    void Histogram::Merge(const Histogram &other)
+    {
+        for(int i = 0; i < kBucketCount; ++i) {
+            uint64_t bucket = other.buckets_[i].load(std::memory_order_relaxed);
+            if(bucket) {
+                buckets_[i].fetch_add(bucket, std::memory_order_relaxed);
+            }
+        }
+        sum_.fetch_add(other.sum(), std::memory_order_relaxed);
+
+        uint64_t other_min = other.min_.load(std::memory_order_relaxed);
+        uint64_t cur_min = min_.load(std::memory_order_relaxed);
+        while(other_min < cur_min && !min_.compare_exchange_weak(cur_min, other_min, std::memory_order_relaxed)) { }
+        uint64_t other_max = other.max();
+        uint64_t cur_max = max_.load(std::memory_order_relaxed);
+        while(other_max > cur_max && !max_.compare_exchange_weak(cur_max, other_max, std::memory_order_relaxed)) { }
+    }
+
+    void Histogram::Clear()
+    {
+        for(auto &bucket: buckets_) {
+            bucket.store(0, std::memory_order_relaxed);
+        }
+        sum_.store(0, std::memory_order_relaxed);
+        min_.store(std::numeric_limits<uint64_t>::max(), std::memory_order_relaxed);
+        max_.store(0, std::memory_order_relaxed);
+    }
+
+    uint64_t Histogram::count() const
+    {
+        // 不单独维护计数，记录时少一次原子操作；读取远少于记录
+        uint64_t total = 0;
+        for(const auto &bucket: buckets_) {
+            total += bucket.load(std::memory_order_relaxed);
+        }
+        return total;
+    }
+
+    uint64_t Histogram::sum() const
+    {
+        return sum_.load(std::memory_order_relaxed);
+    }
+
+    uint64_t Histogram::min() const
+    {
+        return count() ? min_.load(std::memory_order_relaxed) : 0;
+    }
+
+    uint64_t Histogram::max() const
+    {
+        return max_.load(std::memory_order_relaxed);
+    }
+
+    double Histogram::Average() const
+    {
+        uint64_t cur_count = count();
+        return cur_count ? static_cast<double>(sum()) / cur_count : 0;
+    }
+
+    uint64_t Histogram::Percentile(double percentile) const
+    {
+        uint64_t total = count();
+        if(!total) {
+            return 0;
+        }
+
+        double threshold = total * percentile / 100.0;
+        uint64_t cumulative = 0;
+        for(int i = 0; i < kBucketCount; ++i) {
+            uint64_t bucket = buckets_[i].load(std::memory_order_relaxed);
+            if(!bucket || cumulative + bucket < threshold) {
+                cumulative += bucket;
+                continue;
+            }
+            // 在桶内按计数线性插值
+            double fraction = (threshold - cumulative) / bucket;
+            uint64_t value = BucketLowerBound(i) + static_cast<uint64_t>(fraction * (BucketWidth(i) - 1));
+            uint64_t cur_min = min(), cur_max = max();
+            return value < cur_min ? cur_min : (value > cur_max ? cur_max : value);
+        }
+        return max();
+    }
+
+    std::string Histogram::ToString() const
+    {
+        char buffer[256];
+        snprintf(buffer, sizeof(buffer),
+            "count=%lu avg=%.3fus p50=%.3fus p90=%.3fus p99=%.3fus p99.9=%.3fus max=%.3fus",
+            count(), Average() / 1000, Percentile(50) / 1000.0, Percentile(90) / 1000.0,
+            Percentile(99) / 1000.0, Percentile(99.9) / 1000.0, max() / 1000.0);
+        return buffer;
+    }
+
+    int Histogram::BucketIndex(uint64_t value)
+    {
+        if(value < kSubBucketCount) {
+            return value;
+        }
+        int msb = 63 - __builtin_clzll(value);
+        int group = msb - kSubBucketBits + 1;
+        int sub_bucket = (value >> (msb - kSubBucketBits)) & (kSubBucketCount - 1);
+        return group * kSubBucketCount + sub_bucket;
+    }
+
+    uint64_t Histogram::BucketLowerBound(int index)
+    {
+        int group = index / kSubBucketCount, sub_bucket = index % kSubBucketCount;
+        if(group == 0) {
+            return index;
+        }
+        int msb = group + kSubBucketBits - 1;
+        return (1ULL << msb) + (static_cast<uint64_t>(sub_bucket) << (msb - kSubBucketBits));
+    }
+
+    uint64_t Histogram::BucketWidth(int index)
+    {
+        int group = index / kSubBucketCount;
+        if(group == 0) {
+            return 1;
+        }
+        return 1ULL << (group - 1);
+    }
+}
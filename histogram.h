@@ -0,0 +1,92 @@
+#ifndef LSMKV_HANDOUT_HISTOGRAM_H
+#define LSMKV_HANDOUT_HISTOGRAM_H
+
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+#include <chrono>
+#include <string>
+
+namespace histogram {
+    /**
+     * @brief 对数分桶的延迟直方图（HDR风格）
+     * @details 每个2的幂区间再均分为16个子桶，记录值的相对误差不超过1/16。
+     * 记录只需两次relaxed原子加法，不加锁，可以在多个线程中并发记录。
+     * 读取的分位数是近似值，与并发的记录之间不保证一致。
+     */
+    class Histogram
+    {
+    public:
+        static const int kSubBucketBits = 4;
+        static const int kSubBucketCount = 1 << kSubBucketBits;
+        // 小于kSubBucketCount的值各占一个桶，其余每个2的幂区间占kSubBucketCount个桶
+        static const int kBucketCount = (64 - kSubBucketBits + 1) * kSubBucketCount;
+
+        Histogram();
+        Histogram(const Histogram &) = delete;
+        Histogram &operator=(const Histogram &) = delete;
+
+        /**
+         * @brief 记录一个值（通常为纳秒）
+         */
+        void Record(uint64_t value);
+
+        /**
+         * @brief 将other中的记录合并到本直方图
+         */
+        void Merge(const Histogram &other);
+
+        void Clear();
+
+        uint64_t count() const;
+        uint64_t sum() const;
+        uint64_t min() const;
+        uint64_t max() const;
+        double Average() const;
+
+        /**
+         * @brief 近似分位数
+         * @param percentile 百分位，取值[0, 100]，如99.9
+         * @return uint64_t 在所在桶内线性插值的值，不超过记录的最大值；没有记录时返回0
+         */
+        uint64_t Percentile(double percentile) const;
+
+        /**
+         * @brief 以微秒为单位输出count/avg/p50/p90/p99/p99.9/max，记录值须为纳秒
+         */
+        std::string ToString() const;
+
+    private:
+        static int BucketIndex(uint64_t value);
+        static uint64_t BucketLowerBound(int index);
+        static uint64_t BucketWidth(int index);
+
+        std::atomic<uint64_t> buckets_[kBucketCount];
+        std::atomic<uint64_t> sum_;
+        std::atomic<uint64_t> min_;
+        std::atomic<uint64_t> max_;
+    };
+
+    /**
+     * @brief 析构时将构造以来经过的纳秒数记录到直方图
+     */
+    class ScopedTimer
+    {
+    public:
+        explicit ScopedTimer(Histogram &histogram)
+            : histogram_(histogram), start_time_(std::chrono::steady_clock::now()) {}
+        ~ScopedTimer()
+        {
+            histogram_.Record(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - start_time_).count());
+        }
+        ScopedTimer(const ScopedTimer &) = delete;
+        ScopedTimer &operator=(const ScopedTimer &) = delete;
+
+    private:
+        Histogram &histogram_;
+        std::chrono::steady_clock::time_point start_time_;
+    };
+}
+
+#endif //LSMKV_HANDOUT_HISTOGRAM_H
@@ -5,6 +5,14 @@
 #ifndef LSMKV_HANDOUT_INC_H
 #define LSMKV_HANDOUT_INC_H
 #define MEM_TABLE_CAPACITY 408
-#define BLOOM_FILTER_VECTOR_SIZE (8192 * 8)
+#define MEM_TABLE_MEMORY_CAPACITY (8 * 1024 * 1024)
+#define BLOOM_FILTER_BITS_PER_KEY 10
 #define DELETED "~DELETED~"
+#define SS_TABLE_CACHE_CAPACITY (64 * 1024 * 1024)
+#define MAX_SUBCOMPACTIONS 4
+#define MIN_SUBCOMPACTION_TUPLES (2 * MEM_TABLE_CAPACITY)
+#define STATS_DUMP_PERIOD_SECONDS 0
+#define WAL_SYNC_PERIOD_MS 100
+#define V_LOG_IO_QUEUE_DEPTH 64
+#define MIN_BLOB_SIZE 0
 #endif //LSMKV_HANDOUT_INC_H
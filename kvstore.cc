@@ -6,6 +6,14 @@
 #include "utils.h"
 #include "inc.h"
 #include "ss_table_manager.h"
+#include "version.h"
+#include "manifest.h"
+#include "kvstore_iterator.h"
+#include "histogram.h"
+#include "statistics.h"
+#include "perf_context.h"
+#include "wal.h"
+#include "write_batch.h"
 #include "utils/logger.h"
 
 #include <iostream>
@@ -16,52 +24,90 @@
 #include <algorithm>
 #include <chrono>
 #include <optional>
-#include <queue>
 #include <set>
+#include <unordered_set>
+#include <fstream>
+#include <ctime>
+#include <charconv>
 
-KVStore::KVStore(const std::string &dir, const std::string &vlog)
-    : KVStoreAPI(dir, vlog), dir_(dir)
+// 与LatencyType的顺序一致
+static const char *kLatencyTypeNames[] = {"put", "get", "del", "scan", "write", "multiget", "flush", "compaction", "gc"};
+static_assert(sizeof(kLatencyTypeNames) / sizeof(kLatencyTypeNames[0]) == static_cast<size_t>(LatencyType::kCount),
+    "kLatencyTypeNames does not match LatencyType");
+
+const char *LatencyTypeName(LatencyType type)
+{
+    return kLatencyTypeNames[static_cast<int>(type)];
+}
+
+KVStore::KVStore(const std::string &dir, const std::string &vlog, const KVStoreOptions &options)
+    : KVStoreAPI(dir, vlog), dir_(dir), options_(options)
 {
     LOG_INFO("KVStore is created");
 
-    std::vector<std::string> data_dir_entry_list;
-    utils::scanDir(this->dir_, data_dir_entry_list);
+    utils::mkdir(dir_);
+    mem_table_ = std::make_shared<skip_list::SkipList>();
+    v_log_ = new v_log::VLog(vlog, options_.v_log_use_mmap, options_.v_log_io_queue_depth);
+    ss_table_manager_ = std::make_unique<ss_table::SSTableManager>(
+        options_.ss_table_cache_capacity, options_.bloom_filter_bits_per_key);
+    version_ = std::make_unique<version::Version>(dir_);
+    manifest_ = std::make_unique<version::Manifest>(dir_ + "/MANIFEST");
+    latency_histograms_ = std::make_unique<histogram::Histogram[]>(static_cast<int>(LatencyType::kCount));
+    statistics_ = std::make_unique<statistics::Statistics>();
 
-    LOG_INFO("Check SSTable files begins");
-    int level = 0;
-    while(std::find(data_dir_entry_list.begin(), data_dir_entry_list.end(), "level-" + std::to_string(level)) != data_dir_entry_list.end()) {
-        std::vector<std::string> ss_table_file_name_list;
-        // TODO: 将scanDir移到SSTableManager实现
-        utils::scanDir(this->dir_ + "/level-" + std::to_string(level), ss_table_file_name_list);
-        for (const auto &ss_table_file_name : ss_table_file_name_list)
-        {
-            if(!ss_table_file_name.ends_with(".sst")) {
-                LOG_WARNING("Invalid file in level-%d: %s found", level, ss_table_file_name);
-            }
+    bool manifest_exists = manifest_->Exists();
+    if(manifest_exists && manifest_->Recover(*version_)) {
+        LOG_INFO("Recover SSTable levels from MANIFEST");
+        v_log_->Recover(version_->v_log_head(), version_->v_log_tail());
+        RemoveObsoleteSSTableFiles();
+    } else {
+        if(manifest_exists) {
+            // MANIFEST损坏时丢弃只重放了一部分的清单，保留损坏的文件，且不删除任何SSTable文件
+            LOG_ERROR("MANIFEST is corrupted, rebuild SSTable levels from directory");
+            rename(manifest_->file_name().c_str(), (manifest_->file_name() + ".corrupted").c_str());
+            version_ = std::make_unique<version::Version>(dir_);
         }
-        ++level;
+        // 不存在MANIFEST的旧数据目录，扫描目录后写入第一份快照
+        LOG_INFO("Check SSTable files begins");
+        version_->LoadFromDirectory();
+        LOG_INFO("Check SSTable files complete");
+
+        version::VersionEdit edit;
+        edit.v_log_head = v_log_->head();
+        edit.v_log_tail = v_log_->tail();
+        version_->Apply(edit);
+        manifest_->WriteSnapshot(*version_);
     }
-    // TODO: 将SSTable文件部分加载到内存表中
-    LOG_INFO("Check SSTable files complete");
-    LOG_INFO("%d SSTable level(s) detected", level);
+    LOG_INFO("%d SSTable level(s) detected", version_->level_count());
 
-    mem_table_ = new skip_list::SkipList;
-    v_log_ = new v_log::VLog(vlog);
-    ss_table_manager_ = std::make_unique<ss_table::SSTableManager>();
+    // 即使未启用预写日志，也重放上次运行遗留的日志
+    RecoverLogFiles();
+    // 上次关闭时跳过的合并
+    compaction_scheduled_ = CheckSSTableLevelOverflow(0);
 
+    background_thread_ = std::thread(&KVStore::BackgroundWork, this);
 }
 
 KVStore::~KVStore()
 {
     LOG_INFO("KVStore is destroyed");
+
+    {
+        std::lock_guard<std::shared_mutex> lock(mutex_);
+        shutting_down_ = true;
+    }
+    background_work_cv_.notify_one();
+    background_thread_.join();
     
-    if(mem_table_->size()) {
+    if(!wal_ && mem_table_->size()) {
+        // 未启用预写日志时，内存表只能在此写入SSTable；启用时下次启动重放日志即可
         LOG_INFO("Store mem table to SSTable");
-        ConvertMemTableToSSTable();
-        DoCascadeCompaction();
+        if(ConvertMemTableToSSTable(*mem_table_)) {
+            DoCascadeCompaction();
+        }
     }
 
-    delete mem_table_;
+    wal_.reset();
     delete v_log_;
 }
 
@@ -71,13 +117,10 @@ KVStore::~KVStore()
  */
 void KVStore::put(uint64_t key, const std::string &s)
 {
-    mem_table_->Put(key, s);
-    if (mem_table_->size() == MEM_TABLE_CAPACITY)
-    {
-        ConvertMemTableToSSTable();
-        mem_table_->Reset();
-        DoCascadeCompaction();
-    }
+    histogram::ScopedTimer timer(latency_histograms_[static_cast<int>(LatencyType::kPut)]);
+    statistics_->RecordTick(statistics::Ticker::kKeysWritten);
+    statistics_->RecordTick(statistics::Ticker::kBytesWritten, sizeof(key) + s.size());
+    InsertIntoMemTable(key, s);
 }
 /**
  * Returns the (string) value of the given key.
@@ -85,22 +128,31 @@ void KVStore::put(uint64_t key, const std::string &s)
  */
 std::string KVStore::get(uint64_t key)
 {
-    std::string mem_table_get_result = mem_table_->Get(key);
-    if (mem_table_get_result == DELETED)
+    histogram::ScopedTimer timer(latency_histograms_[static_cast<int>(LatencyType::kGet)]);
+    PERF_TIMER_GUARD(get_nanos);
+    statistics_->RecordTick(statistics::Ticker::kKeysRead);
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    return GetValue(key);
+}
+
+std::string KVStore::GetValue(uint64_t key) const
+{
+    // 先查找内存表，再查找只读内存表
+    std::string result;
+    switch (GetInMemTable(key, result))
     {
+    case KeyStatus::kFound:
+        return result;
+    case KeyStatus::kDeleted:
         // 内存表中查找到删除标记
         return "";
-    }
-    if (!mem_table_get_result.empty())
-    {
-        // 内存表中查找成功
-        return mem_table_get_result;
+    case KeyStatus::kNotFound:
+    default:
+        break;
     }
 
     // 从SSTable逐层查找
-    int level = 0;
-    std::string result;
-    while (utils::dirExists(ss_table::SSTable::BuildSSTableDirName(dir_, level)))
+    for (int level = 0; level < version_->level_count(); ++level)
     {
         result = GetValueInSSTable(key, level);
         if(result == DELETED) {
@@ -112,30 +164,211 @@ std::string KVStore::get(uint64_t key)
             return result;
         }
         // 未查找到任何记录，继续查找下一层
-        ++ level;
     }
 
     return result;
 }
+
+KeyStatus KVStore::GetInMemTable(uint64_t key, std::string &value) const
+{
+    for (const skip_list::SkipList *table : {mem_table_.get(), imm_table_.get()})
+    {
+        if (!table)
+        {
+            continue;
+        }
+        std::string mem_table_get_result;
+        {
+            PERF_TIMER_GUARD(memtable_get_nanos);
+            PERF_COUNTER_ADD(memtable_get_count, 1);
+            mem_table_get_result = table->Get(key);
+        }
+        if (mem_table_get_result.empty())
+        {
+            continue;
+        }
+        statistics_->RecordTick(statistics::Ticker::kMemTableHit);
+        if (mem_table_get_result == DELETED)
+        {
+            return KeyStatus::kDeleted;
+        }
+        value = std::move(mem_table_get_result);
+        return KeyStatus::kFound;
+    }
+
+    statistics_->RecordTick(statistics::Ticker::kMemTableMiss);
+    return KeyStatus::kNotFound;
+}
+
+std::vector<std::string> KVStore::MultiGet(const std::vector<uint64_t> &keys)
+{
+    histogram::ScopedTimer timer(latency_histograms_[static_cast<int>(LatencyType::kMultiGet)]);
+    statistics_->RecordTick(statistics::Ticker::kKeysRead, keys.size());
+    std::vector<uint64_t> sorted_keys(keys);
+    std::sort(sorted_keys.begin(), sorted_keys.end());
+    sorted_keys.erase(std::unique(sorted_keys.begin(), sorted_keys.end()), sorted_keys.end());
+    std::vector<std::string> sorted_values(sorted_keys.size());
+    {
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        MultiGetValue(sorted_keys, sorted_values);
+    }
+
+    std::vector<std::string> values(keys.size());
+    for(size_t i = 0; i < keys.size(); ++i) {
+        size_t index = std::lower_bound(sorted_keys.begin(), sorted_keys.end(), keys[i]) - sorted_keys.begin();
+        values[i] = sorted_values[index];
+    }
+    return values;
+}
+
+void KVStore::MultiGetValue(const std::vector<uint64_t> &sorted_keys, std::vector<std::string> &values) const
+{
+    // 尚未找到记录的键在sorted_keys中的下标，保持升序
+    std::vector<size_t> pending;
+    for(size_t i = 0; i < sorted_keys.size(); ++i) {
+        if(GetInMemTable(sorted_keys[i], values[i]) == KeyStatus::kNotFound) {
+            pending.push_back(i);
+        }
+    }
+    std::vector<std::optional<ss_table::SSTableGetResult>> results(sorted_keys.size());
+    MultiGetInSSTables(sorted_keys, pending, results);
+
+    // 找到删除标记的键结果为""，VLog中的值最后批量读取
+    std::vector<v_log::VLogReadRequest> requests;
+    for(size_t i: pending) {
+        if(!results[i].has_value()) {
+            continue;
+        }
+        if(ss_table::IsInlineValue(results[i]->vlen)) {
+            values[i] = std::move(results[i]->inline_value);
+        } else if(results[i]->vlen) {
+            requests.push_back({results[i]->offset, results[i]->vlen, &values[i]});
+        }
+    }
+    v_log_->MultiGet(requests);
+}
+
+void KVStore::MultiGetInSSTables(
+    const std::vector<uint64_t> &sorted_keys,
+    std::vector<size_t> pending,
+    std::vector<std::optional<ss_table::SSTableGetResult>> &results
+) const {
+    for(int level = 0; level < version_->level_count() && !pending.empty(); ++level) {
+        const auto &files = version_->files(level);
+        if(version_->IsDisjoint(level)) {
+            // 文件按键升序排列，与升序的键归并，每个文件至多加载一次
+            size_t file_index = 0;
+            size_t loaded_file_index = files.size();
+            std::shared_ptr<ss_table::SSTable> ss_table;
+            for(size_t index: pending) {
+                uint64_t key = sorted_keys[index];
+                while(file_index < files.size() && files[file_index].header.max_key < key) {
+                    ++ file_index;
+                }
+                if(file_index == files.size()) {
+                    break;
+                }
+                if(key < files[file_index].header.min_key) {
+                    continue;
+                }
+                if(loaded_file_index != file_index) {
+                    PERF_TIMER_GUARD(metadata_nanos);
+                    ss_table = ss_table_manager_->FromFile(files[file_index].ss_table_file_name);
+                    loaded_file_index = file_index;
+                }
+                if(ss_table) {
+                    results[index] = ProbeSSTable(*ss_table, key, level);
+                }
+            }
+        } else {
+            // 文件可能重叠，对每个文件查找其键范围内的键，取时间戳最大的记录
+            std::vector<uint64_t> latest_time_stamps(pending.size(), std::numeric_limits<uint64_t>::min());
+            for(const auto &meta_data: files) {
+                size_t j = std::lower_bound(pending.begin(), pending.end(), meta_data.header.min_key,
+                    [&sorted_keys](size_t index, uint64_t key) { return sorted_keys[index] < key; }) - pending.begin();
+                std::shared_ptr<ss_table::SSTable> ss_table;
+                for(; j < pending.size() && sorted_keys[pending[j]] <= meta_data.header.max_key; ++j) {
+                    if(meta_data.header.time_stamp <= latest_time_stamps[j]) {
+                        continue;
+                    }
+                    if(!ss_table) {
+                        PERF_TIMER_GUARD(metadata_nanos);
+                        ss_table = ss_table_manager_->FromFile(meta_data.ss_table_file_name);
+                        if(!ss_table) {
+                            break;
+                        }
+                    }
+                    auto ss_table_get_res = ProbeSSTable(*ss_table, sorted_keys[pending[j]], level);
+                    if(ss_table_get_res.has_value()) {
+                        results[pending[j]] = std::move(ss_table_get_res);
+                        latest_time_stamps[j] = meta_data.header.time_stamp;
+                    }
+                }
+            }
+        }
+
+        // 找到记录（值或删除标记）的键不再查找下一层
+        size_t remaining = 0;
+        for(size_t index: pending) {
+            if(!results[index].has_value()) {
+                pending[remaining++] = index;
+            }
+        }
+        pending.resize(remaining);
+    }
+}
 /**
  * Delete the given key-value pair if it exists.
  * Returns false iff the key is not found.
  */
 bool KVStore::del(uint64_t key)
 {
-    if (this->get(key).empty())
+    histogram::ScopedTimer timer(latency_histograms_[static_cast<int>(LatencyType::kDel)]);
     {
-        return false;
+        // 不经过get，避免计入get的延迟
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        if (GetValue(key).empty())
+        {
+            return false;
+        }
     }
+    statistics_->RecordTick(statistics::Ticker::kKeysWritten);
+    statistics_->RecordTick(statistics::Ticker::kBytesWritten, sizeof(key));
 
-    mem_table_->Put(key, DELETED);
-    if (mem_table_->size() == MEM_TABLE_CAPACITY)
+    InsertIntoMemTable(key, DELETED);
+    return true;
+}
+
+void KVStore::Write(const WriteBatch &batch)
+{
+    if(!batch.Count()) {
+        return ;
+    }
+    histogram::ScopedTimer timer(latency_histograms_[static_cast<int>(LatencyType::kWrite)]);
+    uint64_t bytes_written = 0;
     {
-        ConvertMemTableToSSTable();
-        mem_table_->Reset();
-        DoCascadeCompaction();
+        // 独占期间读者看不到部分写入的批次，也不会转换内存表；单键写入者仍可并发写入，新旧由序列号决定
+        std::unique_lock<std::shared_mutex> lock(mutex_);
+        if(MemTableFull(batch.Count(), batch.ApproximateSize())) {
+            // 批次放不下时先转换内存表，使整个批次属于同一个内存表与日志
+            MakeImmutableMemTable(lock, true);
+        }
+        // 批次中的记录共用一个序列号，同一个键以批次中最后一次修改为准
+        auto apply = [this, &batch, &bytes_written](uint64_t sequence) {
+            batch.Iterate([this, &bytes_written, sequence](uint64_t key, std::string_view val) {
+                bytes_written += sizeof(key) + (val == DELETED ? 0 : val.size());
+                mem_table_->Put(key, std::string(val), sequence);
+            });
+        };
+        if(!wal_) {
+            apply(++ mem_table_sequence_);
+        } else if(!wal_->AddRecord(batch.rep(), apply)) {
+            LOG_ERROR("Failed to write WAL");
+        }
+        MakeImmutableMemTable(lock);
     }
-    return true;
+    statistics_->RecordTick(statistics::Ticker::kKeysWritten, batch.Count());
+    statistics_->RecordTick(statistics::Ticker::kBytesWritten, bytes_written);
 }
 
 /**
@@ -144,10 +377,28 @@ bool KVStore::del(uint64_t key)
  */
 void KVStore::reset()
 {
-    // 清空内存表
-    mem_table_->Reset();
-    // 清空SSTableManager缓存
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    WaitForBackgroundWork(lock);
+    LockAllWriters();
+
+    // 清空内存表（迭代器可能仍持有旧内存表）
+    mem_table_ = std::make_shared<skip_list::SkipList>();
+    // 删除所有预写日志
+    wal_.reset();
+    std::vector<std::string> base_file_name_list;
+    utils::scanDir(dir_, base_file_name_list);
+    for(const auto &base_file_name: base_file_name_list) {
+        uint64_t number;
+        if(wal::ParseLogFileName(base_file_name, number) && utils::rmfile(wal::BuildLogFileName(dir_, number)) < 0) {
+            LOG_WARNING("Failed to remove WAL file %s", base_file_name.c_str());
+        }
+    }
+    // 清空SSTableManager缓存，推迟删除的文件随下面的目录一并删除
     ss_table_manager_->ResetCache();
+    {
+        std::lock_guard<std::mutex> compacted_files_lock(compacted_files_mutex_);
+        compacted_files_.clear();
+    }
 
     // 删除所有SSTable文件及其目录
     int level = 0;
@@ -167,6 +418,17 @@ void KVStore::reset()
     
     // 重置VLog
     v_log_->Reset();
+
+    // 清空层级清单，并以空快照重写MANIFEST
+    version::VersionEdit edit;
+    edit.v_log_head = v_log_->head();
+    edit.v_log_tail = v_log_->tail();
+    version_->Clear();
+    NewLogFile();
+    edit.log_number = log_number_;
+    version_->Apply(edit);
+    manifest_->WriteSnapshot(*version_);
+    UnlockAllWriters();
 }
 
 /**
@@ -176,86 +438,191 @@ void KVStore::reset()
  */
 void KVStore::scan(uint64_t key1, uint64_t key2, std::list<std::pair<uint64_t, std::string>> &list)
 {
-    std::list<std::pair<uint64_t, std::string>> mem_table_list;
-    mem_table_->Scan(key1, key2, mem_table_list);
+    histogram::ScopedTimer timer(latency_histograms_[static_cast<int>(LatencyType::kScan)]);
+    PERF_TIMER_GUARD(scan_nanos);
+    // 内存表中的值直接取出，SSTable中的值记下位置，最后批量读取VLog
+    std::vector<std::pair<ss_table::KeyOffsetVlenTuple, std::string*>> pending_values;
+    auto iterator = NewIterator();
+    for (iterator->Seek(key1); iterator->Valid() && iterator->key() <= key2; iterator->Next())
+    {
+        if(iterator->current_source_ == KVStoreIterator::Source::kSSTable
+            && !ss_table::IsInlineValue(iterator->current_tuple().vlen)) {
+            list.emplace_back(iterator->key(), "");
+            pending_values.emplace_back(iterator->current_tuple(), &list.back().second);
+        } else {
+            list.emplace_back(iterator->key(), iterator->value());
+        }
+    }
+    if(pending_values.empty()) {
+        return ;
+    }
 
-    // 从SSTable逐层查找
-    // TODO: copied from other functions, refactor it
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    std::vector<v_log::VLogReadRequest> requests;
+    for(const auto &[tuple, val]: pending_values) {
+        if(tuple.offset < v_log_->tail()) {
+            // 值已被垃圾回收重新写入VLog头部，重新查找该键
+            *val = GetValue(tuple.key);
+        } else {
+            requests.push_back({tuple.offset, tuple.vlen, val});
+        }
+    }
+    v_log_->MultiGet(requests);
+}
 
-    int level = 0;
-    std::vector<std::shared_ptr<ss_table::SSTable>> ss_table_list;
-    // 从level-0开始扫描SSTable文件，将所有与[key1, key2]有交集的SSTable文件读入内存
-    while (utils::dirExists(ss_table::SSTable::BuildSSTableDirName(dir_, level)))
+std::unique_ptr<KVStoreIterator> KVStore::NewIterator()
+{
+    return std::unique_ptr<KVStoreIterator>(new KVStoreIterator(this));
+}
+
+void KVStore::PinSSTableFiles()
+{
+    std::lock_guard<std::mutex> lock(compacted_files_mutex_);
+    ++ pinned_iterator_count_;
+}
+
+void KVStore::UnpinSSTableFiles()
+{
+    std::vector<std::string> file_name_list;
     {
-        LoadSSTablesInRangeToMemory(level, key1, key2, ss_table_list);
-        ++ level;
+        std::lock_guard<std::mutex> lock(compacted_files_mutex_);
+        if(-- pinned_iterator_count_ == 0) {
+            file_name_list.swap(compacted_files_);
+        }
+    }
+    if(!file_name_list.empty()) {
+        ss_table_manager_->DeleteSSTableFiles(file_name_list);
     }
+}
 
-    // 将所有SSTable的索引打上时间戳、SSTable索引，放入优先队列
-    auto cmp = [](const ss_table::TimeStampedKeyOffsetVlenTuple &a, const ss_table::TimeStampedKeyOffsetVlenTuple &b) {
-        return a.key_offset_vlen_tuple.key > b.key_offset_vlen_tuple.key 
-            || (a.key_offset_vlen_tuple.key == b.key_offset_vlen_tuple.key && a.time_stamp > b.time_stamp)
-            || (a.key_offset_vlen_tuple.key == b.key_offset_vlen_tuple.key && a.time_stamp == b.time_stamp && a.ss_table_index < b.ss_table_index);
-    };
-    std::priority_queue<
-        ss_table::TimeStampedKeyOffsetVlenTuple,
-        std::vector<ss_table::TimeStampedKeyOffsetVlenTuple>,
-        decltype(cmp)
-    > pq(cmp);
-    size_t ss_table_index = 0;
-    for (const auto &ss_table : ss_table_list)
+void KVStore::DeleteCompactedSSTableFiles(const std::vector<std::string> &file_name_list)
+{
     {
-        for (const auto &tuple : ss_table->key_offset_vlen_tuple_list())
-        {
-            if(tuple.key >= key1 && tuple.key <= key2) {
-                pq.emplace(ss_table->header().time_stamp, tuple, ss_table_index);
-            }
+        std::lock_guard<std::mutex> lock(compacted_files_mutex_);
+        if(pinned_iterator_count_) {
+            // 存活的迭代器可能还会加载这些文件
+            compacted_files_.insert(compacted_files_.end(), file_name_list.begin(), file_name_list.end());
+            return ;
         }
-        ++ ss_table_index;
     }
+    ss_table_manager_->DeleteSSTableFiles(file_name_list);
+}
+
+const histogram::Histogram &KVStore::latency_histogram(LatencyType type) const
+{
+    return latency_histograms_[static_cast<int>(type)];
+}
 
-    // 使用优先级队列进行合并
-    std::vector<ss_table::TimeStampedKeyOffsetVlenTuple> merged_results;
-    while (!pq.empty()) {
-        auto current = pq.top();
-        pq.pop();
+const statistics::Statistics &KVStore::statistics() const
+{
+    return *statistics_;
+}
 
-        // 取出key相同的元组中，优先级最低的元组
-        while (!pq.empty() && pq.top().key_offset_vlen_tuple.key == current.key_offset_vlen_tuple.key) {
-            current = pq.top();
-            pq.pop();
+bool KVStore::GetProperty(const std::string &property, std::string &value)
+{
+    static const std::string kNumFilesAtLevelPrefix = "lsmkv.num-files-at-level";
+    value.clear();
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    if(property.rfind(kNumFilesAtLevelPrefix, 0) == 0) {
+        const char *first = property.data() + kNumFilesAtLevelPrefix.size();
+        const char *last = property.data() + property.size();
+        int level;
+        auto [ptr, ec] = std::from_chars(first, last, level);
+        if(ec != std::errc() || ptr != last || level < 0 || level >= version_->level_count()) {
+            return false;
         }
+        value = std::to_string(version_->file_count(level));
+        return true;
+    }
 
-        merged_results.push_back(current);
+    uint64_t bottommost_level_bytes = 0;
+    if(property == "lsmkv.levelstats") {
+        AppendLevelStats(value, bottommost_level_bytes);
+        return true;
+    }
+    if(property != "lsmkv.stats") {
+        return false;
     }
 
-    // 将内存表扫描结果与SSTable扫描结果合并
-    std::set<uint64_t> scanned_mem_table_keys;
-    for(const auto &mem_table_pair: mem_table_list) {
-        scanned_mem_table_keys.insert(mem_table_pair.first);
-        if(mem_table_pair.second != DELETED) {
-            // 在内存表中找到有效值
-            scanned_mem_table_keys.insert(mem_table_pair.first);
-            list.push_back(mem_table_pair);
-        }
+    char buffer[256];
+    value += "** Level stats **\n";
+    uint64_t ss_table_bytes = AppendLevelStats(value, bottommost_level_bytes);
+    uint64_t v_log_bytes = v_log_->head() - v_log_->tail();
+
+    // 写放大：写入文件的字节数（内存表写入、VLog、合并输出）与用户写入字节数之比
+    // 空间放大：所有SSTable与最下面一个非空层的字节数之比，最下层近似于有效键的集合
+    uint64_t user_bytes = statistics_->ticker(statistics::Ticker::kBytesWritten);
+    uint64_t written_bytes = statistics_->ticker(statistics::Ticker::kFlushBytesWritten)
+        + statistics_->ticker(statistics::Ticker::kVLogBytesWritten)
+        + statistics_->ticker(statistics::Ticker::kCompactionBytesWritten);
+    snprintf(buffer, sizeof(buffer),
+        "** Amplification **\n"
+        "write amplification: %.3f\n"
+        "space amplification (SSTable): %.3f\n"
+        "vlog bytes: %lu (head %lu, tail %lu)\n",
+        user_bytes ? static_cast<double>(written_bytes) / user_bytes : 0.0,
+        bottommost_level_bytes ? static_cast<double>(ss_table_bytes) / bottommost_level_bytes : 0.0,
+        v_log_bytes, v_log_->head(), v_log_->tail());
+    value += buffer;
+
+    value += "** Tickers **\n";
+    value += statistics_->ToString();
+
+    ss_table::CacheStatistics cache_statistics = ss_table_manager_->cache_statistics();
+    snprintf(buffer, sizeof(buffer),
+        "** SSTable cache **\n"
+        "hits: %lu\nmisses: %lu\nevictions: %lu\nusage: %zu\ncapacity: %zu\n",
+        cache_statistics.hits, cache_statistics.misses, cache_statistics.evictions,
+        cache_statistics.usage, cache_statistics.capacity);
+    value += buffer;
+
+    value += "** Latency **\n";
+    for(int i = 0; i < static_cast<int>(LatencyType::kCount); ++i) {
+        value += kLatencyTypeNames[i];
+        value += ": ";
+        value += latency_histograms_[i].ToString();
+        value += "\n";
     }
+    return true;
+}
 
-    for(const auto &time_stamped_tuple: merged_results) {
-        if(
-            std::find(scanned_mem_table_keys.begin(),
-            scanned_mem_table_keys.end(),
-            time_stamped_tuple.key_offset_vlen_tuple.key) != scanned_mem_table_keys.end()
-        ) {
-            // 内存表中已经存在该键（有效值或者删除标记）
-                continue;
+uint64_t KVStore::AppendLevelStats(std::string &value, uint64_t &bottommost_level_bytes) const
+{
+    char buffer[128];
+    uint64_t total_bytes = 0;
+    bottommost_level_bytes = 0;
+    value += "level  files  keys  bytes\n";
+    for(int level = 0; level < version_->level_count(); ++level) {
+        uint64_t key_count = 0, level_bytes = 0;
+        for(const auto &meta_data: version_->files(level)) {
+            key_count += meta_data.header.key_count;
+            int64_t file_size = utils::fileSize(meta_data.ss_table_file_name);
+            level_bytes += file_size > 0 ? file_size : 0;
         }
-        if(!time_stamped_tuple.key_offset_vlen_tuple.vlen) {
-            // 在SSTable中找到删除标记
-            continue;
+        snprintf(buffer, sizeof(buffer), "%5d  %5zu  %lu  %lu\n",
+            level, version_->file_count(level), key_count, level_bytes);
+        value += buffer;
+        total_bytes += level_bytes;
+        if(level_bytes) {
+            bottommost_level_bytes = level_bytes;
         }
-        list.push_back(std::make_pair(time_stamped_tuple.key_offset_vlen_tuple.key, 
-            v_log_->Get(time_stamped_tuple.key_offset_vlen_tuple.offset, time_stamped_tuple.key_offset_vlen_tuple.vlen)));
     }
+    return total_bytes;
+}
+
+void KVStore::DumpStatistics()
+{
+    std::string stats;
+    GetProperty("lsmkv.stats", stats);
+    std::ofstream fout(dir_ + "/STATS", std::ios::out | std::ios::app);
+    if(!fout) {
+        LOG_WARNING("Failed to open STATS file");
+        return ;
+    }
+    char time_buffer[64];
+    time_t now = time(nullptr);
+    strftime(time_buffer, sizeof(time_buffer), "%Y-%m-%d %H:%M:%S", localtime(&now));
+    fout << "==== " << time_buffer << " ====\n" << stats << "\n";
 }
 
 /**
@@ -264,52 +631,469 @@ void KVStore::scan(uint64_t key1, uint64_t key2, std::list<std::pair<uint64_t, s
  */
 void KVStore::gc(uint64_t chunk_size)
 {
-    std::vector<v_log::DeallocVLogEntryInfo> dealloc_entries;
-    v_log_->DeallocSpace(chunk_size, dealloc_entries);
-    for(const auto &entry: dealloc_entries) {
-        if(!IsVLogEntryOutdated(entry.key, entry.offset)) {
-            mem_table_->Put(entry.key, entry.val);
+    histogram::ScopedTimer timer(latency_histograms_[static_cast<int>(LatencyType::kGc)]);
+    {
+        // 后台线程写入VLog与修改层级清单时不加锁，须等待其空闲，并在回收期间暂停后台任务；
+        // 等待时释放mutex_，读写不受影响
+        std::unique_lock<std::shared_mutex> lock(mutex_);
+        WaitForBackgroundWork(lock);
+        gc_running_ = true;
+    }
+    statistics_->RecordTick(statistics::Ticker::kGcCount);
+    bool relocated = GarbageCollect(chunk_size);
+
+    std::lock_guard<std::shared_mutex> lock(mutex_);
+    gc_running_ = false;
+    if(relocated) {
+        compaction_scheduled_ = true;
+    }
+    background_work_cv_.notify_one();
+    background_done_cv_.notify_all();
+}
+
+bool KVStore::GarbageCollect(uint64_t chunk_size)
+{
+    std::vector<v_log::DeallocVLogEntryInfo> live_entries;
+    uint64_t new_tail;
+    {
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        std::vector<v_log::DeallocVLogEntryInfo> dealloc_entries;
+        if(!v_log_->ReadTailChunk(chunk_size, dealloc_entries, new_tail) || new_tail == v_log_->tail()) {
+            return false;
+        }
+        std::vector<bool> outdated;
+        MarkOutdatedVLogEntries(dealloc_entries, outdated);
+        for(size_t i = 0; i < dealloc_entries.size(); ++i) {
+            if(!outdated[i]) {
+                live_entries.push_back(std::move(dealloc_entries[i]));
+            }
         }
     }
-    
-    ConvertMemTableToSSTable();
-    mem_table_->Reset();
-    DoCascadeCompaction();
+    std::sort(live_entries.begin(), live_entries.end(),
+        [](const v_log::DeallocVLogEntryInfo &a, const v_log::DeallocVLogEntryInfo &b) { return a.key < b.key; });
+
+    // 有效的值通过一次写入追加到VLog头部（短值内联）；后台线程已暂停，只有本线程追加VLog，无须加锁
+    uint64_t old_v_log_head = v_log_->head();
+    std::vector<ss_table::KeyOffsetVlenTuple> relocated_tuples;
+    std::string inline_values;
+    for(const auto &entry: live_entries) {
+        if(entry.val.size() < options_.min_blob_size) {
+            relocated_tuples.emplace_back(entry.key, inline_values.size(), ss_table::kInlineValueFlag | entry.val.size());
+            inline_values.append(entry.val);
+        } else {
+            relocated_tuples.emplace_back(entry.key, v_log_->Append(entry.key, entry.val), entry.val.size());
+        }
+    }
+    v_log_->Flush();
+    if(v_log_->head() != old_v_log_head) {
+        v_log_->Sync();
+    }
+    statistics_->RecordTick(statistics::Ticker::kVLogBytesWritten, v_log_->head() - old_v_log_head);
+
+    uint64_t sequence = 0;
+    if(!live_entries.empty()) {
+        // 重新写入期间前台可能覆盖或删除了其中的键，只保留仍然有效的指针；
+        // 独占期间内存表不会被替换，之后写入的键所在的内存表在写入level-0时序列号更大，不会被新的指针覆盖
+        std::lock_guard<std::shared_mutex> lock(mutex_);
+        std::vector<bool> outdated;
+        MarkOutdatedVLogEntries(live_entries, outdated);
+        size_t kept = 0;
+        for(size_t i = 0; i < relocated_tuples.size(); ++i) {
+            if(!outdated[i]) {
+                relocated_tuples[kept++] = relocated_tuples[i];
+                statistics_->RecordTick(statistics::Ticker::kGcBytesRelocated, live_entries[i].val.size());
+            }
+        }
+        relocated_tuples.erase(relocated_tuples.begin() + kept, relocated_tuples.end());
+        sequence = version_->AllocateSequence();
+    }
+
+    // 新的指针按键排序后写入level-0的单个SSTable，落盘并记录到MANIFEST之后才能回收旧的空间
+    version::VersionEdit edit;
+    if(!relocated_tuples.empty()) {
+        std::string base_file_name = std::to_string(sequence) + ".sst";
+        utils::mkdir(ss_table::SSTable::BuildSSTableDirName(dir_, 0));
+        auto ss_table = ss_table_manager_->NewSSTable(
+            ss_table::SSTable::BuildSSTableFileName(dir_, 0, base_file_name),
+            sequence,
+            relocated_tuples,
+            std::move(inline_values)
+        );
+        ss_table_manager_->WriteSSTableToFile(ss_table);
+        edit.AddFile(0, ss_table->header(), base_file_name);
+    }
+    edit.v_log_head = v_log_->head();
+    edit.v_log_tail = new_tail;
+    SyncAddedFiles(edit);
+    edit.next_sequence = version_->next_sequence();
+    if(!manifest_->Append(edit)) {
+        // 不回收旧的空间；新的SSTable未被记录，下次启动时删除
+        LOG_ERROR("Failed to log GC, keep vLog tail at %lu", v_log_->tail());
+        return false;
+    }
+
+    // 只在应用新的指针与回收空间时独占，读者不会看到指向已回收空间的指针
+    std::lock_guard<std::shared_mutex> lock(mutex_);
+    version_->Apply(edit);
+    if(manifest_->NeedsSnapshot()) {
+        manifest_->WriteSnapshot(*version_);
+    }
+    uint64_t old_tail = v_log_->tail();
+    v_log_->DeallocSpace(new_tail);
+    statistics_->RecordTick(statistics::Ticker::kGcBytesReclaimed, new_tail - old_tail);
+    return !relocated_tuples.empty();
+}
+
+void KVStore::InsertIntoMemTable(uint64_t key, const std::string &val)
+{
+    {
+        // 内存表支持并发写入，写入者只持有本线程的写入者锁；并发写入者的日志记录组提交
+        std::shared_lock<std::shared_mutex> lock(ThreadWriterLock());
+        WriteToLogAndMemTable(key, val);
+        if(!MemTableFull()) {
+            return ;
+        }
+    }
+    // 转换内存表时须独占，保证只读内存表不再被写入
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    MakeImmutableMemTable(lock);
+}
+
+bool KVStore::MemTableFull(size_t pending_keys, size_t pending_bytes) const
+{
+    // 覆盖写入只替换值指针，旧值留在Arena中，只按键数计量时反复更新热点键会使内存无限增长
+    return mem_table_->size() + pending_keys >= MEM_TABLE_CAPACITY
+        || mem_table_->memory_usage() + pending_bytes >= options_.mem_table_memory_capacity;
+}
+
+void KVStore::MakeImmutableMemTable(std::unique_lock<std::shared_mutex> &lock, bool force)
+{
+    if(!MemTableFull() && !(force && mem_table_->size())) {
+        return ;
+    }
+    // 上一个只读内存表尚未写入完成时，阻塞写入
+    background_done_cv_.wait(lock, [this] { return imm_table_ == nullptr; });
+    // 等待正在写入旧内存表与旧日志的线程完成，之后的写入者看到新的内存表与日志
+    LockAllWriters();
+    imm_table_ = mem_table_;
+    mem_table_ = std::make_shared<skip_list::SkipList>();
+    NewLogFile();
+    UnlockAllWriters();
+    background_work_cv_.notify_one();
 }
 
-void KVStore::ConvertMemTableToSSTable()
+std::shared_mutex &KVStore::ThreadWriterLock()
 {
+    // 每个线程第一次写入时轮流分配一个写入者锁
+    static std::atomic<unsigned> next_stripe = 0;
+    thread_local unsigned stripe = next_stripe++ % kWriterLockStripes;
+    return writer_locks_[stripe].mutex;
+}
+
+void KVStore::LockAllWriters()
+{
+    for(auto &writer_lock: writer_locks_) {
+        writer_lock.mutex.lock();
+    }
+}
+
+void KVStore::UnlockAllWriters()
+{
+    for(auto &writer_lock: writer_locks_) {
+        writer_lock.mutex.unlock();
+    }
+}
+
+void KVStore::NewLogFile()
+{
+    log_number_ = version_->AllocateSequence();
+    if(options_.use_wal) {
+        // 旧日志在析构时同步并关闭
+        wal_ = std::make_unique<wal::LogWriter>(
+            wal::BuildLogFileName(dir_, log_number_), options_.wal_sync_mode, options_.wal_sync_period_ms);
+    }
+}
+
+void KVStore::WriteToLogAndMemTable(uint64_t key, const std::string &val)
+{
+    if(!wal_) {
+        mem_table_->Put(key, val, ++ mem_table_sequence_);
+        return ;
+    }
+    std::string payload;
+    wal::EncodeEntry(payload, key, val);
+    // 组提交写入日志后，本线程以记录的序列号写入内存表，与同组其他线程并发执行
+    if(!wal_->AddRecord(payload, [this, key, &val](uint64_t sequence) { mem_table_->Put(key, val, sequence); })) {
+        LOG_ERROR("Failed to write WAL");
+    }
+}
+
+void KVStore::RecoverLogFiles()
+{
+    std::vector<std::string> base_file_name_list;
+    utils::scanDir(dir_, base_file_name_list);
+    std::vector<uint64_t> log_numbers;
+    for(const auto &base_file_name: base_file_name_list) {
+        uint64_t number;
+        if(wal::ParseLogFileName(base_file_name, number)) {
+            log_numbers.push_back(number);
+        }
+    }
+    std::sort(log_numbers.begin(), log_numbers.end());
+
+    if(!log_numbers.empty()) {
+        // MANIFEST中的序列号可能落后于崩溃前创建的日志，新日志的编号须大于所有旧日志
+        version::VersionEdit edit;
+        edit.next_sequence = log_numbers.back() + 1;
+        version_->Apply(edit);
+    }
+    NewLogFile();
+
+    // 按日志顺序重放，序列号跨日志递增
+    uint64_t sequence = 0;
+    for(uint64_t number: log_numbers) {
+        if(number < version_->log_number()) {
+            continue;
+        }
+        std::string file_name = wal::BuildLogFileName(dir_, number);
+        LOG_INFO("Replay WAL file %s", file_name.c_str());
+        wal::ReadLog(file_name, [this, &file_name, &sequence](std::string_view payload) {
+            ++ sequence;
+            bool ok = wal::DecodeEntries(payload, [this, sequence](uint64_t key, std::string_view val) {
+                mem_table_->Put(key, std::string(val), sequence);
+            });
+            if(!ok) {
+                LOG_WARNING("Corrupted WAL payload in %s", file_name.c_str());
+            }
+        });
+    }
+
+    if(mem_table_->size()) {
+        // 写入level-0，并将日志编号推进到新日志，旧日志随后删除；
+        // 失败时日志编号不变，重放的键值对留在内存表中，随下一次写入level-0
+        if(ConvertMemTableToSSTable(*mem_table_)) {
+            mem_table_ = std::make_shared<skip_list::SkipList>();
+        }
+    } else if(!log_numbers.empty()) {
+        version::VersionEdit edit;
+        edit.log_number = log_number_;
+        LogAndApply(edit);
+    }
+    RemoveObsoleteLogFiles();
+}
+
+void KVStore::RemoveObsoleteLogFiles()
+{
+    std::vector<std::string> base_file_name_list;
+    utils::scanDir(dir_, base_file_name_list);
+    for(const auto &base_file_name: base_file_name_list) {
+        uint64_t number;
+        if(!wal::ParseLogFileName(base_file_name, number) || number >= version_->log_number()) {
+            continue;
+        }
+        if(utils::rmfile(wal::BuildLogFileName(dir_, number)) < 0) {
+            LOG_WARNING("Failed to remove WAL file %s", base_file_name.c_str());
+        }
+    }
+}
+
+void KVStore::BackgroundWork()
+{
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    auto has_work = [this] {
+        // 垃圾回收期间暂停，其结束时唤醒后台线程
+        return !gc_running_ && (imm_table_ || compaction_scheduled_ || shutting_down_);
+    };
+    const std::chrono::seconds stats_dump_period(options_.stats_dump_period_seconds);
+    auto next_stats_dump_time = std::chrono::steady_clock::now() + stats_dump_period;
+    while(true) {
+        if(stats_dump_period.count() == 0) {
+            background_work_cv_.wait(lock, has_work);
+        } else {
+            background_work_cv_.wait_until(lock, next_stats_dump_time, has_work);
+            // 后台任务繁忙时也按时输出
+            if(std::chrono::steady_clock::now() >= next_stats_dump_time) {
+                lock.unlock();
+                DumpStatistics();
+                lock.lock();
+                next_stats_dump_time = std::chrono::steady_clock::now() + stats_dump_period;
+            }
+            if(!has_work()) {
+                continue;
+            }
+        }
+        background_busy_ = true;
+        if(imm_table_) {
+            // 优先写入只读内存表，使前台写入尽快恢复
+            lock.unlock();
+            bool flushed = FlushImmutableMemTable();
+            lock.lock();
+            if(flushed) {
+                compaction_scheduled_ = true;
+            } else if(shutting_down_) {
+                // 只读内存表仍在预写日志中，下次启动时重放
+                background_busy_ = false;
+                break;
+            } else {
+                // 稍后重试，期间前台写入等待只读内存表释放
+                background_work_cv_.wait_for(lock, std::chrono::seconds(1), [this] { return shutting_down_; });
+            }
+        } else if(compaction_scheduled_ && !shutting_down_) {
+            // 关闭时跳过合并，下次启动时重新调度
+            compaction_scheduled_ = false;
+            lock.unlock();
+            DoCascadeCompaction();
+            lock.lock();
+        } else {
+            // shutting_down_，且没有剩余的后台任务
+            background_busy_ = false;
+            break;
+        }
+        background_busy_ = false;
+        background_done_cv_.notify_all();
+    }
+    background_done_cv_.notify_all();
+}
+
+bool KVStore::FlushImmutableMemTable()
+{
+    if(!ConvertMemTableToSSTable(*imm_table_)) {
+        return false;
+    }
+    RemoveObsoleteLogFiles();
+
+    std::lock_guard<std::shared_mutex> lock(mutex_);
+    imm_table_.reset();
+    return true;
+}
+
+void KVStore::WaitForBackgroundWork(std::unique_lock<std::shared_mutex> &lock)
+{
+    background_done_cv_.wait(lock, [this] {
+        return !imm_table_ && !compaction_scheduled_ && !background_busy_ && !gc_running_;
+    });
+}
+
+bool KVStore::ConvertMemTableToSSTable(const skip_list::SkipList &mem_table)
+{
+    histogram::ScopedTimer timer(latency_histograms_[static_cast<int>(LatencyType::kFlush)]);
+    uint64_t old_v_log_head = v_log_->head();
     utils::mkdir(dir_ + "/level-0");
     // 准备inserted_tuples
     std::vector<ss_table::KeyOffsetVlenTuple> inserted_tuples;
+    std::string inline_values;
     uint64_t v_log_offset;  // 写入VLog的偏移量
-    for(auto it = mem_table_->begin(); it != mem_table_->end(); ++it) {
+    for(auto it = mem_table.begin(); it != mem_table.end(); ++it) {
         if((*it).val() == DELETED) {
             inserted_tuples.emplace_back((*it).key(), 0, 0);
+        } else if((*it).val().size() < options_.min_blob_size) {
+            // 短值内联存储在SSTable中
+            inserted_tuples.emplace_back((*it).key(), inline_values.size(), ss_table::kInlineValueFlag | (*it).val().size());
+            inline_values.append((*it).val());
         } else {
-            v_log_offset = v_log_->Insert((*it).key(), (*it).val());
+            v_log_offset = v_log_->Append((*it).key(), (*it).val());
             inserted_tuples.emplace_back((*it).key(), v_log_offset, (*it).val().size());
         }
     }
+    // 整个内存表的VLog entry通过一次写入追加到文件，并在记录到MANIFEST之前落盘；
+    // 否则掉电后MANIFEST与SSTable可能引用丢失的值，而保存这些值的预写日志已经删除
+    v_log_->Flush();
+    if(v_log_->head() != old_v_log_head) {
+        v_log_->Sync();
+    }
 
     // 将SSTable写入文件
-    uint64_t now = std::chrono::system_clock::now().time_since_epoch().count();
+    uint64_t sequence = version_->AllocateSequence();
+    std::string base_file_name = std::to_string(sequence) + ".sst";
     auto ss_table = ss_table_manager_->NewSSTable(
         ss_table::SSTable::BuildSSTableFileName(
             dir_, 
             0, 
-            std::to_string(now) + ".sst"
+            base_file_name
         ),
-        now,
-        inserted_tuples
+        sequence,
+        inserted_tuples,
+        std::move(inline_values)
     );
     ss_table_manager_->WriteSSTableToFile(ss_table);
+    statistics_->RecordTick(statistics::Ticker::kFlushCount);
+    statistics_->RecordTick(statistics::Ticker::kFlushBytesWritten, ss_table->file_size());
+    statistics_->RecordTick(statistics::Ticker::kVLogBytesWritten, v_log_->head() - old_v_log_head);
+
+    // SSTable和VLog数据均已写入后，再记录到MANIFEST
+    version::VersionEdit edit;
+    edit.AddFile(0, ss_table->header(), base_file_name);
+    edit.v_log_head = v_log_->head();
+    {
+        // 垃圾回收会在前台修改尾指针；当前内存表的日志编号之前的日志均已写入SSTable
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        edit.v_log_tail = v_log_->tail();
+        edit.log_number = log_number_;
+    }
+    return LogAndApply(edit);
+}
+
+bool KVStore::LogAndApply(version::VersionEdit &edit)
+{
+    SyncAddedFiles(edit);
+    edit.next_sequence = version_->next_sequence();
+    if(!manifest_->Append(edit)) {
+        // 内存中的层级清单与MANIFEST保持一致，新增的文件未被引用，下次启动时删除
+        return false;
+    }
+    {
+        std::lock_guard<std::shared_mutex> lock(mutex_);
+        version_->Apply(edit);
+    }
+    if(manifest_->NeedsSnapshot()) {
+        manifest_->WriteSnapshot(*version_);
+    }
+    return true;
+}
+
+void KVStore::SyncAddedFiles(const version::VersionEdit &edit) const
+{
+    if(edit.added_files.empty()) {
+        return ;
+    }
+    std::set<int> levels;
+    for(const auto &file: edit.added_files) {
+        if(utils::syncFile(ss_table::SSTable::BuildSSTableFileName(dir_, file.level, file.base_file_name)) < 0) {
+            LOG_ERROR("Failed to sync SSTable file %s", file.base_file_name.c_str());
+        }
+        levels.insert(file.level);
+    }
+    // 新文件（或直接移动建立的硬链接）记录在层级目录中
+    for(int level: levels) {
+        utils::syncDir(ss_table::SSTable::BuildSSTableDirName(dir_, level));
+    }
+    utils::syncDir(dir_);
+}
+
+void KVStore::RemoveObsoleteSSTableFiles()
+{
+    for(int level = 0; utils::dirExists(ss_table::SSTable::BuildSSTableDirName(dir_, level)); ++level) {
+        std::set<std::string> live_file_names;
+        for(const auto &meta_data: version_->files(level)) {
+            live_file_names.insert(meta_data.ss_table_file_name);
+        }
+
+        std::vector<std::string> base_file_name_list;
+        utils::scanDir(ss_table::SSTable::BuildSSTableDirName(dir_, level), base_file_name_list);
+        for(const auto &base_file_name: base_file_name_list) {
+            auto file_name = ss_table::SSTable::BuildSSTableFileName(dir_, level, base_file_name);
+            if(base_file_name.ends_with(".sst") && !live_file_names.count(file_name)) {
+                // 合并中途崩溃留下的、未记录到MANIFEST的SSTable文件
+                LOG_WARNING("Remove obsolete SSTable file %s", file_name.c_str());
+                utils::rmfile(file_name);
+            }
+        }
+    }
 }
 
 
 void KVStore::LoadSSTablesToMemory(
     const std::vector<std::string> &ss_table_file_name_list, 
-    int level,
     std::vector<std::shared_ptr<ss_table::SSTable>> &ss_table_list,
     uint64_t &min_key,
     uint64_t &max_key
@@ -318,13 +1102,7 @@ void KVStore::LoadSSTablesToMemory(
     max_key = std::numeric_limits<uint64_t>::min();
 
     for(const auto &ss_table_file_name: ss_table_file_name_list) {
-        auto ss_table = 
-            ss_table_manager_->FromFile(ss_table::SSTable::BuildSSTableFileName(
-                dir_, 
-                level,
-                ss_table_file_name
-            )
-        );
+        auto ss_table = ss_table_manager_->FromFile(ss_table_file_name);
         if(!ss_table) {
             continue;
         }
@@ -340,21 +1118,13 @@ void KVStore::LoadSSTablesInRangeToMemory(
     uint64_t max_key,
     std::vector<std::shared_ptr<ss_table::SSTable>> &ss_table_list
 ) {
-    std::string ss_table_dir_name = ss_table::SSTable::BuildSSTableDirName(dir_, level);
-    if(!utils::dirExists(ss_table_dir_name)) {
-        LOG_WARNING("SSTable directory %s does not exist", ss_table_dir_name.c_str());
-        return ;
-    }
-    std::vector<std::string> ss_table_file_name_list;
-    utils::scanDir(ss_table::SSTable::BuildSSTableDirName(dir_, level), ss_table_file_name_list);
-    for(const auto &ss_table_file_name: ss_table_file_name_list) {
-        auto ss_table = 
-            ss_table_manager_->FromFile(ss_table::SSTable::BuildSSTableFileName(dir_, level, ss_table_file_name));
-        if(!ss_table) {
+    for(const auto &meta_data: version_->files(level)) {
+        if(meta_data.header.max_key < min_key || meta_data.header.min_key > max_key) {
+            // SSTable 区间与[min_key, max_key]无交集
             continue;
         }
-        if(ss_table->header().max_key < min_key || ss_table->header().min_key > max_key) {
-            // SSTable 区间与[min_key, max_key]无交集
+        auto ss_table = ss_table_manager_->FromFile(meta_data.ss_table_file_name);
+        if(!ss_table) {
             continue;
         }
 
@@ -364,44 +1134,58 @@ void KVStore::LoadSSTablesInRangeToMemory(
 
 void KVStore::StoreSSTablesToDisk(
     int level,
-    const std::vector<ss_table::TimeStampedKeyOffsetVlenTuple> 
-        &merged_time_stamped_tuple_list
+    ss_table::MergingIterator &merging_iterator,
+    std::optional<uint64_t> end_key,
+    version::VersionEdit &edit
 ) {
     std::string ss_table_dir_name = ss_table::SSTable::BuildSSTableDirName(dir_, level);
     if(!utils::dirExists(ss_table_dir_name)) {
         utils::mkdir(ss_table_dir_name);
     }
 
-    uint64_t merged_time_stamped_tuple_count = merged_time_stamped_tuple_list.size();
-    for(uint64_t i = 0;i < merged_time_stamped_tuple_count; i += MEM_TABLE_CAPACITY) {
-        // 判断是不是最后一组
-        int sublist_size = 
-            i + MEM_TABLE_CAPACITY < merged_time_stamped_tuple_count ?
-            MEM_TABLE_CAPACITY : merged_time_stamped_tuple_count - i;
-        std::vector<ss_table::TimeStampedKeyOffsetVlenTuple> 
-            merged_time_stamped_tuple_sublist(
-                merged_time_stamped_tuple_list.begin() + i, 
-                merged_time_stamped_tuple_list.begin() + i + sublist_size
-            );
+    // 每凑满MEM_TABLE_CAPACITY个元组切分出一个SSTable，合并结果不会整体驻留内存
+    std::vector<ss_table::KeyOffsetVlenTuple> inserted_tuples;
+    inserted_tuples.reserve(MEM_TABLE_CAPACITY);
+    std::string inline_values;
+    uint64_t max_time_stamp = std::numeric_limits<uint64_t>::min();
+    auto has_next = [&merging_iterator, &end_key] {
+        return merging_iterator.Valid()
+            && (!end_key || merging_iterator.current().key_offset_vlen_tuple.key < *end_key);
+    };
+    while(has_next()) {
+        auto time_stamped_tuple = merging_iterator.current();
+        max_time_stamp = time_stamped_tuple.time_stamp > max_time_stamp ? time_stamped_tuple.time_stamp : max_time_stamp;
+        inserted_tuples.push_back(time_stamped_tuple.key_offset_vlen_tuple);
+        if(ss_table::IsInlineValue(inserted_tuples.back().vlen)) {
+            // 内联值复制到新SSTable的内联值块中
+            inserted_tuples.back().offset = inline_values.size();
+            inline_values.append(merging_iterator.current_inline_value());
+        }
+        merging_iterator.Next();
 
-        // 计算子列表的最大时间戳
-        uint64_t max_time_stamp = std::numeric_limits<uint64_t>::min();
-        std::vector<ss_table::KeyOffsetVlenTuple> inserted_tuples;
-        for(const auto &time_stamped_tuple: merged_time_stamped_tuple_sublist) {
-            max_time_stamp = time_stamped_tuple.time_stamp > max_time_stamp ? time_stamped_tuple.time_stamp : max_time_stamp;
-            inserted_tuples.push_back(time_stamped_tuple.key_offset_vlen_tuple);
+        if(inserted_tuples.size() < MEM_TABLE_CAPACITY && has_next()) {
+            continue;
         }
         
         // 将SSTable写入文件
+        std::string base_file_name = std::to_string(version_->AllocateSequence()) + ".sst";
         auto ss_table = ss_table_manager_->NewSSTable(
-            ss_table::SSTable::BuildUniqueSSTableFileName(
+            ss_table::SSTable::BuildSSTableFileName(
                 dir_,
-                level
+                level,
+                base_file_name
             ),
             max_time_stamp, 
-            inserted_tuples
+            inserted_tuples,
+            std::move(inline_values)
         );
         ss_table_manager_->WriteSSTableToFile(ss_table);
+        statistics_->RecordTick(statistics::Ticker::kCompactionBytesWritten, ss_table->file_size());
+        edit.AddFile(level, ss_table->header(), base_file_name);
+
+        inserted_tuples.clear();
+        inline_values.clear();
+        max_time_stamp = std::numeric_limits<uint64_t>::min();
     }
 }
 
@@ -414,36 +1198,56 @@ std::optional<ss_table::SSTableGetResult> KVStore::GetInSSTable (
     status = KeyStatus::kNotFound; // 默认为未找到状态
     std::optional<ss_table::SSTableGetResult> result;
 
-    std::vector<std::string> ss_table_base_file_name_list;
-    utils::scanDir(ss_table::SSTable::BuildSSTableDirName(dir_, level), ss_table_base_file_name_list);
-
     std::shared_ptr<ss_table::SSTable> ss_table;
+    if(version_->IsDisjoint(level)) {
+        // 该层文件互不重叠，二分查找到至多一个可能包含key的文件
+        {
+            PERF_TIMER_GUARD(metadata_nanos);
+            const ss_table::SSTableMetaData *meta_data = version_->FindFile(level, key);
+            if(!meta_data) {
+                return result;
+            }
+            ss_table = ss_table_manager_->FromFile(meta_data->ss_table_file_name);
+        }
+        if(!ss_table) {
+            return result;
+        }
+        auto ss_table_get_res = ProbeSSTable(*ss_table, key, level);
+        if(ss_table_get_res.has_value()) {
+            if(ss_table_get_res.value().vlen) {
+                result = ss_table_get_res.value();
+                status = KeyStatus::kFound;
+            } else {
+                status = KeyStatus::kDeleted;
+            }
+        }
+        return result;
+    }
+
+    // level-0中的文件可能重叠，取时间戳最大的记录
     uint64_t latest_time_stamp = std::numeric_limits<uint64_t>::min();
-    for (const auto &ss_table_base_file_name : ss_table_base_file_name_list)
+    for (const auto &meta_data : version_->files(level))
     {
-        auto ss_table_file_name = ss_table::SSTable::BuildSSTableFileName(
-            dir_,
-            level,
-            ss_table_base_file_name
-        );
-        auto header = ss_table::SSTable::ReadSSTableHeaderDirectly(ss_table_file_name);
-        if(header.key_count == 0) {
-            // 读取SSTable文件header失败
+        if(key < meta_data.header.min_key || key > meta_data.header.max_key) {
+            // key不在SSTable的键范围内
             continue;
         }
-        if(key < header.min_key || key > header.max_key) {
-            // key不在SSTable的键范围内
+        if(meta_data.header.time_stamp <= latest_time_stamp) {
+            // 已经找到时间戳更新的记录
             continue;
         }
 
         // 将整个SSTable文件读入内存
-        ss_table = ss_table_manager_->FromFile(ss_table_file_name);
+        {
+            PERF_TIMER_GUARD(metadata_nanos);
+            ss_table = ss_table_manager_->FromFile(meta_data.ss_table_file_name);
+        }
         if(!ss_table) {
             // 读取SSTable文件失败
             continue;
         }
 
-        auto ss_table_get_res = ss_table->Get(key);
+        auto ss_table_get_res = ProbeSSTable(*ss_table, key, level);
         if (ss_table_get_res.has_value() && ss_table->header().time_stamp > latest_time_stamp)
         {
             // 找到了一条记录且时间戳更新（找到vlog中的索引或者删除标记），
@@ -462,6 +1266,37 @@ std::optional<ss_table::SSTableGetResult> KVStore::GetInSSTable (
     return result;
 }
 
+std::optional<ss_table::SSTableGetResult> KVStore::ProbeSSTable(
+    const ss_table::SSTable &ss_table,
+    uint64_t key,
+    int level
+) const {
+    statistics_->RecordTick(statistics::Ticker::kSSTableProbes);
+    PERF_COUNTER_BY_LEVEL_ADD(bloom_filter_probe_count, 1, level);
+    bool key_may_match;
+    {
+        PERF_TIMER_GUARD(bloom_filter_nanos);
+        key_may_match = ss_table.KeyMayMatch(key);
+    }
+    if(!key_may_match) {
+        statistics_->RecordTick(statistics::Ticker::kBloomFilterUseful);
+        PERF_COUNTER_BY_LEVEL_ADD(bloom_filter_useful_count, 1, level);
+        return std::nullopt;
+    }
+    statistics_->RecordTick(statistics::Ticker::kBloomFilterPositive);
+
+    std::optional<ss_table::SSTableGetResult> result;
+    {
+        PERF_TIMER_GUARD(binary_search_nanos);
+        PERF_COUNTER_ADD(binary_search_count, 1);
+        result = ss_table.Search(key);
+    }
+    if(!result) {
+        statistics_->RecordTick(statistics::Ticker::kBloomFilterFalsePositive);
+    }
+    return result;
+}
+
 std::string KVStore::GetValueInSSTable(uint64_t key, int level) const {
     KeyStatus key_status;
     std::optional<ss_table::SSTableGetResult> optional_offset = GetInSSTable(key, level, key_status);
@@ -469,6 +1304,9 @@ std::string KVStore::GetValueInSSTable(uint64_t key, int level) const {
     switch (key_status)
     {
     case KeyStatus::kFound:
+        if(ss_table::IsInlineValue(optional_offset->vlen)) {
+            return std::move(optional_offset->inline_value);
+        }
         return v_log_->Get(optional_offset->offset, optional_offset->vlen);
         break;
     case KeyStatus::kDeleted:
@@ -481,125 +1319,291 @@ std::string KVStore::GetValueInSSTable(uint64_t key, int level) const {
     }
 }
 
+std::vector<uint64_t> KVStore::PickSubcompactionBoundaries(
+    const std::vector<std::shared_ptr<ss_table::SSTable>> &ss_table_list
+) const {
+    uint64_t tuple_count = 0;
+    std::vector<uint64_t> candidate_keys;
+    for(const auto &ss_table: ss_table_list) {
+        tuple_count += ss_table->header().key_count;
+        candidate_keys.push_back(ss_table->header().min_key);
+        candidate_keys.push_back(ss_table->header().max_key);
+    }
+    size_t subcompaction_count = std::min<uint64_t>(
+        options_.max_subcompactions, tuple_count / MIN_SUBCOMPACTION_TUPLES);
+    if(subcompaction_count <= 1) {
+        return {};
+    }
+
+    // 在输入文件的边界键中等间隔选取分界键
+    std::sort(candidate_keys.begin(), candidate_keys.end());
+    candidate_keys.erase(std::unique(candidate_keys.begin(), candidate_keys.end()), candidate_keys.end());
+    std::vector<uint64_t> boundaries;
+    for(size_t i = 1; i < subcompaction_count; ++i) {
+        uint64_t key = candidate_keys[i * candidate_keys.size() / subcompaction_count];
+        if(key > candidate_keys.front() && (boundaries.empty() || key > boundaries.back())) {
+            boundaries.push_back(key);
+        }
+    }
+    return boundaries;
+}
+
 void KVStore::DoCompaction(
-    const std::vector<std::string> ss_table_base_file_name_list, 
+    const std::vector<std::string> ss_table_file_name_list, 
     int from_level,
-    int to_level
+    int to_level,
+    version::VersionEdit &edit
 ) {
+    histogram::ScopedTimer timer(latency_histograms_[static_cast<int>(LatencyType::kCompaction)]);
+    if(TryTrivialMove(ss_table_file_name_list, from_level, to_level, edit)) {
+        statistics_->RecordTick(statistics::Ticker::kTrivialMoveCount);
+        return ;
+    }
+    statistics_->RecordTick(statistics::Ticker::kCompactionCount);
+
     // 将SSTable文件读入内存
     std::vector<std::shared_ptr<ss_table::SSTable>>ss_table_list;
     uint64_t min_key = std::numeric_limits<uint64_t>::max(), 
                 max_key = std::numeric_limits<uint64_t>::min();
-    LoadSSTablesToMemory(ss_table_base_file_name_list, from_level,
-                        ss_table_list, min_key, max_key);
+    LoadSSTablesToMemory(ss_table_file_name_list, ss_table_list, min_key, max_key);
+    size_t from_level_ss_table_count = ss_table_list.size();
     LoadSSTablesInRangeToMemory(to_level, min_key, max_key, ss_table_list);
+    for(const auto &ss_table: ss_table_list) {
+        statistics_->RecordTick(statistics::Ticker::kCompactionBytesRead, ss_table->file_size());
+    }
 
-    // 刪除旧的SSTable文件
+    // 合并SSTable文件, 并将合并后的SSTable文件写入磁盘
+    std::vector<int> ss_table_levels(ss_table_list.size(), to_level);
+    std::fill(ss_table_levels.begin(), ss_table_levels.begin() + from_level_ss_table_count, from_level);
+
+    // 按键范围划分为多个子合并，每个子合并在独立线程中归并并写出自己的SSTable
+    std::vector<uint64_t> boundaries = PickSubcompactionBoundaries(ss_table_list);
+    int subcompaction_count = boundaries.size() + 1;
+    std::vector<version::VersionEdit> subcompaction_edits(subcompaction_count);
+    utils::mkdir(ss_table::SSTable::BuildSSTableDirName(dir_, to_level));
+    #pragma omp parallel for num_threads(subcompaction_count) schedule(dynamic, 1)
+    for(int i = 0; i < subcompaction_count; ++i) {
+        ss_table::MergingIterator merging_iterator(ss_table_list, ss_table_levels);
+        if(i > 0) {
+            merging_iterator.Seek(boundaries[i - 1]);
+        }
+        StoreSSTablesToDisk(
+            to_level,
+            merging_iterator,
+            i + 1 < subcompaction_count ? std::optional<uint64_t>(boundaries[i]) : std::nullopt,
+            subcompaction_edits[i]
+        );
+    }
+    // 所有子合并的输出与输入的删除作为同一条记录写入MANIFEST
+    for(const auto &subcompaction_edit: subcompaction_edits) {
+        edit.added_files.insert(edit.added_files.end(),
+            subcompaction_edit.added_files.begin(), subcompaction_edit.added_files.end());
+    }
+
+    // 新文件全部写入后，将增删作为一条记录写入MANIFEST，再删除旧的SSTable文件
     std::vector<std::string> deleted_ss_table_file_name_list;
-    for(const auto &ss_table: ss_table_list) {
+    for(size_t i = 0; i < ss_table_list.size(); ++i) {
         // 此处ss_table-> file_name()为完整路径
-        deleted_ss_table_file_name_list.push_back(ss_table->file_name());
+        const auto &file_name = ss_table_list[i]->file_name();
+        edit.DeleteFile(
+            i < from_level_ss_table_count ? from_level : to_level,
+            ss_table::SSTable::ExtractBaseFileName(file_name)
+        );
+        deleted_ss_table_file_name_list.push_back(file_name);
+    }
+    if(!LogAndApply(edit)) {
+        // 输入文件仍被MANIFEST引用，不能删除
+        LOG_ERROR("Failed to log compaction from level-%d to level-%d", from_level, to_level);
+        return ;
     }
-    ss_table_manager_->DeleteSSTableFiles(deleted_ss_table_file_name_list);
+    DeleteCompactedSSTableFiles(deleted_ss_table_file_name_list);
+}
 
-    // 合并SSTable文件, 并将合并后的SSTable文件写入磁盘
-    auto merged_time_stamped_tuple_list = ss_table::SSTable::MergeSSTables(ss_table_list);
-    StoreSSTablesToDisk(to_level, merged_time_stamped_tuple_list);
+bool KVStore::TryTrivialMove(
+    const std::vector<std::string> &ss_table_file_name_list,
+    int from_level,
+    int to_level,
+    version::VersionEdit &edit
+) {
+    // 只读取层级清单中的元数据，不加载SSTable
+    std::unordered_set<std::string> file_name_set(ss_table_file_name_list.begin(), ss_table_file_name_list.end());
+    std::vector<ss_table::SSTableMetaData> inputs;
+    for(const auto &meta_data: version_->files(from_level)) {
+        if(file_name_set.count(meta_data.ss_table_file_name)) {
+            inputs.push_back(meta_data);
+        }
+    }
+    if(inputs.empty()) {
+        return false;
+    }
+    std::sort(inputs.begin(), inputs.end(),
+        [](const ss_table::SSTableMetaData &a, const ss_table::SSTableMetaData &b) {
+            return a.header.min_key < b.header.min_key;
+        }
+    );
+
+    for(size_t i = 0; i < inputs.size(); ++i) {
+        const auto &header = inputs[i].header;
+        if(i > 0 && inputs[i - 1].header.max_key >= header.min_key) {
+            // 输入文件之间重叠（level-0），须归并
+            return false;
+        }
+        if(version_->IsDisjoint(to_level)) {
+            if(version_->CountOverlappingFiles(to_level, header.min_key, header.max_key)) {
+                return false;
+            }
+            continue;
+        }
+        for(const auto &meta_data: version_->files(to_level)) {
+            if(meta_data.header.max_key >= header.min_key && meta_data.header.min_key <= header.max_key) {
+                return false;
+            }
+        }
+    }
+
+    // 先在下一层建立硬链接，记录到MANIFEST后再删除旧路径，任何时刻崩溃都不会丢失文件
+    utils::mkdir(ss_table::SSTable::BuildSSTableDirName(dir_, to_level));
+    std::vector<std::string> moved_file_name_list;
+    for(const auto &meta_data: inputs) {
+        std::string base_file_name = ss_table::SSTable::ExtractBaseFileName(meta_data.ss_table_file_name);
+        if(utils::linkfile(
+            meta_data.ss_table_file_name,
+            ss_table::SSTable::BuildSSTableFileName(dir_, to_level, base_file_name)) < 0) {
+            LOG_ERROR("Failed to move SSTable file %s", meta_data.ss_table_file_name.c_str());
+            // 放弃移动，已建立的链接作为孤立文件在下次启动时删除
+            return false;
+        }
+        edit.DeleteFile(from_level, base_file_name);
+        edit.AddFile(to_level, meta_data.header, base_file_name);
+        moved_file_name_list.push_back(meta_data.ss_table_file_name);
+    }
+    if(!LogAndApply(edit)) {
+        // 放弃本次合并，旧路径仍被MANIFEST引用，不能删除；已建立的链接在下次启动时删除
+        LOG_ERROR("Failed to log trivial move from level-%d to level-%d", from_level, to_level);
+        return true;
+    }
+    DeleteCompactedSSTableFiles(moved_file_name_list);
+    return true;
 }
 
 void KVStore::DoCascadeCompaction() {
     int level = 0;
     while(CheckSSTableLevelOverflow(level)) {
-        std::vector<std::string> ss_table_base_file_name_list;
-        utils::scanDir(ss_table::SSTable::BuildSSTableDirName(dir_, level), ss_table_base_file_name_list);
-        if(level == 0) {
-            DoCompaction(ss_table_base_file_name_list, level, level + 1);
-            ++ level;
-            continue;
-        }
-
-        std::vector<std::string> compacted_ss_table_base_file_name_list;
-        FilterSSTableFiles(
-            ss_table_base_file_name_list,
+        std::vector<std::string> ss_table_file_name_list;
+        version::VersionEdit edit;
+        PickCompactionFiles(
             level, 
-            ss_table_base_file_name_list.size() - ss_table::SSTable::SSTableMaxCountAtLevel(level),
-            compacted_ss_table_base_file_name_list
+            version_->file_count(level) - ss_table::SSTable::SSTableMaxCountAtLevel(level),
+            ss_table_file_name_list,
+            edit
         );
-        DoCompaction(compacted_ss_table_base_file_name_list, level, level + 1);
+        DoCompaction(ss_table_file_name_list, level, level + 1, edit);
         ++ level;
     }
 }
 
-void KVStore::FilterSSTableFiles(
-    const std::vector<std::string> &ss_table_base_file_name_list,
+void KVStore::PickCompactionFiles(
     int level,
-    int filter_size,
-    std::vector<std::string> &filtered_ss_table_base_file_name_list
+    size_t pick_count,
+    std::vector<std::string> &picked_ss_table_file_name_list,
+    version::VersionEdit &edit
 ) {
-    std::vector<ss_table::SSTableMetaData> ss_table_meta_data_list;
-    for(const auto &ss_table_file_name: ss_table_base_file_name_list) {
-        ss_table_meta_data_list.push_back({
-            ss_table::SSTable::ReadSSTableHeaderDirectly(
-                ss_table::SSTable::BuildSSTableFileName(dir_, level, ss_table_file_name)
-            ),
-            ss_table_file_name
-        });
+    const auto &level_files = version_->files(level);
+    if(!version_->IsDisjoint(level)) {
+        // level-0（或旧数据目录中重叠的层）整层合并，保证上层的记录总是比下层新
+        for(const auto &meta_data: level_files) {
+            picked_ss_table_file_name_list.push_back(meta_data.ss_table_file_name);
+        }
+        return ;
     }
 
-    std::sort(ss_table_meta_data_list.begin(), ss_table_meta_data_list.end(),
-        [](const ss_table::SSTableMetaData &a, const ss_table::SSTableMetaData &b) {
-            // 首先按照时间戳升序排序，然后按照最小键升序排序
-            return a.header.time_stamp < b.header.time_stamp 
-            || (a.header.time_stamp == b.header.time_stamp && a.header.min_key < b.header.min_key);
+    pick_count = std::min(pick_count, level_files.size());
+    size_t window_count = level_files.size() - pick_count + 1;
+
+    // 轮转起点：第一个最小键大于上次合并最大键的文件，超出末尾时从头开始
+    size_t start = 0;
+    if(auto compact_pointer = version_->compact_pointer(level)) {
+        start = std::upper_bound(level_files.begin(), level_files.end(), *compact_pointer,
+            [](uint64_t key, const ss_table::SSTableMetaData &meta_data) {
+                return key < meta_data.header.min_key;
+            }
+        ) - level_files.begin();
+        if(start == level_files.size()) {
+            start = 0;
         }
-    );
-    
-    for(int i = 0; i < filter_size; ++i) {
-        // LOG_INFO("timestamp: %lu", ss_table_meta_data_list[i].header.time_stamp);
-        filtered_ss_table_base_file_name_list.push_back(ss_table_meta_data_list[i].ss_table_file_name);
+        start = std::min(start, window_count - 1);
+    }
+
+    // 按轮转顺序考察每个由pick_count个相邻文件组成的窗口，选择与下一层重叠文件最少的窗口
+    size_t best = start;
+    if(version_->IsDisjoint(level + 1)) {
+        size_t best_overlap = std::numeric_limits<size_t>::max();
+        for(size_t i = 0; i < window_count && best_overlap; ++i) {
+            size_t first = (start + i) % window_count;
+            size_t overlap = version_->CountOverlappingFiles(
+                level + 1,
+                level_files[first].header.min_key,
+                level_files[first + pick_count - 1].header.max_key
+            );
+            if(overlap < best_overlap) {
+                best = first;
+                best_overlap = overlap;
+            }
+        }
+    }
+
+    for(size_t i = best; i < best + pick_count; ++i) {
+        picked_ss_table_file_name_list.push_back(level_files[i].ss_table_file_name);
     }
+    edit.SetCompactPointer(level, level_files[best + pick_count - 1].header.max_key);
 }
 
 
 bool KVStore::CheckSSTableLevelOverflow(int level) const {
-    std::vector<std::string> ss_table_file_name_list;
-    std::string dir = ss_table::SSTable::BuildSSTableDirName(dir_, level);
-    if(!utils::dirExists(dir)) {
-        return false;
-    }
-    utils::scanDir(ss_table::SSTable::BuildSSTableDirName(dir_, level), ss_table_file_name_list);
-    return ss_table_file_name_list.size() > ss_table::SSTable::SSTableMaxCountAtLevel(level);
+    return version_->file_count(level) > static_cast<size_t>(ss_table::SSTable::SSTableMaxCountAtLevel(level));
 }
 
-bool KVStore::IsVLogEntryOutdated(uint64_t v_log_entry_key, uint64_t v_log_entry_offset) const {
-    std::string mem_table_get_result = mem_table_->Get(v_log_entry_key);
-        if(!mem_table_get_result.empty()) {
-            // 内存表中查找成功，或者在内存表中找到删除标记
-            return true;
-        }
+void KVStore::MarkOutdatedVLogEntries(
+    const std::vector<v_log::DeallocVLogEntryInfo> &entries,
+    std::vector<bool> &outdated
+) const {
+    // 同一个键可能在回收的区间中出现多次，只查找一次
+    std::vector<uint64_t> sorted_keys;
+    sorted_keys.reserve(entries.size());
+    for(const auto &entry: entries) {
+        sorted_keys.push_back(entry.key);
+    }
+    std::sort(sorted_keys.begin(), sorted_keys.end());
+    sorted_keys.erase(std::unique(sorted_keys.begin(), sorted_keys.end()), sorted_keys.end());
 
-    // 从SSTable逐层查找
-    int level = 0;
-    KeyStatus key_status;
-    std::optional<ss_table::SSTableGetResult> result;
-    while (utils::dirExists(ss_table::SSTable::BuildSSTableDirName(dir_, level)))
-    {
-        result = GetInSSTable(v_log_entry_key, level, key_status);
-        if(key_status == KeyStatus::kDeleted) {
-            // 在SSTable中查找到删除标记
-            return true;
+    // 内存表中查找成功，或者在内存表中找到删除标记，VLog中的值均已过期
+    std::vector<bool> in_mem_table(sorted_keys.size(), false);
+    std::vector<size_t> pending;
+    for(size_t i = 0; i < sorted_keys.size(); ++i) {
+        for(const skip_list::SkipList *table : {mem_table_.get(), imm_table_.get()}) {
+            if(table && !table->Get(sorted_keys[i]).empty()) {
+                in_mem_table[i] = true;
+                break;
+            }
         }
-        if(key_status == KeyStatus::kFound) {
-            // 查找到有效的值
-            return result->offset != v_log_entry_offset;
+        if(!in_mem_table[i]) {
+            pending.push_back(i);
         }
-
-        // 未查找到任何记录，继续查找下一层
-        ++ level;
     }
+    std::vector<std::optional<ss_table::SSTableGetResult>> results(sorted_keys.size());
+    MultiGetInSSTables(sorted_keys, pending, results);
 
-    // 没有查找到任何记录
-    return true;
+    // 只有最新记录指向该entry时才未过期；删除标记、内联值与未找到记录均视为过期
+    outdated.resize(entries.size());
+    for(size_t i = 0; i < entries.size(); ++i) {
+        size_t index = std::lower_bound(sorted_keys.begin(), sorted_keys.end(), entries[i].key) - sorted_keys.begin();
+        const auto &result = results[index];
+        outdated[i] = in_mem_table[index]
+            || !result.has_value()
+            || !result->vlen
+            || ss_table::IsInlineValue(result->vlen)
+            || result->offset != entries[i].offset;
+    }
 }
 
 
@@ -607,7 +1611,6 @@ bool KVStore::IsVLogEntryOutdated(uint64_t v_log_entry_key, uint64_t v_log_entry
 
 /* For Test Only */
 void KVStore::get_everywhere(uint64_t key) {
-    int level = 0;
     auto mem_table_get_res = mem_table_->Get(key);
     if(!mem_table_get_res.empty()) {
         LOG_WARNING("key %lu found in mem table: %s", key, mem_table_get_res.c_str());
@@ -615,37 +1618,23 @@ void KVStore::get_everywhere(uint64_t key) {
         LOG_INFO("key %lu not found in mem table", key);
     }
     
-    while(utils::dirExists(ss_table::SSTable::BuildSSTableDirName(dir_, level))) {
+    for(int level = 0; level < version_->level_count(); ++level) {
         LOG_INFO("## read level %d ##", level);
         get_everywhere_in_level(key, level);
-        ++ level;
     }
 }
 
 void KVStore::get_everywhere_in_level(uint64_t key, int level) {
-    std::vector<std::string> ss_table_base_file_name_list;
-    utils::scanDir(ss_table::SSTable::BuildSSTableDirName(dir_, level), ss_table_base_file_name_list);
-
     std::shared_ptr<ss_table::SSTable> ss_table;
-    for (const auto &ss_table_base_file_name : ss_table_base_file_name_list)
+    for (const auto &meta_data : version_->files(level))
     {
-        auto ss_table_file_name = ss_table::SSTable::BuildSSTableFileName(
-            dir_,
-            level,
-            ss_table_base_file_name
-        );
-        auto header = ss_table::SSTable::ReadSSTableHeaderDirectly(ss_table_file_name);
-        if(header.key_count == 0) {
-            // 读取SSTable文件header失败
-            continue;
-        }
-        if(key < header.min_key || key > header.max_key) {
+        if(key < meta_data.header.min_key || key > meta_data.header.max_key) {
             // key不在SSTable的键范围内
             continue;
         }
 
         // 将整个SSTable文件读入内存
-        ss_table = ss_table_manager_->FromFile(ss_table_file_name);
+        ss_table = ss_table_manager_->FromFile(meta_data.ss_table_file_name);
         if(!ss_table) {
             // 读取SSTable文件失败
             continue;
@@ -655,7 +1644,10 @@ void KVStore::get_everywhere_in_level(uint64_t key, int level) {
         if (ss_table_get_res.has_value())
         {
             // 找到了key对应的一条记录
-            if(ss_table_get_res.value().vlen) {
+            if(ss_table::IsInlineValue(ss_table_get_res.value().vlen)) {
+                LOG_WARNING("key %lu found inline in level %d: %s", key, level, ss_table_get_res.value().inline_value.c_str());
+                LOG_WARNING("time stamp: %lu", ss_table->header().time_stamp);
+            } else if(ss_table_get_res.value().vlen) {
                 LOG_WARNING("key %lu found in level %d: %s", key, level, this->v_log_->Get(ss_table_get_res.value().offset, ss_table_get_res.value().vlen).c_str());
                 LOG_WARNING("time stamp: %lu", ss_table->header().time_stamp);
             } else {
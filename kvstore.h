@@ -1,11 +1,18 @@
 #pragma once
 
 #include "kvstore_api.h"
+#include "kvstore_options.h"
 #include <vector>
 #include <memory>
 #include <string>
+#include <string_view>
 #include <list>
 #include <optional>
+#include <thread>
+#include <mutex>
+#include <shared_mutex>
+#include <condition_variable>
+#include <atomic>
 
 namespace skip_list
 {
@@ -20,16 +27,58 @@ namespace ss_table
 {
 	class SSTable;
 	class SSTableManager;
-	struct TimeStampedKeyOffsetVlenTuple;
 	struct SSTableGetResult;
+	class MergingIterator;
+}
+namespace histogram
+{
+	class Histogram;
+}
+namespace statistics
+{
+	class Statistics;
+}
+namespace wal
+{
+	class LogWriter;
+}
+class KVStoreIterator;
+class WriteBatch;
+namespace version
+{
+	class Version;
+	class Manifest;
+	struct VersionEdit;
 }
 enum class KeyStatus {
 	kFound,
 	kNotFound,
 	kDeleted
 };
+/**
+ * @brief KVStore内部记录延迟直方图的操作
+ */
+enum class LatencyType {
+	kPut,
+	kGet,
+	kDel,
+	kScan,
+	kWrite,		// 一次批量写入
+	kMultiGet,	// 一次批量查找
+	kFlush,		// 内存表写入level-0
+	kCompaction,	// 一次合并（包括直接移动）
+	kGc,
+	kCount
+};
+
+/**
+ * @brief 延迟类型的名称，如"put"，用于输出统计
+ */
+const char *LatencyTypeName(LatencyType type);
+
 class KVStore : public KVStoreAPI
 {
+	friend class KVStoreIterator;
 
 // --------------------------------------
 // Public Interface
@@ -40,8 +89,9 @@ public:
 	 *
 	 * @param dir SSTable文件存储目录(末尾无"/")
 	 * @param vlog vlog文件路径
+	 * @param options 可选配置
 	 */
-	KVStore(const std::string &dir, const std::string &vlog);
+	KVStore(const std::string &dir, const std::string &vlog, const KVStoreOptions &options = KVStoreOptions());
 
 	~KVStore();
 
@@ -56,11 +106,97 @@ public:
 	void scan(uint64_t key1, uint64_t key2, std::list<std::pair<uint64_t, std::string>> &list) override;
 
 	void gc(uint64_t chunk_size) override;
+
+	/**
+	 * @brief 原子地应用批次中的所有写入与删除
+	 * @details 整个批次写入同一个内存表与一条预写日志记录，读者要么看到全部修改，要么都看不到；
+	 * 每个批次只检查一次内存表容量，批次超过剩余容量时先转换内存表，因此内存表可能超过MEM_TABLE_CAPACITY与字节预算。
+	 */
+	void Write(const WriteBatch &batch);
+
+	/**
+	 * @brief 批量查找多个键
+	 * @details 将键排序去重后，依次在内存表与各层中一趟解析：每层按键序遍历文件，每个文件至多加载一次；
+	 * 最后按偏移量顺序读取VLog，并合并相邻的读取。
+	 * 
+	 * @param keys 待查找的键，可以无序或重复
+	 * @return std::vector<std::string> 与keys一一对应的值，未找到或已删除时为""
+	 */
+	std::vector<std::string> MultiGet(const std::vector<uint64_t> &keys);
+
+	/**
+	 * @brief 创建按键升序遍历的迭代器，须先调用Seek或SeekToFirst
+	 * @details 迭代器惰性读取VLog，分页扫描或只取前N个键时，开销与返回的记录数成正比
+	 */
+	std::unique_ptr<KVStoreIterator> NewIterator();
+
+	/**
+	 * @brief 某类操作的延迟直方图，单位为纳秒，自KVStore创建起累计
+	 */
+	const histogram::Histogram &latency_histogram(LatencyType type) const;
+
+	/**
+	 * @brief 引擎内部的计数器，自KVStore创建起累计
+	 */
+	const statistics::Statistics &statistics() const;
+
+	/**
+	 * @brief 以文本形式读取引擎状态
+	 * @details 支持的属性：
+	 * 		- "lsmkv.stats"：各层文件数与大小、写放大与空间放大、计数器、SSTable缓存与延迟直方图；
+	 * 		- "lsmkv.levelstats"：各层文件数、键数与大小；
+	 * 		- "lsmkv.num-files-at-level<N>"：第N层的文件数，N须小于当前层数。
+	 * 
+	 * @param property 属性名
+	 * @param value 返回属性值
+	 * @return true 属性存在
+	 * @return false 不支持该属性
+	 */
+	bool GetProperty(const std::string &property, std::string &value);
 	
 private:
 // --------------------------------------
 // Helper Get Functions
 // --------------------------------------
+	/**
+	 * @brief 依次在内存表、只读内存表和各层SSTable中查找key
+	 * @details 调用者须持有mutex_
+	 * 
+	 * @return std::string 查找到的值，未找到或已删除时返回""
+	 */
+	std::string GetValue(uint64_t key) const;
+
+	/**
+	 * @brief 依次在内存表和只读内存表中查找key
+	 * @details 调用者须持有mutex_
+	 * 
+	 * @param value 状态为kFound时返回查找到的值
+	 * @return KeyStatus 
+	 */
+	KeyStatus GetInMemTable(uint64_t key, std::string &value) const;
+
+	/**
+	 * @brief MultiGet的实现，调用者须持有mutex_
+	 * 
+	 * @param sorted_keys 升序且不重复的键
+	 * @param values 返回与sorted_keys一一对应的值，大小须与sorted_keys相同
+	 */
+	void MultiGetValue(const std::vector<uint64_t> &sorted_keys, std::vector<std::string> &values) const;
+
+	/**
+	 * @brief 在各层SSTable中批量查找升序的键，每层按键序遍历文件，每个文件至多加载一次
+	 * @details 调用者须持有mutex_
+	 * 
+	 * @param sorted_keys 升序且不重复的键
+	 * @param pending 需要查找的键在sorted_keys中的下标，升序
+	 * @param results 返回每个键在最上面一层中的记录（值或删除标记），未找到时不修改，大小须与sorted_keys相同
+	 */
+	void MultiGetInSSTables(
+		const std::vector<uint64_t> &sorted_keys,
+		std::vector<size_t> pending,
+		std::vector<std::optional<ss_table::SSTableGetResult>> &results
+	) const;
+
 	/**
 	 * @brief 在第level层SSTable查找key，返回对应的值
 	 * 
@@ -75,7 +211,7 @@ private:
 
 	/**
 	 * @brief 在第level层SSTable查找key，直接返回时间戳最大的SSTable::Get查找结果
-	 * @details 该函数为低级接口
+	 * @details 该函数为低级接口。文件互不重叠的层中二分查找，至多读取一个SSTable
 	 * 
 	 * @param key 键
 	 * @param level 层数
@@ -84,6 +220,16 @@ private:
 	 */
 	std::optional<ss_table::SSTableGetResult> GetInSSTable (uint64_t key, int level, KeyStatus &status) const ;
 
+	/**
+	 * @brief 在单个SSTable中查找key，先查询Bloom过滤器再二分查找，并记录统计与性能明细
+	 * 
+	 * @param ss_table 键范围包含key的SSTable
+	 * @param key 键
+	 * @param level SSTable所在的层数
+	 * @return std::optional<ss_table::SSTableGetResult> 
+	 */
+	std::optional<ss_table::SSTableGetResult> ProbeSSTable(const ss_table::SSTable &ss_table, uint64_t key, int level) const;
+
 
 
 // --------------------------------------
@@ -91,21 +237,23 @@ private:
 // --------------------------------------
 	/**
 	 * @brief 将内存表中的所有键值对写入level-0的单个SSTable文件
+	 * 
+	 * @param mem_table 被写入的内存表
+	 * @return true 已写入并记录到MANIFEST
+	 * @return false MANIFEST写入失败，层级清单与日志编号不变
 	 */
-	void ConvertMemTableToSSTable();
+	bool ConvertMemTableToSSTable(const skip_list::SkipList &mem_table);
 
 	/**
 	 * @brief 将SSTable文件加载到内存
 	 * 
-	 * @param ss_table_file_name_list 需要加载的SSTable文件名列表（不是完整路径）
-	 * @param level 加载的SSTable所在的层级
+	 * @param ss_table_file_name_list 需要加载的SSTable文件名列表（完整路径）
 	 * @param ss_table_list 将所有加载的SSTable追加到该列表中
 	 * @param min_key 加载后的SSTable中的最小key
 	 * @param max_key 加载后的SSTable中的最大key
 	 */
 	void LoadSSTablesToMemory(
 		const std::vector<std::string> &ss_table_file_name_list, 
-		int level,
 		std::vector<std::shared_ptr<ss_table::SSTable>> &ss_table_list,
 		uint64_t &min_key,
 		uint64_t &max_key
@@ -127,16 +275,69 @@ private:
 	);
 
 	/**
-	 * @brief 从tuples生成新的SSTable文件，写入第level层
+	 * @brief 消费归并迭代器的输出，边归并边生成新的SSTable文件，写入第level层
+	 * @details 可以在多个线程中对不同的键范围并发调用
 	 * 
 	 * @param level 层数
-	 * @param tuples 合并后得到的带有时间戳的KeyOffsetVlen元组 
+	 * @param merging_iterator 输入SSTable的归并迭代器
+	 * @param end_key 只消费键小于end_key的元组，为std::nullopt时消费到末尾
+	 * @param edit 新生成的SSTable文件记录到该修改中
 	 */
 	void StoreSSTablesToDisk(
 		int level,
-		const std::vector<ss_table::TimeStampedKeyOffsetVlenTuple> &tuples
+		ss_table::MergingIterator &merging_iterator,
+		std::optional<uint64_t> end_key,
+		version::VersionEdit &edit
 	);
 
+	/**
+	 * @brief 根据输入SSTable的键范围选出子合并的分界键
+	 * @details 输入元组较少时不划分。第i个子合并负责[boundaries[i-1], boundaries[i])中的键。
+	 * 
+	 * @param ss_table_list 合并的输入SSTable
+	 * @return std::vector<uint64_t> 升序的分界键，为空时不划分
+	 */
+	std::vector<uint64_t> PickSubcompactionBoundaries(
+		const std::vector<std::shared_ptr<ss_table::SSTable>> &ss_table_list
+	) const;
+
+	/**
+	 * @brief 将新增的SSTable文件落盘，再将修改写入MANIFEST，最后应用到内存中的层级清单
+	 * 
+	 * @param edit 修改，会补充下一个序列号
+	 * @return true 修改已落盘并应用
+	 * @return false MANIFEST写入失败，修改未应用，调用者不能删除被替换的文件
+	 */
+	bool LogAndApply(version::VersionEdit &edit);
+
+	/**
+	 * @brief 将修改中新增的SSTable文件及其所在的层级目录落盘
+	 * @details 须在修改写入MANIFEST之前调用，否则掉电后MANIFEST可能引用尚未落盘的文件，
+	 * 而被替换的输入文件已经删除。数据目录也一并同步，使新建的层级目录本身落盘
+	 */
+	void SyncAddedFiles(const version::VersionEdit &edit) const;
+
+	/**
+	 * @brief 删除层级目录中未被层级清单引用的SSTable文件
+	 */
+	void RemoveObsoleteSSTableFiles();
+
+	/**
+	 * @brief 删除合并或直接移动后不再被层级清单引用的SSTable文件
+	 * @details 仍有迭代器存活时推迟到最后一个迭代器析构时删除，迭代器惰性加载快照中的文件时文件总是存在
+	 */
+	void DeleteCompactedSSTableFiles(const std::vector<std::string> &file_name_list);
+
+	/**
+	 * @brief 迭代器第一次Seek时调用，调用者须持有mutex_
+	 */
+	void PinSSTableFiles();
+
+	/**
+	 * @brief 已Seek的迭代器析构时调用，最后一个迭代器析构时删除推迟的文件
+	 */
+	void UnpinSSTableFiles();
+
 
 // --------------------------------------
 // Compaction Operations
@@ -144,14 +345,34 @@ private:
 	/**
 	 * @brief 执行合并操作
 	 * 
-	 * @param ss_table_base_file_name_list 需要合并的SSTable文件名列表（不是完整路径）
+	 * @param ss_table_file_name_list 需要合并的SSTable文件名列表（完整路径）
 	 * @param from_level 合并的SSTable所在的层级
 	 * @param to_level 合并后的SSTable所在的层级
+	 * @param edit 合并产生的层级清单修改，文件增删会追加到其中
 	 */
 	void DoCompaction(
-		const std::vector<std::string> ss_table_base_file_name_list,
+		const std::vector<std::string> ss_table_file_name_list,
 		 int from_level,
-		 int to_level
+		 int to_level,
+		 version::VersionEdit &edit
+	);
+
+	/**
+	 * @brief 若输入文件之间以及与下一层均不重叠，将其直接移动到下一层
+	 * @details 只修改层级清单并移动文件路径，不重写元组，也不重建Bloom过滤器
+	 * 
+	 * @param ss_table_file_name_list 需要合并的SSTable文件名列表（完整路径）
+	 * @param from_level 合并的SSTable所在的层级
+	 * @param to_level 合并后的SSTable所在的层级
+	 * @param edit 合并产生的层级清单修改
+	 * @return true 已完成移动，或MANIFEST写入失败而放弃本次合并
+	 * @return false 不满足条件，须归并
+	 */
+	bool TryTrivialMove(
+		const std::vector<std::string> &ss_table_file_name_list,
+		int from_level,
+		int to_level,
+		version::VersionEdit &edit
 	);
 
 	/**
@@ -161,18 +382,21 @@ private:
 	void DoCascadeCompaction();
 
 	/**
-	 * @brief 从level层过滤出时间戳最小的filter_size个SSTable文件
+	 * @brief 选出level层中需要合并到下一层的SSTable文件
+	 * @details level-0（或文件重叠的层）选出整层；互不重叠的层按键范围轮转，
+	 * 从上次合并的最大键之后开始，在pick_count个相邻文件组成的窗口中选择与下一层重叠最少的一个，
+	 * 并将本次合并的最大键记录到edit中。
 	 * 
-	 * @param ss_table_file_name_list 候选的SSTable文件名列表
 	 * @param level 层数
-	 * @param filter_size 需要过滤出的SSTable文件个数 
-	 * @param filtered_ss_table_file_name_list 过滤后的SSTable文件名列表 
+	 * @param pick_count 需要选出的SSTable文件个数
+	 * @param picked_ss_table_file_name_list 选出的SSTable文件名列表（完整路径）
+	 * @param edit 记录合并指针的修改
 	 */
-	void FilterSSTableFiles(
-		const std::vector<std::string> &ss_table_base_file_name_list,
+	void PickCompactionFiles(
 		int level,
-		int filter_size,
-		std::vector<std::string> &filtered_ss_table_base_file_name_list
+		size_t pick_count,
+		std::vector<std::string> &picked_ss_table_file_name_list,
+		version::VersionEdit &edit
 	);
 
 	/**
@@ -185,16 +409,139 @@ private:
 	bool CheckSSTableLevelOverflow(int level) const;
 
 
+// --------------------------------------
+// Background Flush Operations
+// --------------------------------------
+	/**
+	 * @brief 将键值对写入内存表，内存表已满时将其转为只读内存表
+	 * @details 写入者只持有本线程的写入者锁，多个线程同时写入内存表；只有转换内存表时才独占mutex_与所有写入者锁
+	 */
+	void InsertIntoMemTable(uint64_t key, const std::string &val);
+
+	/**
+	 * @brief 写入pending_keys个键、pending_bytes字节后，内存表的键数是否达到MEM_TABLE_CAPACITY，
+	 * 或占用内存是否达到mem_table_memory_capacity
+	 * @details 调用者须持有mutex_或写入者锁
+	 */
+	bool MemTableFull(size_t pending_keys = 0, size_t pending_bytes = 0) const;
+
+	/**
+	 * @brief 若内存表已满，将其转为只读内存表，交给后台线程写入level-0
+	 * @details 调用者须独占mutex_。若上一个只读内存表尚未写入完成，则等待其完成；
+	 * 替换内存表与预写日志时独占所有写入者锁，等待正在写入的线程完成。
+	 * 
+	 * @param lock mutex_上的锁
+	 * @param force 为true时，只要内存表非空就进行转换
+	 */
+	void MakeImmutableMemTable(std::unique_lock<std::shared_mutex> &lock, bool force = false);
+
+	/**
+	 * @brief 本线程的写入者锁，写入内存表与预写日志时持有其共享锁
+	 * @details 写入者按线程分散到kWriterLockStripes个读写锁上。所有写入者共享同一个锁时，
+	 * 每次加锁都要修改同一个读者计数，该缓存行在各核之间来回迁移，写入无法随线程数扩展
+	 */
+	std::shared_mutex &ThreadWriterLock();
+
+	/**
+	 * @brief 独占所有写入者锁，之后没有写入者访问内存表与预写日志
+	 */
+	void LockAllWriters();
+
+	void UnlockAllWriters();
+
+	/**
+	 * @brief 后台线程主循环：写入只读内存表，并执行级联合并
+	 */
+	void BackgroundWork();
+
+	/**
+	 * @brief 将只读内存表写入level-0，完成后释放只读内存表
+	 * @return false MANIFEST写入失败，只读内存表与其日志保留，稍后重试
+	 */
+	bool FlushImmutableMemTable();
+
+	/**
+	 * @brief 等待后台线程完成所有已调度的写入与合并，以及正在进行的垃圾回收
+	 * @details 调用者须持有mutex_
+	 * 
+	 * @param lock mutex_上的锁
+	 */
+	void WaitForBackgroundWork(std::unique_lock<std::shared_mutex> &lock);
+
+	/**
+	 * @brief 将"lsmkv.stats"追加到数据目录下的STATS文件
+	 */
+	void DumpStatistics();
+
+
+// --------------------------------------
+// Write-Ahead Log
+// --------------------------------------
+	/**
+	 * @brief 创建新的预写日志文件，供当前内存表使用
+	 * @details 调用者须独占mutex_（构造函数中除外）。未启用预写日志时只分配日志编号
+	 */
+	void NewLogFile();
+
+	/**
+	 * @brief 将键值对写入预写日志与内存表，未启用预写日志时只写入内存表
+	 * @details 调用者须持有写入者锁，保证转换内存表时没有写入者，日志与内存表一一对应。
+	 * 组提交写入日志后各线程并发写入内存表，值带有日志中的序列号，同一个键保留日志中最后的值，
+	 * 因此重放日志得到的值与崩溃前读者看到的值一致
+	 */
+	void WriteToLogAndMemTable(uint64_t key, const std::string &val);
+
+
+	/**
+	 * @brief 启动时重放编号不小于层级清单中日志编号的预写日志，并将恢复的内存表写入level-0
+	 * @details 重放的记录可能来自两个日志（内存表与只读内存表），写入一个SSTable
+	 */
+	void RecoverLogFiles();
+
+	/**
+	 * @brief 删除编号小于层级清单中日志编号的预写日志文件
+	 * @details 日志编号随level-0的SSTable一起记录到MANIFEST，此前VLog与SSTable均已落盘，删除日志不会丢失数据
+	 */
+	void RemoveObsoleteLogFiles();
+
+
+// --------------------------------------
+// Statistics
+// --------------------------------------
+	/**
+	 * @brief 输出各层文件数、键数与大小，调用者须持有mutex_
+	 * 
+	 * @param value 追加到该字符串
+	 * @param bottommost_level_bytes 返回最下面一个非空层的字节数
+	 * @return uint64_t 所有SSTable文件的字节数
+	 */
+	uint64_t AppendLevelStats(std::string &value, uint64_t &bottommost_level_bytes) const;
+
+
 // --------------------------------------
 // Garbage Collection Operations
 // --------------------------------------
 	/**
-	 * @brief 判断VLogEntry是否过期
-	 * @details 通过查找内存表和逐层SSTable，判断键为key，偏移为offset的VLog entry是否过期并返回结果
-	 * @return true VLog entry已经过期，需要进行垃圾回收
-	 * @return false VLog entry未过期
+	 * @brief 批量判断回收的VLog entry是否过期
+	 * @details 将entry的键排序去重后，一趟查找内存表与各层SSTable（每个文件至多加载一次）；
+	 * 键的最新记录指向该entry的偏移量时未过期。调用者须持有mutex_
+	 * 
+	 * @param entries VLog::DeallocSpace回收的entry
+	 * @param outdated 返回与entries一一对应的结果，true表示已经过期，无须重新写入
 	 */
-	bool IsVLogEntryOutdated(uint64_t v_log_entry_key, uint64_t v_log_entry_offset) const;
+	void MarkOutdatedVLogEntries(
+		const std::vector<v_log::DeallocVLogEntryInfo> &entries,
+		std::vector<bool> &outdated
+	) const;
+
+	/**
+	 * @brief gc的实现，调用者须已暂停后台线程
+	 * @details 只在判断entry是否有效时持有共享锁，重新检查仍然有效的键与应用新的指针时独占mutex_；
+	 * 重新写入VLog与生成SSTable时不持有mutex_
+	 *
+	 * @return true 写入了新的level-0 SSTable，须调度合并
+	 */
+	bool GarbageCollect(uint64_t chunk_size);
 
 
 // --------------------------------------
@@ -202,9 +549,39 @@ private:
 // --------------------------------------
 private:
 	std::string dir_;
-	skip_list::SkipList *mem_table_;
+	KVStoreOptions options_;
+	std::shared_ptr<skip_list::SkipList> mem_table_;
+	std::shared_ptr<skip_list::SkipList> imm_table_; // 等待后台线程写入level-0的只读内存表
 	v_log::VLog *v_log_;
 	std::unique_ptr<ss_table::SSTableManager> ss_table_manager_;
+	std::unique_ptr<version::Version> version_; // 内存中的SSTable层级清单
+	std::unique_ptr<version::Manifest> manifest_; // 层级清单的持久化日志
+	std::unique_ptr<histogram::Histogram[]> latency_histograms_; // 按LatencyType索引
+	std::unique_ptr<statistics::Statistics> statistics_;
+	std::unique_ptr<wal::LogWriter> wal_; // 当前内存表的预写日志，未启用时为nullptr
+	uint64_t log_number_ = 0; // 当前内存表的日志编号，只在独占mutex_时修改
+	std::atomic<uint64_t> mem_table_sequence_ = 0; // 未启用预写日志时为内存表中的值分配的序列号
+
+	// 替换内存表、只读内存表和修改层级清单均须独占mutex_，读取它们须持有共享锁；
+	// 向内存表写入只需持有写入者锁（跳表支持并发写入），替换内存表与预写日志时另须独占所有写入者锁；
+	// 层级清单只由后台线程与垃圾回收修改，两者不会同时进行，因此它们读取层级清单时无须加锁
+	std::shared_mutex mutex_;
+	static const int kWriterLockStripes = 16;
+	struct alignas(64) WriterLockStripe {
+		std::shared_mutex mutex;
+	};
+	WriterLockStripe writer_locks_[kWriterLockStripes];
+	std::condition_variable_any background_work_cv_; // 唤醒后台线程
+	std::condition_variable_any background_done_cv_; // 后台线程完成一次写入或合并
+	std::thread background_thread_;
+	bool compaction_scheduled_ = false;
+	bool background_busy_ = false;
+	bool gc_running_ = false; // 垃圾回收进行中，后台线程暂停
+	bool shutting_down_ = false;
+
+	std::mutex compacted_files_mutex_;
+	int pinned_iterator_count_ = 0; // 已Seek且尚未析构的迭代器数
+	std::vector<std::string> compacted_files_; // 因迭代器存活而推迟删除的SSTable文件（完整路径）
 
 // --------------------------------------
 // For Test Only
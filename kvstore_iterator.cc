@@ -0,0 +1,217 @@
+#include "kvstore_iterator.h"
+#include "kvstore.h"
+#include "ss_table.h"
+#include "ss_table_manager.h"
+#include "version.h"
+#include "v_log.h"
+#include "inc.h"
+#include "perf_context.h"
+
+#include <cassert>
+
+KVStoreIterator::KVStoreIterator(KVStore *store)
+    : store_(store),
+      mem_table_iterator_(nullptr),
+      imm_table_iterator_(nullptr)
+{
+}
+
+KVStoreIterator::~KVStoreIterator()
+{
+    if(pinned_) {
+        store_->UnpinSSTableFiles();
+    }
+}
+
+void KVStoreIterator::Seek(uint64_t key)
+{
+    PERF_TIMER_GUARD(iterator_seek_nanos);
+    std::shared_lock<std::shared_mutex> lock(store_->mutex_);
+
+    // 持有内存表的引用，内存表被后台线程写入SSTable后仍可继续遍历
+    mem_table_ = store_->mem_table_;
+    imm_table_ = store_->imm_table_;
+    mem_table_iterator_ = mem_table_->Seek(key);
+    imm_table_iterator_ = imm_table_ ? imm_table_->Seek(key) : skip_list::SkipList::Iterator(nullptr);
+
+    // 持锁期间层级清单中的SSTable文件均存在；之后合并掉的文件推迟到迭代器析构后删除，惰性加载时仍然存在
+    if(!pinned_) {
+        store_->PinSSTableFiles();
+        pinned_ = true;
+    }
+    std::vector<std::shared_ptr<ss_table::SSTable>> ss_table_list;
+    std::vector<int> ss_table_levels;
+    level_iterators_.clear();
+    for(int level = 0; level < store_->version_->level_count(); ++level) {
+        if(store_->version_->IsDisjoint(level)) {
+            level_iterators_.emplace_back(level, store_->version_->files_snapshot(level), *store_->ss_table_manager_);
+            level_iterators_.back().Seek(key);
+            continue;
+        }
+        for(const auto &meta_data: store_->version_->files(level)) {
+            if(meta_data.header.max_key < key) {
+                continue;
+            }
+            auto ss_table = store_->ss_table_manager_->FromFile(meta_data.ss_table_file_name);
+            if(ss_table) {
+                ss_table_list.push_back(ss_table);
+                ss_table_levels.push_back(level);
+            }
+        }
+    }
+    ss_table_iterator_ = std::make_unique<ss_table::MergingIterator>(ss_table_list, ss_table_levels);
+    ss_table_iterator_->Seek(key);
+
+    FindCurrent();
+    SkipDeleted();
+}
+
+void KVStoreIterator::SeekToFirst()
+{
+    Seek(0);
+}
+
+bool KVStoreIterator::Valid() const
+{
+    return current_source_ != Source::kNone;
+}
+
+void KVStoreIterator::Next()
+{
+    assert(Valid());
+    PERF_COUNTER_ADD(iterator_next_count, 1);
+    std::shared_lock<std::shared_mutex> lock(store_->mutex_);
+    AdvanceSources(current_key_);
+    FindCurrent();
+    SkipDeleted();
+}
+
+uint64_t KVStoreIterator::key() const
+{
+    assert(Valid());
+    return current_key_;
+}
+
+std::string KVStoreIterator::value() const
+{
+    assert(Valid());
+    std::shared_lock<std::shared_mutex> lock(store_->mutex_);
+    switch (current_source_)
+    {
+    case Source::kMemTable:
+        return std::string((*mem_table_iterator_).val());
+    case Source::kImmTable:
+        return std::string((*imm_table_iterator_).val());
+    case Source::kSSTable: {
+        const auto &tuple = current_tuple();
+        if(ss_table::IsInlineValue(tuple.vlen)) {
+            return std::string(current_inline_value());
+        }
+        if(tuple.offset < store_->v_log_->tail()) {
+            // 值已被垃圾回收重新写入VLog头部，重新查找该键
+            return store_->GetValue(current_key_);
+        }
+        return store_->v_log_->Get(tuple.offset, tuple.vlen);
+    }
+    case Source::kNone:
+    default:
+        return "";
+    }
+}
+
+void KVStoreIterator::FindCurrent()
+{
+    const skip_list::SkipList::Iterator end(nullptr);
+    current_source_ = Source::kNone;
+    if(mem_table_iterator_ != end) {
+        current_source_ = Source::kMemTable;
+        current_key_ = (*mem_table_iterator_).key();
+    }
+    if(imm_table_iterator_ != end
+        && (current_source_ == Source::kNone || (*imm_table_iterator_).key() < current_key_)) {
+        current_source_ = Source::kImmTable;
+        current_key_ = (*imm_table_iterator_).key();
+    }
+    if(ss_table_iterator_->Valid()) {
+        uint64_t ss_table_key = ss_table_iterator_->current().key_offset_vlen_tuple.key;
+        if(current_source_ == Source::kNone || ss_table_key < current_key_) {
+            current_source_ = Source::kSSTable;
+            current_key_ = ss_table_key;
+            current_level_iterator_ = -1;
+        }
+    }
+    for(size_t i = 0; i < level_iterators_.size(); ++i) {
+        const auto &level_iterator = level_iterators_[i];
+        if(!level_iterator.Valid()) {
+            continue;
+        }
+        uint64_t ss_table_key = level_iterator.current().key;
+        if(current_source_ == Source::kNone || ss_table_key < current_key_
+            || (current_source_ == Source::kSSTable && ss_table_key == current_key_ && current_level_iterator_ < 0
+                && level_iterator.level() < ss_table_iterator_->current_level())) {
+            // 键相同时，只有文件重叠的下层可能排在互不重叠的上层之前
+            current_source_ = Source::kSSTable;
+            current_key_ = ss_table_key;
+            current_level_iterator_ = i;
+        }
+    }
+}
+
+void KVStoreIterator::AdvanceSources(uint64_t key)
+{
+    const skip_list::SkipList::Iterator end(nullptr);
+    if(mem_table_iterator_ != end && (*mem_table_iterator_).key() == key) {
+        ++ mem_table_iterator_;
+    }
+    if(imm_table_iterator_ != end && (*imm_table_iterator_).key() == key) {
+        ++ imm_table_iterator_;
+    }
+    if(ss_table_iterator_->Valid() && ss_table_iterator_->current().key_offset_vlen_tuple.key == key) {
+        ss_table_iterator_->Next();
+    }
+    for(auto &level_iterator: level_iterators_) {
+        if(level_iterator.Valid() && level_iterator.current().key == key) {
+            level_iterator.Next();
+        }
+    }
+}
+
+void KVStoreIterator::SkipDeleted()
+{
+    while(Valid() && IsCurrentDeleted()) {
+        AdvanceSources(current_key_);
+        FindCurrent();
+    }
+}
+
+bool KVStoreIterator::IsCurrentDeleted() const
+{
+    switch (current_source_)
+    {
+    case Source::kMemTable:
+        return (*mem_table_iterator_).val() == DELETED;
+    case Source::kImmTable:
+        return (*imm_table_iterator_).val() == DELETED;
+    case Source::kSSTable:
+        return !current_tuple().vlen;
+    case Source::kNone:
+    default:
+        return false;
+    }
+}
+
+const ss_table::KeyOffsetVlenTuple &KVStoreIterator::current_tuple() const
+{
+    if(current_level_iterator_ >= 0) {
+        return level_iterators_[current_level_iterator_].current();
+    }
+    return ss_table_iterator_->current_tuple();
+}
+
+std::string_view KVStoreIterator::current_inline_value() const
+{
+    if(current_level_iterator_ >= 0) {
+        return level_iterators_[current_level_iterator_].current_inline_value();
+    }
+    return ss_table_iterator_->current_inline_value();
+}
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "skip_list.h"
+
+class KVStore;
+namespace ss_table
+{
+	class MergingIterator;
+	class LevelIterator;
+	struct KeyOffsetVlenTuple;
+}
+
+/**
+ * @brief 按键升序遍历KVStore的迭代器
+ * @details 惰性地归并内存表、只读内存表与各层SSTable的游标，跳过删除标记；
+ * 只有调用value()时才从VLog读取值。level-0与文件重叠的层在Seek时为每个文件建立游标，
+ * 互不重叠的层每层只有一个串联迭代器，遍历到下一个文件时才加载该文件。
+ * Seek时获取KVStore当前的内存表与各层文件列表的快照，之后写入内存表的数据可能可见，而之后写入的SSTable不可见；
+ * 迭代器存活期间，合并不会删除快照中的文件。迭代器不能在KVStore销毁后使用。
+ */
+class KVStoreIterator
+{
+	friend class KVStore;
+
+public:
+	~KVStoreIterator();
+
+	/**
+	 * @brief 定位到第一个键不小于key的有效记录
+	 */
+	void Seek(uint64_t key);
+
+	/**
+	 * @brief 定位到第一条有效记录
+	 */
+	void SeekToFirst();
+
+	/**
+	 * @brief 是否指向一条有效记录
+	 */
+	bool Valid() const;
+
+	/**
+	 * @brief 移动到下一条有效记录
+	 */
+	void Next();
+
+	/**
+	 * @brief 当前记录的键
+	 */
+	uint64_t key() const;
+
+	/**
+	 * @brief 当前记录的值，位于SSTable中的值在此时才从VLog读取
+	 */
+	std::string value() const;
+
+private:
+	enum class Source {
+		kMemTable,
+		kImmTable,
+		kSSTable,
+		kNone
+	};
+
+	explicit KVStoreIterator(KVStore *store);
+
+	/**
+	 * @brief 在各来源中选出键最小的记录，键相同时内存表优先于只读内存表，只读内存表优先于SSTable，
+	 * SSTable之间层数小的优先
+	 */
+	void FindCurrent();
+
+	/**
+	 * @brief 将所有位于键key的来源前移一位
+	 */
+	void AdvanceSources(uint64_t key);
+
+	/**
+	 * @brief 跳过删除标记，直到指向有效记录或遍历结束
+	 */
+	void SkipDeleted();
+
+	bool IsCurrentDeleted() const;
+
+	/**
+	 * @brief 当前记录在SSTable中的元组，调用者须保证当前记录来自SSTable
+	 */
+	const ss_table::KeyOffsetVlenTuple &current_tuple() const;
+
+	/**
+	 * @brief 当前记录内联存储的值，调用者须保证当前记录来自SSTable且为内联值
+	 */
+	std::string_view current_inline_value() const;
+
+	KVStore *store_;
+	std::shared_ptr<skip_list::SkipList> mem_table_;
+	std::shared_ptr<skip_list::SkipList> imm_table_;
+	skip_list::SkipList::Iterator mem_table_iterator_;
+	skip_list::SkipList::Iterator imm_table_iterator_;
+	std::unique_ptr<ss_table::MergingIterator> ss_table_iterator_; // level-0与文件重叠的层
+	std::vector<ss_table::LevelIterator> level_iterators_; // 每个互不重叠的层一个，按层数升序
+	bool pinned_ = false; // 是否已通知KVStore推迟删除合并掉的文件
+
+	Source current_source_ = Source::kNone;
+	int current_level_iterator_ = -1; // 当前记录来自level_iterators_中的下标，-1表示来自ss_table_iterator_
+	uint64_t current_key_ = 0;
+};
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <cstddef>
+#include "inc.h"
+
+/**
+ * @brief 预写日志的同步模式
+ */
+enum class WalSyncMode
+{
+	kNone,		// 只写入操作系统缓存，进程崩溃不丢数据，掉电可能丢失
+	kPerBatch,	// 每组提交调用一次fdatasync后才返回
+	kPeriodic	// 后台线程每隔wal_sync_period_ms调用一次fdatasync
+};
+
+/**
+ * @brief KVStore的可选配置，默认值与课程测试的行为一致
+ */
+struct KVStoreOptions
+{
+	/**
+	 * @brief 内存表占用内存的字节预算，达到预算或键数达到MEM_TABLE_CAPACITY时转换内存表
+	 * @details 覆盖写入不增加键数，但旧值直到内存表释放才回收，因此须同时按字节计量
+	 */
+	size_t mem_table_memory_capacity = MEM_TABLE_MEMORY_CAPACITY;
+
+	/**
+	 * @brief 读取VLog中的值时是否使用只读内存映射，为false时使用pread
+	 */
+	bool v_log_use_mmap = false;
+
+	/**
+	 * @brief 批量读取VLog（scan与MultiGet）时同时在途的最大请求数，优先使用io_uring，不可用时使用pread线程池；
+	 * 为0或v_log_use_mmap为true时同步读取
+	 */
+	unsigned v_log_io_queue_depth = V_LOG_IO_QUEUE_DEPTH;
+
+	/**
+	 * @brief 短于该字节数的值内联存储在SSTable中，不写入VLog；为0时所有值都写入VLog
+	 * @details 内联值的查找不需要额外读取VLog，也不会在VLog中产生垃圾，但会增大SSTable与其缓存占用
+	 */
+	size_t min_blob_size = MIN_BLOB_SIZE;
+
+	/**
+	 * @brief SSTable缓存的字节预算，超出时按LRU淘汰未被使用的SSTable
+	 */
+	size_t ss_table_cache_capacity = SS_TABLE_CACHE_CAPACITY;
+
+	/**
+	 * @brief 新建SSTable的Bloom过滤器中每个键占用的比特数
+	 */
+	int bloom_filter_bits_per_key = BLOOM_FILTER_BITS_PER_KEY;
+
+	/**
+	 * @brief 一次合并最多划分的子合并数，各子合并按键范围并行执行；为1时不划分
+	 */
+	int max_subcompactions = MAX_SUBCOMPACTIONS;
+
+	/**
+	 * @brief 每隔多少秒将GetProperty("lsmkv.stats")追加到数据目录下的STATS文件，为0时不输出
+	 */
+	unsigned stats_dump_period_seconds = STATS_DUMP_PERIOD_SECONDS;
+
+	/**
+	 * @brief 是否将put/del写入预写日志
+	 * @details 启用时内存表在崩溃后可以通过重放日志恢复，析构时不再将内存表写入SSTable；
+	 * 关闭时只在析构时将内存表写入SSTable
+	 */
+	bool use_wal = true;
+
+	/**
+	 * @brief 预写日志的同步模式
+	 */
+	WalSyncMode wal_sync_mode = WalSyncMode::kNone;
+
+	/**
+	 * @brief wal_sync_mode为kPeriodic时的同步间隔（毫秒）
+	 */
+	unsigned wal_sync_period_ms = WAL_SYNC_PERIOD_MS;
+};
@@ -0,0 +1,164 @@
+#include "manifest.h"
+#include "version.h"
+#include "utils.h"
+#include "utils/logger.h"
+
+#include <fstream>
+#include <sstream>
+#include <cstdio>
+
+namespace version {
+    const size_t kRecordHeaderSize = sizeof(uint32_t) + sizeof(uint16_t);
+
+    Manifest::Manifest(const std::string &file_name): file_name_(file_name) { }
+
+    Manifest::~Manifest()
+    {
+        if(fd_ >= 0) {
+            close(fd_);
+        }
+    }
+
+    bool Manifest::Exists() const
+    {
+        struct stat st;
+        return stat(file_name_.c_str(), &st) == 0;
+    }
+
+    bool Manifest::Recover(Version &version)
+    {
+        std::ifstream fin(file_name_, std::ios::binary);
+        if(!fin) {
+            return false;
+        }
+        std::stringstream buffer;
+        buffer << fin.rdbuf();
+        fin.close();
+        std::string content = buffer.str();
+
+        size_t pos = 0;
+        record_count_ = 0;
+        while(content.size() - pos >= kRecordHeaderSize) {
+            uint32_t len;
+            uint16_t check_sum;
+            memcpy(&len, content.data() + pos, sizeof(len));
+            memcpy(&check_sum, content.data() + pos + sizeof(len), sizeof(check_sum));
+            if(content.size() - pos - kRecordHeaderSize < len) {
+                LOG_WARNING("Truncated MANIFEST record at offset %zu", pos);
+                break;
+            }
+            const char *payload = content.data() + pos + kRecordHeaderSize;
+            std::vector<unsigned char> data(payload, payload + len);
+            VersionEdit edit;
+            if(utils::crc16(data) != check_sum || !edit.DecodeFrom(payload, len)) {
+                if(pos + kRecordHeaderSize + len < content.size()) {
+                    // 损坏的记录之后还有数据，不是崩溃时写了一半的最后一条记录
+                    LOG_ERROR("Corrupted MANIFEST record at offset %zu", pos);
+                    return false;
+                }
+                LOG_WARNING("Corrupted MANIFEST record at offset %zu", pos);
+                break;
+            }
+            version.Apply(edit);
+            pos += kRecordHeaderSize + len;
+            ++ record_count_;
+        }
+        if(record_count_ == 0 && !content.empty()) {
+            // 第一条记录是原子替换写入的快照，不可能只写了一半
+            LOG_ERROR("No valid record in MANIFEST");
+            return false;
+        }
+
+        fd_ = open(file_name_.c_str(), O_WRONLY | O_APPEND);
+        if(fd_ < 0) {
+            perror("open");
+            return false;
+        }
+        if(pos < content.size()) {
+            // 丢弃崩溃时写了一半的记录
+            if(ftruncate(fd_, pos) < 0) {
+                perror("ftruncate");
+            }
+        }
+        LOG_INFO("Recovered %d MANIFEST record(s)", record_count_);
+        return true;
+    }
+
+    bool Manifest::Append(const VersionEdit &edit)
+    {
+        if(fd_ < 0) {
+            fd_ = open(file_name_.c_str(), O_WRONLY | O_APPEND | O_CREAT, 0644);
+            if(fd_ < 0) {
+                perror("open");
+                return false;
+            }
+        }
+        struct stat st;
+        if(fstat(fd_, &st) < 0) {
+            perror("fstat");
+            return false;
+        }
+        std::string record;
+        EncodeRecord(edit, record);
+        if(write(fd_, record.data(), record.size()) != static_cast<ssize_t>(record.size())
+            || fdatasync(fd_) < 0) {
+            LOG_ERROR("Failed to append MANIFEST record");
+            // 截断写了一半的记录，否则之后追加的记录位于损坏的记录之后，无法重放
+            if(ftruncate(fd_, st.st_size) < 0) {
+                perror("ftruncate");
+            }
+            return false;
+        }
+        ++ record_count_;
+        return true;
+    }
+
+    void Manifest::WriteSnapshot(const Version &version)
+    {
+        std::string record;
+        EncodeRecord(version.BuildSnapshot(), record);
+
+        std::string tmp_file_name = file_name_ + ".tmp";
+        int tmp_fd = open(tmp_file_name.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if(tmp_fd < 0) {
+            perror("open");
+            return ;
+        }
+        if(write(tmp_fd, record.data(), record.size()) != static_cast<ssize_t>(record.size())) {
+            LOG_ERROR("Failed to write MANIFEST snapshot");
+            close(tmp_fd);
+            return ;
+        }
+        fdatasync(tmp_fd);
+        close(tmp_fd);
+
+        if(rename(tmp_file_name.c_str(), file_name_.c_str()) < 0) {
+            perror("rename");
+            return ;
+        }
+        // 重命名记录在目录中，目录落盘后新快照才不会因掉电丢失
+        size_t slash = file_name_.find_last_of('/');
+        utils::syncDir(slash == std::string::npos ? "." : file_name_.substr(0, slash));
+        if(fd_ >= 0) {
+            close(fd_);
+        }
+        fd_ = open(file_name_.c_str(), O_WRONLY | O_APPEND);
+        record_count_ = 1;
+    }
+
+    bool Manifest::NeedsSnapshot() const
+    {
+        return record_count_ >= kManifestSnapshotInterval;
+    }
+
+    void Manifest::EncodeRecord(const VersionEdit &edit, std::string &record)
+    {
+        std::string payload;
+        edit.EncodeTo(payload);
+        uint32_t len = payload.size();
+        uint16_t check_sum = utils::crc16(std::vector<unsigned char>(payload.begin(), payload.end()));
+        record.append(reinterpret_cast<const char*>(&len), sizeof(len));
+        record.append(reinterpret_cast<const char*>(&check_sum), sizeof(check_sum));
+        record.append(payload);
+    }
+}
@@ -0,0 +1,75 @@
+#ifndef MANIFEST_H
+#define MANIFEST_H
+#include <string>
+#include <cstdint>
+
+namespace version {
+    struct VersionEdit;
+    class Version;
+
+    /**
+     * @brief 每追加该数量的修改记录后，将MANIFEST重写为一份快照
+     */
+    const int kManifestSnapshotInterval = 1024;
+
+    /**
+     * @brief 仅追加的MANIFEST日志
+     * @details 每条记录格式为 [4字节长度][2字节crc16校验和][VersionEdit编码]，
+     * 文件的第一条记录总是完整快照。一次合并的所有增删作为一条记录写入，
+     * 因此崩溃后的清单要么是合并前的状态，要么是合并后的状态。
+     */
+    class Manifest {
+    public:
+        /**
+         * @param file_name MANIFEST文件路径，如"data/MANIFEST"
+         */
+        explicit Manifest(const std::string &file_name);
+        ~Manifest();
+
+        /**
+         * @brief MANIFEST文件是否存在
+         */
+        bool Exists() const;
+
+        /**
+         * @brief 重放MANIFEST文件中的所有记录，恢复层级清单
+         * @details 只有文件末尾崩溃时写了一半的记录会被截断；文件中间的记录损坏，
+         * 或非空文件中没有一条有效记录时视为MANIFEST损坏，此时version只重放了一部分，不可使用
+         *
+         * @param version 重放的目标清单
+         * @return true 重放成功
+         * @return false MANIFEST文件不存在、无法读取或已损坏
+         */
+        bool Recover(Version &version);
+
+        /**
+         * @brief 追加一条修改记录并落盘
+         * @details 写入或落盘失败时截断写了一半的记录，使之后追加的记录仍然可以重放
+         *
+         * @return true 记录已落盘
+         * @return false 写入失败，调用者不能假定修改已持久化
+         */
+        bool Append(const VersionEdit &edit);
+
+        /**
+         * @brief 以version的完整状态重写MANIFEST文件（写临时文件后原子替换）
+         */
+        void WriteSnapshot(const Version &version);
+
+        /**
+         * @brief 自上次快照以来追加的记录数是否达到阈值
+         */
+        bool NeedsSnapshot() const;
+
+        const std::string &file_name() const { return file_name_; }
+
+    private:
+        static void EncodeRecord(const VersionEdit &edit, std::string &record);
+
+        std::string file_name_;
+        int fd_ = -1;
+        int record_count_ = 0; // 自上次快照以来追加的记录数
+    };
+}
+
+#endif //MANIFEST_H
@@ -0,0 +1,60 @@
+#include "perf_context.h"
+
+#include <cstring>
+
+namespace perf_context {
+    thread_local PerfLevel tls_perf_level = PerfLevel::kDisable;
+    thread_local PerfContext tls_perf_context = {};
+
+    void PerfContext::Reset()
+    {
+        memset(this, 0, sizeof(PerfContext));
+    }
+
+    std::string PerfContext::ToString(bool exclude_zero_counters) const
+    {
+        std::string result;
+        auto append = [&result, exclude_zero_counters](const std::string &name, uint64_t value) {
+            if(exclude_zero_counters && !value) {
+                return ;
+            }
+            result += name + " = " + std::to_string(value) + "\n";
+        };
+        append("get_nanos", get_nanos);
+        append("scan_nanos", scan_nanos);
+        append("iterator_seek_nanos", iterator_seek_nanos);
+        append("iterator_next_count", iterator_next_count);
+        append("memtable_get_count", memtable_get_count);
+        append("memtable_get_nanos", memtable_get_nanos);
+        append("metadata_nanos", metadata_nanos);
+        append("ss_table_cache_hit_count", ss_table_cache_hit_count);
+        append("ss_table_cache_miss_count", ss_table_cache_miss_count);
+        append("ss_table_load_nanos", ss_table_load_nanos);
+        for(int level = 0; level < kMaxLevels; ++level) {
+            append("bloom_filter_probe_count@level" + std::to_string(level), bloom_filter_probe_count[level]);
+            append("bloom_filter_useful_count@level" + std::to_string(level), bloom_filter_useful_count[level]);
+        }
+        append("bloom_filter_nanos", bloom_filter_nanos);
+        append("binary_search_count", binary_search_count);
+        append("binary_search_nanos", binary_search_nanos);
+        append("v_log_read_count", v_log_read_count);
+        append("v_log_read_bytes", v_log_read_bytes);
+        append("v_log_read_nanos", v_log_read_nanos);
+        return result;
+    }
+
+    void SetPerfLevel(PerfLevel level)
+    {
+        tls_perf_level = level;
+    }
+
+    PerfLevel GetPerfLevel()
+    {
+        return tls_perf_level;
+    }
+
+    PerfContext *get_perf_context()
+    {
+        return &tls_perf_context;
+    }
+}
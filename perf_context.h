@@ -0,0 +1,119 @@
+#ifndef LSMKV_HANDOUT_PERF_CONTEXT_H
+#define LSMKV_HANDOUT_PERF_CONTEXT_H
+
+#include <cstdint>
+#include <chrono>
+#include <string>
+
+namespace perf_context {
+    /**
+     * @brief 线程局部的性能记录级别，默认不记录
+     */
+    enum class PerfLevel {
+        kDisable,
+        kEnableCount,   // 只记录计数
+        kEnableTime     // 记录计数与耗时
+    };
+
+    /**
+     * @brief 线程局部的单次请求性能明细
+     * @details 调用者在一次get或scan之前调用SetPerfLevel并Reset，返回后读取get_perf_context()，
+     * 即可得到该请求在各阶段的计数与耗时（纳秒）。只记录当前线程执行的部分，不包括后台线程。
+     */
+    struct PerfContext {
+        static const int kMaxLevels = 16; // 更深的层计入最后一项
+
+        uint64_t get_nanos;                 // KVStore::get总耗时
+        uint64_t scan_nanos;                // KVStore::scan总耗时
+        uint64_t iterator_seek_nanos;       // 迭代器定位（获取内存表并加载SSTable）
+        uint64_t iterator_next_count;
+
+        uint64_t memtable_get_count;        // 查找的内存表与只读内存表个数
+        uint64_t memtable_get_nanos;
+
+        uint64_t metadata_nanos;            // 在层级清单中查找文件，并从缓存取得SSTable
+        uint64_t ss_table_cache_hit_count;
+        uint64_t ss_table_cache_miss_count;
+        uint64_t ss_table_load_nanos;       // 缓存未命中时读取并解析SSTable文件
+
+        uint64_t bloom_filter_probe_count[kMaxLevels];  // 按层统计的Bloom过滤器查询次数
+        uint64_t bloom_filter_useful_count[kMaxLevels]; // 按层统计的判断键不存在的次数
+        uint64_t bloom_filter_nanos;
+
+        uint64_t binary_search_count;       // SSTable元组列表的二分查找次数
+        uint64_t binary_search_nanos;
+
+        uint64_t v_log_read_count;
+        uint64_t v_log_read_bytes;
+        uint64_t v_log_read_nanos;
+
+        void Reset();
+
+        /**
+         * @brief 每行输出一项，形如"memtable_get_count = 2"
+         * @param exclude_zero_counters 为true时省略值为0的项
+         */
+        std::string ToString(bool exclude_zero_counters = false) const;
+    };
+
+    extern thread_local PerfLevel tls_perf_level;
+    extern thread_local PerfContext tls_perf_context;
+
+    void SetPerfLevel(PerfLevel level);
+    PerfLevel GetPerfLevel();
+
+    /**
+     * @brief 当前线程的PerfContext
+     */
+    PerfContext *get_perf_context();
+
+    /**
+     * @brief 析构时将构造以来经过的纳秒数累加到metric，记录级别低于kEnableTime时不读取时钟
+     */
+    class PerfTimer
+    {
+    public:
+        explicit PerfTimer(uint64_t &metric)
+            : metric_(metric), enabled_(tls_perf_level >= PerfLevel::kEnableTime)
+        {
+            if(enabled_) {
+                start_time_ = std::chrono::steady_clock::now();
+            }
+        }
+        ~PerfTimer()
+        {
+            if(enabled_) {
+                metric_ += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now() - start_time_).count();
+            }
+        }
+        PerfTimer(const PerfTimer &) = delete;
+        PerfTimer &operator=(const PerfTimer &) = delete;
+
+    private:
+        uint64_t &metric_;
+        bool enabled_;
+        std::chrono::steady_clock::time_point start_time_;
+    };
+}
+
+#define PERF_TIMER_GUARD(metric) \
+    perf_context::PerfTimer perf_timer_##metric(perf_context::tls_perf_context.metric)
+
+#define PERF_COUNTER_ADD(metric, value) \
+    do { \
+        if(perf_context::tls_perf_level >= perf_context::PerfLevel::kEnableCount) { \
+            perf_context::tls_perf_context.metric += (value); \
+        } \
+    } while(0)
+
+#define PERF_COUNTER_BY_LEVEL_ADD(metric, value, level) \
+    do { \
+        if(perf_context::tls_perf_level >= perf_context::PerfLevel::kEnableCount) { \
+            int perf_level_index = (level) < perf_context::PerfContext::kMaxLevels \
+                ? (level) : perf_context::PerfContext::kMaxLevels - 1; \
+            perf_context::tls_perf_context.metric[perf_level_index] += (value); \
+        } \
+    } while(0)
+
+#endif //LSMKV_HANDOUT_PERF_CONTEXT_H
@@ -0,0 +1,513 @@
+#include <iostream>
+#include <cstdint>
+#include <string>
+#include <cassert>
+#include <thread>
+#include <vector>
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <csignal>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "test.h"
+#include "ss_table.h"
+#include "statistics.h"
+
+class RecoveryTest : public Test
+{
+private:
+	const uint64_t TEST_MAX = 1024 * 8;
+	const uint64_t HOT_KEYS = 16;
+	const int WRITERS = 4;
+	const int HOT_WRITES = 4096;
+
+	std::string value(uint64_t i, char c)
+	{
+		return std::string(i % 64 + 1, c) + std::to_string(i);
+	}
+
+	std::string expected(uint64_t i)
+	{
+		if (i % 3 == 0)
+			return not_found;
+		if (i % 5 == 1)
+			return value(i, 't');
+		return value(i, 's');
+	}
+
+public:
+	/**
+	 * Write data, then return the values of the hot keys as seen by get().
+	 * The caller exits without destroying the store, so the last memtable
+	 * can only be recovered from the write-ahead log.
+	 */
+	std::vector<std::string> prepare()
+	{
+		std::cout << "<<Preparation Mode>>" << std::endl;
+		uint64_t i;
+
+		store.reset();
+
+		for (i = 0; i < TEST_MAX; ++i)
+		{
+			store.put(i, value(i, 's'));
+		}
+		for (i = 0; i < TEST_MAX; i += 3)
+		{
+			EXPECT(true, store.del(i));
+		}
+		for (i = 1; i < TEST_MAX; i += 5)
+		{
+			if (i % 3)
+				store.put(i, value(i, 't'));
+		}
+		for (i = 0; i < TEST_MAX; ++i)
+			EXPECT(expected(i), store.get(i));
+		phase();
+
+		// Concurrent writers race on a few hot keys
+		std::vector<std::thread> writers;
+		for (int t = 0; t < WRITERS; ++t)
+		{
+			writers.emplace_back([this, t] {
+				for (int j = 0; j < HOT_WRITES; ++j)
+					store.put(TEST_MAX + j % HOT_KEYS, std::to_string(t) + "-" + std::to_string(j));
+			});
+		}
+		for (auto &writer : writers)
+			writer.join();
+
+		std::vector<std::string> hot_values;
+		for (i = 0; i < HOT_KEYS; ++i)
+		{
+			hot_values.push_back(store.get(TEST_MAX + i));
+			EXPECT(false, hot_values.back().empty());
+		}
+		phase();
+
+		report();
+		return hot_values;
+	}
+
+	void test(const std::vector<std::string> &hot_values)
+	{
+		std::cout << "<<Test Mode>>" << std::endl;
+		uint64_t i;
+
+		for (i = 0; i < TEST_MAX; ++i)
+			EXPECT(expected(i), store.get(i));
+		phase();
+
+		// Replay must restore the values readers saw before the crash
+		for (i = 0; i < HOT_KEYS; ++i)
+			EXPECT(hot_values[i], store.get(TEST_MAX + i));
+		phase();
+
+		report();
+	}
+
+	RecoveryTest(const std::string &dir, const std::string &vlog, bool v, const KVStoreOptions &options)
+		: Test(dir, vlog, v, options)
+	{
+	}
+};
+
+class ManifestTest : public Test
+{
+private:
+	const uint64_t TEST_MAX = 1024 * 8;
+
+	std::string value(uint64_t i)
+	{
+		return std::string(i % 64 + 1, 'm') + std::to_string(i);
+	}
+
+	std::string expected(uint64_t i)
+	{
+		return i % 7 == 0 ? not_found : value(i);
+	}
+
+public:
+	/**
+	 * Write enough data to flush and compact, so that the MANIFEST holds
+	 * a snapshot followed by many edit records.
+	 */
+	void prepare()
+	{
+		std::cout << "<<Preparation Mode>>" << std::endl;
+		uint64_t i;
+
+		store.reset();
+		for (i = 0; i < TEST_MAX; ++i)
+			store.put(i, value(i));
+		for (i = 0; i < TEST_MAX; i += 7)
+			EXPECT(true, store.del(i));
+		for (i = 0; i < TEST_MAX; ++i)
+			EXPECT(expected(i), store.get(i));
+		phase();
+
+		report();
+	}
+
+	/**
+	 * @param corrupted whether the store must have set the MANIFEST aside as corrupted
+	 */
+	void test(const std::string &manifest, bool corrupted)
+	{
+		std::cout << "<<Test Mode>>" << std::endl;
+
+		for (uint64_t i = 0; i < TEST_MAX; ++i)
+			EXPECT(expected(i), store.get(i));
+		phase();
+
+		struct stat st;
+		EXPECT(corrupted, stat((manifest + ".corrupted").c_str(), &st) == 0);
+		phase();
+
+		report();
+	}
+
+	ManifestTest(const std::string &dir, const std::string &vlog, bool v)
+		: Test(dir, vlog, v)
+	{
+	}
+};
+
+class TrivialMoveTest : public Test
+{
+private:
+	const uint64_t TEST_MAX = 1024 * 16;
+
+	std::string value(uint64_t i)
+	{
+		return std::string(i % 64 + 1, 'v') + std::to_string(i);
+	}
+
+public:
+	/**
+	 * Levels holding each SSTable file on disk, by base file name.
+	 * The store must be closed, since a running move links the file into both levels.
+	 */
+	static std::map<std::string, std::vector<int>> scan_levels(const std::string &dir)
+	{
+		std::map<std::string, std::vector<int>> levels;
+		for (int level = 0; utils::dirExists(ss_table::SSTable::BuildSSTableDirName(dir, level)); ++level)
+		{
+			std::vector<std::string> base_file_name_list;
+			utils::scanDir(ss_table::SSTable::BuildSSTableDirName(dir, level), base_file_name_list);
+			for (const auto &base_file_name : base_file_name_list)
+			{
+				if (base_file_name.ends_with(".sst"))
+					levels[base_file_name].push_back(level);
+			}
+		}
+		return levels;
+	}
+
+	/**
+	 * Leave the on-disk state of two moves interrupted by a crash: one linked into the
+	 * next level before the MANIFEST record, one recorded but not yet unlinked from the
+	 * level above. Returns the paths that recovery must remove.
+	 */
+	static std::vector<std::string> interrupt_moves(const std::string &dir)
+	{
+		int deepest = -1;
+		std::vector<std::string> base_file_name_list;
+		for (const auto &[base_file_name, levels] : scan_levels(dir))
+		{
+			if (levels.back() > deepest)
+			{
+				deepest = levels.back();
+				base_file_name_list.clear();
+			}
+			if (levels.back() == deepest)
+				base_file_name_list.push_back(base_file_name);
+		}
+		std::vector<std::string> injected;
+		if (deepest < 2)
+			return injected;
+
+		const std::string &linked = base_file_name_list.front();
+		utils::mkdir(ss_table::SSTable::BuildSSTableDirName(dir, deepest + 1));
+		injected.push_back(ss_table::SSTable::BuildSSTableFileName(dir, deepest + 1, linked));
+		utils::linkfile(ss_table::SSTable::BuildSSTableFileName(dir, deepest, linked), injected.back());
+
+		const std::string &unlinked = base_file_name_list.back();
+		injected.push_back(ss_table::SSTable::BuildSSTableFileName(dir, deepest - 1, unlinked));
+		utils::linkfile(ss_table::SSTable::BuildSSTableFileName(dir, deepest, unlinked), injected.back());
+		return injected;
+	}
+
+	/**
+	 * Sequential keys in [first, last), which compaction moves down without rewriting.
+	 */
+	void ingest(uint64_t first, uint64_t last)
+	{
+		for (uint64_t i = first; i < last; ++i)
+			store.put(i, value(i));
+	}
+
+	void prepare()
+	{
+		std::cout << "<<Preparation Mode>>" << std::endl;
+
+		store.reset();
+		ingest(0, TEST_MAX);
+		EXPECT(true, store.statistics().ticker(statistics::Ticker::kTrivialMoveCount) > 0);
+		phase();
+
+		report();
+	}
+
+	/**
+	 * @param acknowledged keys below this were written before the crash
+	 */
+	void test(uint64_t acknowledged)
+	{
+		std::cout << "<<Test Mode>>" << std::endl;
+
+		for (uint64_t i = 0; i < acknowledged; ++i)
+			EXPECT(value(i), store.get(i));
+		phase();
+
+		report();
+	}
+
+	/**
+	 * @param levels scan_levels() after the recovered store was closed
+	 * @param injected paths left by interrupt_moves()
+	 */
+	void check_files(const std::map<std::string, std::vector<int>> &levels, const std::vector<std::string> &injected)
+	{
+		std::cout << "<<File Check>>" << std::endl;
+
+		EXPECT(false, levels.empty());
+		for (const auto &[base_file_name, file_levels] : levels)
+			EXPECT(size_t(1), file_levels.size());
+		struct stat st;
+		for (const auto &file_name : injected)
+			EXPECT(false, stat(file_name.c_str(), &st) == 0);
+		phase();
+
+		report();
+	}
+
+	uint64_t test_max() const
+	{
+		return TEST_MAX;
+	}
+
+	TrivialMoveTest(const std::string &dir, const std::string &vlog, bool v, const KVStoreOptions &options)
+		: Test(dir, vlog, v, options)
+	{
+	}
+};
+
+int main(int argc, char *argv[])
+{
+	bool verbose = (argc == 2 && std::string(argv[1]) == "-v");
+
+	std::cout << "Usage: " << argv[0] << " [-v]" << std::endl;
+	std::cout << "  -v: print extra info for failed tests [currently ";
+	std::cout << (verbose ? "ON" : "OFF") << "]" << std::endl;
+	std::cout << std::endl;
+	std::cout.flush();
+
+	const std::pair<WalSyncMode, const char *> modes[] = {
+		{WalSyncMode::kNone, "none"},
+		{WalSyncMode::kPerBatch, "per-batch"},
+		{WalSyncMode::kPeriodic, "periodic"},
+	};
+	for (const auto &[mode, name] : modes)
+	{
+		std::cout << "KVStore Recovery Test [WAL sync mode: " << name << "]" << std::endl;
+		std::cout.flush();
+
+		KVStoreOptions options;
+		options.use_wal = true;
+		options.wal_sync_mode = mode;
+
+		int fds[2];
+		if (pipe(fds) < 0)
+		{
+			perror("pipe");
+			return -1;
+		}
+
+		pid_t pid = fork();
+		if (pid == 0)
+		{
+			close(fds[0]);
+			RecoveryTest test("./data", "./data/vlog", verbose, options);
+			std::vector<std::string> hot_values = test.prepare();
+
+			// Hand the observed values to the parent, then die without flushing the memtable
+			std::string message;
+			for (const auto &hot_value : hot_values)
+				message += hot_value + "\n";
+			if (write(fds[1], message.data(), message.size()) != static_cast<ssize_t>(message.size()))
+				perror("write");
+			close(fds[1]);
+			std::cout.flush();
+			_exit(0);
+		}
+		else if (pid > 0)
+		{
+			close(fds[1]);
+			std::string message;
+			char buffer[4096];
+			ssize_t n;
+			while ((n = read(fds[0], buffer, sizeof(buffer))) > 0)
+				message.append(buffer, n);
+			close(fds[0]);
+			waitpid(pid, nullptr, 0);
+
+			std::vector<std::string> hot_values;
+			std::stringstream ss(message);
+			std::string line;
+			while (std::getline(ss, line))
+				hot_values.push_back(line);
+
+			RecoveryTest test("./data", "./data/vlog", verbose, options);
+			test.test(hot_values);
+		}
+		else
+		{
+			perror("fork");
+			return -1;
+		}
+		std::cout << std::endl;
+	}
+
+	const std::string manifest = "./data/MANIFEST";
+	const std::pair<bool, const char *> damages[] = {
+		{false, "torn tail record"},
+		{true, "corrupted first record"},
+	};
+	for (const auto &[corrupted, name] : damages)
+	{
+		std::cout << "KVStore MANIFEST Recovery Test [" << name << "]" << std::endl;
+		std::cout.flush();
+
+		std::remove((manifest + ".corrupted").c_str());
+		{
+			ManifestTest test("./data", "./data/vlog", verbose);
+			test.prepare();
+		}
+
+		if (corrupted)
+		{
+			// Flip a byte inside the snapshot, which is followed by further records
+			std::fstream file(manifest, std::ios::in | std::ios::out | std::ios::binary);
+			char byte;
+			file.seekg(8);
+			file.get(byte);
+			file.seekp(8);
+			file.put(static_cast<char>(~byte));
+		}
+		else
+		{
+			// A record header announcing more bytes than were written before the crash
+			std::ofstream file(manifest, std::ios::app | std::ios::binary);
+			uint32_t len = 4096;
+			uint16_t check_sum = 0;
+			file.write(reinterpret_cast<const char *>(&len), sizeof(len));
+			file.write(reinterpret_cast<const char *>(&check_sum), sizeof(check_sum));
+			file.write("torn", 4);
+		}
+
+		{
+			ManifestTest test("./data", "./data/vlog", verbose);
+			test.test(manifest, corrupted);
+		}
+		// Records appended after recovery must not land behind the damaged bytes
+		{
+			ManifestTest test("./data", "./data/vlog", verbose);
+			test.test(manifest, corrupted);
+		}
+		std::remove((manifest + ".corrupted").c_str());
+		std::cout << std::endl;
+	}
+
+	// Without the write-ahead log the store finishes every compaction before closing
+	std::cout << "KVStore Trivial Move Recovery Test [interrupted moves]" << std::endl;
+	std::cout.flush();
+	KVStoreOptions move_options;
+	move_options.use_wal = false;
+	uint64_t acknowledged;
+	{
+		TrivialMoveTest test("./data", "./data/vlog", verbose, move_options);
+		test.prepare();
+		acknowledged = test.test_max();
+	}
+	std::vector<std::string> injected = TrivialMoveTest::interrupt_moves("./data");
+	{
+		TrivialMoveTest test("./data", "./data/vlog", verbose, move_options);
+		test.test(acknowledged);
+	}
+	{
+		auto levels = TrivialMoveTest::scan_levels("./data");
+		TrivialMoveTest test("./data", "./data/vlog", verbose, move_options);
+		test.check_files(levels, injected);
+	}
+	std::cout << std::endl;
+
+	// Kill a writer at different points of sequential ingestion
+	move_options.use_wal = true;
+	for (int round = 0; round < 3; ++round)
+	{
+		std::cout << "KVStore Trivial Move Recovery Test [killed writer, round " << round + 1 << "]" << std::endl;
+		std::cout.flush();
+
+		int fds[2];
+		if (pipe(fds) < 0)
+		{
+			perror("pipe");
+			return -1;
+		}
+		uint64_t first = acknowledged;
+		acknowledged += 1024 * 8;
+		pid_t pid = fork();
+		if (pid == 0)
+		{
+			close(fds[0]);
+			TrivialMoveTest test("./data", "./data/vlog", false, move_options);
+			test.ingest(first, acknowledged);
+			if (write(fds[1], "r", 1) != 1)
+				perror("write");
+			close(fds[1]);
+			test.ingest(acknowledged, UINT64_MAX);
+			_exit(0);
+		}
+		else if (pid > 0)
+		{
+			close(fds[1]);
+			char ready;
+			if (read(fds[0], &ready, 1) != 1)
+				perror("read");
+			close(fds[0]);
+			usleep(50000 * (round + 1));
+			kill(pid, SIGKILL);
+			waitpid(pid, nullptr, 0);
+
+			{
+				TrivialMoveTest test("./data", "./data/vlog", verbose, move_options);
+				test.test(acknowledged);
+			}
+			auto levels = TrivialMoveTest::scan_levels("./data");
+			TrivialMoveTest test("./data", "./data/vlog", verbose, move_options);
+			test.check_files(levels, {});
+		}
+		else
+		{
+			perror("fork");
+			return -1;
+		}
+		std::cout << std::endl;
+	}
+
+	return 0;
+}
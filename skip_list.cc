@@ -6,65 +6,65 @@
 #include "v_log.h"
 #include "utils.h"
 #include <cassert>
+#include <random>
+#include <algorithm>
+#include <new>
 
 namespace skip_list {
     SkipList::SkipList(double p)
-    : probability_(p)
+    : head_(nullptr)
+    , probability_(p)
+    , max_height_(1)
     , size_(0)
     {
-        // 加入头结点
-        headers_.push_back(new Node);
+        head_ = NewNode(0, nullptr, kMaxHeight);
     }
-    void SkipList::Put(uint64_t key, const std::string &val) {
-        bool is_found;
-        auto res_node = GetNode(key, &is_found);
-        if(is_found) {
-            // 查找成功，直接覆盖
-            while (res_node->below_) {
-                res_node = res_node->below_;
+
+    void SkipList::Put(uint64_t key, const std::string &val, uint64_t sequence) {
+        Node *prev[kMaxHeight];
+        const char *val_data = CopyValue(val, sequence);
+        while(true) {
+            // 高于查找时跳表高度的层（可能被其他线程同时增高），前驱结点为头结点
+            std::fill(prev, prev + kMaxHeight, head_);
+            Node *next = FindGreaterOrEqual(key, prev);
+            if(next && next->key_ == key) {
+                // 查找成功，序列号不小于当前值时原子地替换，序列号更大的并发写入者先替换时放弃
+                const char *old_val_data = next->val_data_.load(std::memory_order_acquire);
+                while(Node::Sequence(old_val_data) <= sequence
+                    && !next->val_data_.compare_exchange_weak(old_val_data, val_data, std::memory_order_acq_rel)) { }
+                return ;
             }
-            res_node->val() = val;
-        }
-        else {
-            // 未查找成功，插入新结点
-            auto new_node = new Node(key, val);
-            InsertSuccNode(new_node, res_node);
-            int height = GrowUpVertically(new_node, probability_);
-            UpdateHeight(height);
-            new_node = new_node->above_;
-            for (int i = 1; i < height; ++i) {
-                InsertNodeHorizonally(new_node, headers_[i]);
-                new_node = new_node->above_;
+
+            int height = RandomHeight();
+            int max_height = max_height_.load(std::memory_order_relaxed);
+            while(height > max_height
+                && !max_height_.compare_exchange_weak(max_height, height, std::memory_order_relaxed)) { }
+
+            // 先链入底层链表，底层链入成功即视为插入成功
+            Node *new_node = NewNode(key, val_data, height);
+            new_node->next_[0].store(next, std::memory_order_relaxed);
+            if(!prev[0]->next_[0].compare_exchange_strong(next, new_node, std::memory_order_release)) {
+                // 其他线程在同一位置插入了结点，重新查找（未链入的结点留在Arena中）
+                continue;
             }
             ++ size_;
-        }
-    }
-    bool SkipList::Del(uint64_t key) {
-        bool is_found;
-        Node *res_node = GetNode(key, &is_found);
-        if(!is_found) {
-            return false;
-        }
 
-        // 移动到最底层
-        while(res_node->below_) {
-            res_node = res_node->below_;
-        }
-        // 向上逐层删除结点
-        Node *deleted_node;
-        while(res_node) {
-            if(res_node->prev_) {
-                res_node->prev_->succ_ = res_node->succ_;
-            }
-            if(res_node->succ_) {
-                res_node->succ_->prev_ = res_node->prev_;
+            // 逐层向上链入，CAS失败时从原前驱向后重新定位
+            for(int level = 1; level < height; ++level) {
+                while(true) {
+                    Node *succ = prev[level]->Next(level);
+                    while(succ && succ->key_ < key) {
+                        prev[level] = succ;
+                        succ = succ->Next(level);
+                    }
+                    new_node->next_[level].store(succ, std::memory_order_relaxed);
+                    if(prev[level]->next_[level].compare_exchange_strong(succ, new_node, std::memory_order_release)) {
+                        break;
+                    }
+                }
             }
-            deleted_node = res_node;
-            res_node = res_node->above_;
-            delete deleted_node;
+            return ;
         }
-        -- size_;
-        return true;
     }
     
     void SkipList::Scan(uint64_t key1, uint64_t key2, std::list<std::pair<uint64_t, std::string>> &list) const
@@ -72,197 +72,99 @@ namespace skip_list {
         assert(key1 <= key2);
         list.clear();
 
-        bool is_found;
-        Node *node1 = GetNode(key1, &is_found);
-        if(is_found) {
-            // 移动到最底层
-            while(node1->below_) {
-                node1 = node1->below_;
-            }
-        }
-        else {
-            node1 = node1->succ_;
-        }
         // 扫描链表，将键值对加入返回列表中
-        Node *cur_node = node1;
+        Node *cur_node = FindGreaterOrEqual(key1, nullptr);
         while(cur_node && cur_node->key_ <= key2) {
             list.emplace_back(cur_node->key_, cur_node->val());
-            cur_node = cur_node->succ_;
+            cur_node = cur_node->Next(0);
         }
     }
     
-    void SkipList::Reset()
+    SkipList::Iterator SkipList::Seek(uint64_t key) const
     {
-        this->Clear();
-        headers_.push_back(new Node);
+        return Iterator(FindGreaterOrEqual(key, nullptr));
     }
-    SkipList::Node* SkipList::GetNode(uint64_t key, bool* is_found) const
+
+    void SkipList::Reset()
     {
-        assert(!headers_.empty()) ;
+        // 所有结点与值一次性释放
+        arena_.Reset();
+        head_ = NewNode(0, nullptr, kMaxHeight);
+        max_height_ = 1;
+        size_ = 0;
+    }
 
-        Node* cur_node = headers_.back();
+    SkipList::Node *SkipList::FindGreaterOrEqual(uint64_t key, Node **prev) const
+    {
+        Node *cur_node = head_;
+        int level = max_height_.load(std::memory_order_relaxed) - 1;
         while(true) {
-            if(cur_node->is_header_ || cur_node->key_ < key) {
-                if(!cur_node->succ_ || cur_node->succ_->key_ > key) {
-                    if(!cur_node->below_) {
-                        // 已经到达最底层，查找失败
-                        is_found && (*is_found = false);
-                        break;
-                    }
-                    else {
-                        cur_node = cur_node->below_;
-                    }
-                }
-                else {
-                    cur_node = cur_node->succ_;
-                }
+            Node *next = cur_node->Next(level);
+            if(next && next->key_ < key) {
+                // 在当前层继续前进
+                cur_node = next;
+                continue;
             }
-            else if(cur_node->key_ == key) {
-                // 查找成功
-                is_found && (*is_found = true);
-                break;
+            if(prev) {
+                prev[level] = cur_node;
             }
-        }
-        return cur_node;
-    }
-    
-    void SkipList::Clear() {
-        // 逐层删除链表
-        for(auto header: headers_) {
-            Node* cur = header;
-            Node* succ;
-            while(cur) {
-                succ = cur->succ_;
-                delete cur;
-                cur = succ;
+            if(level == 0) {
+                return next;
             }
+            -- level;
         }
-        headers_.clear();
-        this->size_ = 0;
-    }
-    std::string SkipList::Get(uint64_t key) const {
-        bool is_found;
-        Node *res_node = GetNode(key, &is_found);
-        if(is_found) {
-            return res_node->val();
-        } else {
-            return "";
-        }
-    }
-
-    SkipList::~SkipList() {
-        this->Clear();
-    }
-
-    int SkipList::size() const {
-        return size_;
     }
 
-    SkipList::Node *SkipList::header() const {
-        assert(!headers_.empty());
-        return headers_[0];
-    }
-
-    void SkipList::InsertSuccNode(SkipList::Node *inserted, SkipList::Node *prev) {
-        assert(inserted && prev);
-        inserted->prev_ = prev;
-        inserted->succ_ = prev->succ_;
-        prev->succ_ = inserted;
-        if(inserted->succ_) {
-            inserted->succ_->prev_ = inserted;
-        }
-    }
-
-    int SkipList::GrowUpVertically(SkipList::Node *base_node, double growth_probability) {
-        Node *cur_node = base_node;
+    int SkipList::RandomHeight() const
+    {
+        // 全局rand()不是线程安全的，每个线程使用独立的随机数生成器
+        thread_local std::mt19937 generator(std::random_device{}());
+        std::uniform_real_distribution<double> distribution(0.0, 1.0);
         int height = 1;
-        while (utils::random() < growth_probability) {
-            // 浅拷贝base_node.val_ptr
-            cur_node->above_ = new Node(base_node->key_, base_node->val_ptr_, nullptr, nullptr, nullptr, cur_node);
-            cur_node = cur_node->above_;
+        while(height < kMaxHeight && distribution(generator) < probability_) {
             ++ height;
         }
         return height;
     }
 
-    bool SkipList::UpdateHeight(int height) {
-        if(headers_.size() >= height) {
-            return false;
+    SkipList::Node *SkipList::NewNode(uint64_t key, const char *val_data, int height)
+    {
+        char *memory = arena_.Allocate(
+            sizeof(Node) + sizeof(std::atomic<Node*>) * (height - 1), alignof(Node));
+        Node *node = new (memory) Node(key, val_data);
+        for(int level = 0; level < height; ++level) {
+            new (&node->next_[level]) std::atomic<Node*>(nullptr);
         }
+        return node;
+    }
 
-        int count = height - headers_.size();
-        while (count != 0) {
-            // m_headers剩余位置补齐头节点
-            auto new_header_node = new Node;
-            new_header_node->below_ = headers_.back();
-            headers_.back()->above_ = new_header_node;
-
-            headers_.push_back(new_header_node);
-            --count;
-        }
-        return true;
+    const char *SkipList::CopyValue(const std::string &val, uint64_t sequence)
+    {
+        uint32_t size = val.size();
+        char *val_data = arena_.Allocate(sizeof(uint64_t) + sizeof(uint32_t) + size);
+        memcpy(val_data, &sequence, sizeof(uint64_t));
+        memcpy(val_data + sizeof(uint64_t), &size, sizeof(uint32_t));
+        memcpy(val_data + sizeof(uint64_t) + sizeof(uint32_t), val.data(), size);
+        return val_data;
     }
 
-    void SkipList::InsertNodeHorizonally(SkipList::Node *inserted, SkipList::Node *header) {
-        assert(inserted && header);
-        Node *cur_node = header;
-        while (true) {
-            if (cur_node->is_header_ || cur_node->key_ < inserted->key_) {
-                if (!cur_node->succ_ || cur_node->succ_->key_ > inserted->key_) {
-                    InsertSuccNode(inserted, cur_node);
-                    break;
-                }
-            }
-            cur_node = cur_node->succ_;
+    std::string SkipList::Get(uint64_t key) const {
+        Node *res_node = FindGreaterOrEqual(key, nullptr);
+        if(res_node && res_node->key_ == key) {
+            return std::string(res_node->val());
+        } else {
+            return "";
         }
     }
 
+    SkipList::~SkipList() = default;
 
+    int SkipList::size() const {
+        return size_;
+    }
 
-    SkipList::Node::Node(const uint64_t& arg_key,
-                         const std::string& arg_val,
-                         SkipList::Node *arg_prev,
-                         SkipList::Node *arg_succ,
-                         SkipList::Node *arg_above,
-                         SkipList::Node *arg_below)
-            : key_(arg_key),
-              val_ptr_(new std::string(arg_val)),
-              prev_(arg_prev),
-              succ_(arg_succ),
-              above_(arg_above),
-              below_(arg_below),
-              is_header_(false),
-              is_owner_(true) { }
-
-    SkipList::Node::Node(const uint64_t &arg_key,
-                         std::string *arg_val_ptr,
-                         SkipList::Node *arg_prev,
-                         SkipList::Node *arg_succ,
-                         SkipList::Node *arg_above,
-                         SkipList::Node *arg_below)
-            : key_(arg_key),
-              val_ptr_(arg_val_ptr),
-              prev_(arg_prev),
-              succ_(arg_succ),
-              above_(arg_above),
-              below_(arg_below) ,
-              is_header_(false),
-              is_owner_(false) { }
-
-    SkipList::Node::Node() :
-            key_(0),
-            val_ptr_(nullptr),
-            prev_(nullptr),
-            succ_(nullptr),
-            above_(nullptr),
-            below_(nullptr),
-            is_header_(true),
-            is_owner_(false) { }
-
-    SkipList::Node::~Node() {
-        if(is_owner_) {
-            delete val_ptr_;
-        }
+    size_t SkipList::memory_usage() const {
+        return arena_.memory_usage();
     }
 
 } // namespace skip_list
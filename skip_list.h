@@ -10,7 +10,11 @@
 #include <string>
 #include <cstdlib>
 #include <list>
+#include <atomic>
+#include <string_view>
+#include <cstring>
 #include <cassert>
+#include "arena.h"
 
 namespace ss_table {
     struct Header;
@@ -20,136 +24,143 @@ namespace v_log {
     class VLog;
 }
 namespace skip_list {
+    /**
+     * @brief 支持多线程并发写入的跳表内存表
+     * @details 每个键只对应一个结点，结点末尾内联保存与其高度等长的后继指针数组。
+     * 结点与值均分配在跳表独占的Arena中，跳表析构或Reset时一次性释放。
+     * 插入通过CAS修改后继指针，不加锁；读取只沿后继指针前进，不会等待写入。
+     * 覆盖已有的键时将新值写入Arena并原子地替换值指针，旧值不会被释放，因此读取者拿到的值始终有效。
+     * 每个值带有写入者分配的序列号，同一个键保留序列号最大的值，与并发写入者实际插入的先后无关。
+     * 结点在跳表存活期间不会被删除。
+     */
     class SkipList
     {
     public:
         class Node;
         class Iterator;
+
+        static const int kMaxHeight = 12;
     public:
+        /**
+         * @param p 结点向上生长一层的概率
+         */
         explicit SkipList(double p = 0.5);
         ~SkipList();
 
         std::string Get(uint64_t key) const;
-        void Put(uint64_t key, const std::string &val);
-        bool Del(uint64_t key);
+
+        /**
+         * @brief 插入或覆盖键值对，可以与其他Put、Get、迭代并发执行
+         * @details 键已存在且其值的序列号大于sequence时不覆盖；序列号相同时后写入的值生效，
+         * 因此同一批次中的多条记录可以共用一个序列号
+         *
+         * @param sequence 值的序列号，如预写日志中记录的顺序
+         */
+        void Put(uint64_t key, const std::string &val, uint64_t sequence);
         void Scan(uint64_t key1, uint64_t key2, std::list<std::pair<uint64_t, std::string>> &list) const;
-        void Reset();
 
         /**
-         * 底层链表头节点指针
-         * @return
+         * @brief 清空跳表，调用者须保证没有并发访问
          */
-        Node *header() const;
+        void Reset();
+
         Iterator begin() const {
-            return Iterator(headers_[0]->succ_);
+            return Iterator(head_->Next(0));
         }
         Iterator end() const {
             return Iterator(nullptr);
         }
 
-
-        int size() const;
-    
-    private:
-
         /**
-         * @brief 查找结点
+         * @brief 定位到底层链表中第一个键不小于key的结点
          * @param key 查找的键
-         * @param is_found 是否查找成功
-         * @return 在跳表中查找key，若查找成功，返回查找过程中第一个键为key的结点指针，
-         * 若查找失败，返回底层链表中键值最大且小于key的结点指针（如果不存在这样的结点，则返回底层链表头结点）。
-         * 如果is_found不为空，通过is_found返回是否查找成功。
+         * @return 指向该结点的迭代器，不存在时返回end()
          */
-        Node *GetNode(uint64_t key, bool* is_found) const;
+        Iterator Seek(uint64_t key) const;
+
+
+        int size() const;
 
         /**
-         * @brief 将结点插入水平链表
-         * @param inserted 被插入结点
-         * @param header 被插入链表的头结点
+         * @brief 跳表占用的内存字节数（Arena向系统申请的字节数）
          */
-        static void InsertNodeHorizonally(Node *inserted, Node* header);
-
+        size_t memory_usage() const;
+    
+    private:
         /**
-         * @brief 将结点作为后继插入
-         * @details 将结点inserted插入结点prev和prev的后继结点之间。
-         * @param inserted 被插入结点
-         * @param prev 被插入结点前驱
+         * @brief 在Arena中创建高度为height的结点
          */
-        static void InsertSuccNode(Node *inserted, Node *prev);
+        Node *NewNode(uint64_t key, const char *val_data, int height);
 
         /**
-         * @brief 依概率垂直向上生长
-         * @param base_node 生长的基结点
-         * @param growth_probability 生长概率
-         * @return 基结点到顶部结点的路径高度
+         * @brief 将值复制到Arena中，格式为[uint64_t 序列号][uint32_t 长度][值]
          */
-        static int GrowUpVertically(Node *base_node, double growth_probability);
+        const char *CopyValue(const std::string &val, uint64_t sequence);
 
         /**
-         * @brief 更新跳表的高度
-         * @param height 更新后的跳表高度
-         * @return 是否更新了高度
+         * @brief 查找键不小于key的第一个结点，并记录每一层中位于其之前的结点
+         * @param key 查找的键
+         * @param prev 非空时返回每一层中键小于key的最后一个结点
+         * @return 底层链表中第一个键不小于key的结点，不存在时返回nullptr
          */
-        bool UpdateHeight(int height);
-        
+        Node *FindGreaterOrEqual(uint64_t key, Node **prev) const;
+
         /**
-         * @brief 清空跳表
-         * @details 清空跳表，回收所有动态内存，并清空m_headers.
+         * @brief 随机生成新结点的高度（线程安全）
          */
-        void Clear();
+        int RandomHeight() const;
 
 
     public:
         class Node {
             friend class SkipList;
         public:
-            Node() ;
-            explicit Node(const uint64_t& key, const std::string& val, Node* prev= nullptr, Node* succ= nullptr, Node* above= nullptr, Node* below= nullptr);
-            Node(const uint64_t& key, std::string* val_ptr, Node* prev= nullptr, Node* succ= nullptr, Node* above= nullptr, Node* below= nullptr);
-            ~Node();
             uint64_t key() const { return key_; }
-            std::string& val() const {return *val_ptr_;}
-            Node *prev() const { return prev_; }
-            Node *succ() const { return succ_; }
-            Node *above() const { return above_; }
-            Node *below() const { return below_; }
-            bool is_header() const { return is_header_; }
-            bool is_owner() const { return is_owner_; }
+            std::string_view val() const {
+                const char *val_data = val_data_.load(std::memory_order_acquire);
+                uint32_t size;
+                memcpy(&size, val_data + sizeof(uint64_t), sizeof(uint32_t));
+                return std::string_view(val_data + sizeof(uint64_t) + sizeof(uint32_t), size);
+            }
+            Node *succ() const { return Next(0); }
 
         private:
+            Node(uint64_t key, const char *val_data): key_(key), val_data_(val_data) {}
+
+            static uint64_t Sequence(const char *val_data) {
+                uint64_t sequence;
+                memcpy(&sequence, val_data, sizeof(uint64_t));
+                return sequence;
+            }
+
+            Node *Next(int level) const {
+                return next_[level].load(std::memory_order_acquire);
+            }
+
             uint64_t key_;
-            std::string* val_ptr_;
-            Node* prev_;
-            Node* succ_;
-            Node* above_;
-            Node* below_;
-            bool is_header_; // 是否为链表头节点
-            bool is_owner_; // val_ptr的动态内存是否归属于该节点
+            std::atomic<const char*> val_data_;
+            std::atomic<Node*> next_[1]; // 实际长度为结点高度，在Arena中紧随结点分配
         };
         class Iterator {
         public:
             explicit Iterator(Node *cur_node): cur_node_(cur_node) {}
             Iterator& operator++() {
                 assert(cur_node_);
-                cur_node_ = cur_node_->succ_;
+                cur_node_ = cur_node_->succ();
                 return *this;
             }
-            Iterator Previous() const {
-                assert(cur_node_);
-                return Iterator(cur_node_->prev_);
-            }
             Iterator Next() const {
                 assert(cur_node_);
-                return Iterator(cur_node_->succ_);
+                return Iterator(cur_node_->succ());
             }
             Node &operator*() const {
                 assert(cur_node_);
                 return *cur_node_;
             }
-            bool operator==(const Iterator& other) {
+            bool operator==(const Iterator& other) const {
                 return cur_node_ == other.cur_node_;
             }
-            bool operator!=(const Iterator& other) {
+            bool operator!=(const Iterator& other) const {
                 return cur_node_ != other.cur_node_;
             }
 
@@ -158,9 +169,11 @@ namespace skip_list {
         };
 
     private:
-        std::vector<Node*> headers_;
+        arena::Arena arena_;
+        Node *head_;
         double probability_;
-        int size_;
+        std::atomic<int> max_height_;
+        std::atomic<int> size_;
     };
 
 } // namespace skip_list
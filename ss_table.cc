@@ -11,9 +11,9 @@
 #include <fstream>
 #include <limits>
 #include <vector>
-#include <queue>
+#include <algorithm>
+#include <cassert>
 
-#include <chrono>
 namespace ss_table {
     SSTable::~SSTable() {
         delete bloom_filter_;
@@ -28,7 +28,13 @@ namespace ss_table {
 
         for(const auto& tuple: key_offset_vlen_tuple_list_) {
             // tuple结构体末尾存在padding, sizeof(KeyOffsetVlenTuple) == 24，此处写入20字节即可
-            fout.write(reinterpret_cast<const char*> (&tuple), 20);
+            fout.write(reinterpret_cast<const char*> (&tuple), kTupleEncodedSize);
+        }
+        if(!inline_values_.empty()) {
+            uint64_t inline_value_size = inline_values_.size();
+            fout.write(inline_values_.data(), inline_values_.size());
+            fout.write(reinterpret_cast<const char*>(&inline_value_size), sizeof(inline_value_size));
+            fout.write(reinterpret_cast<const char*>(&kInlineValueMagic), sizeof(kInlineValueMagic));
         }
         fout.close();
     }
@@ -42,10 +48,23 @@ namespace ss_table {
 
     std::optional<SSTableGetResult> SSTable::Get(uint64_t key) const
     {
-        if(key > header_.max_key || key < header_.min_key) {
+        if(!KeyMayMatch(key)) {
             return std::nullopt;
         }
-        if(!bloom_filter_->Search(key)) {
+        return Search(key);
+    }
+
+    bool SSTable::KeyMayMatch(uint64_t key) const
+    {
+        if(key > header_.max_key || key < header_.min_key) {
+            return false;
+        }
+        return bloom_filter_->Search(key);
+    }
+
+    std::optional<SSTableGetResult> SSTable::Search(uint64_t key) const
+    {
+        if(key > header_.max_key || key < header_.min_key) {
             return std::nullopt;
         }
 
@@ -57,6 +76,9 @@ namespace ss_table {
             if(key == key_offset_vlen_tuple_list_[mid].key) {
                 result.offset = key_offset_vlen_tuple_list_[mid].offset;
                 result.vlen = key_offset_vlen_tuple_list_[mid].vlen;
+                if(IsInlineValue(result.vlen)) {
+                    result.inline_value = InlineValue(key_offset_vlen_tuple_list_[mid]);
+                }
                 return result;
             } else if(key < key_offset_vlen_tuple_list_[mid].key) {
                 rh = mid - 1;
@@ -77,47 +99,26 @@ namespace ss_table {
     const std::string &SSTable::file_name() const {
         return file_name_;
     }
+    std::string_view SSTable::InlineValue(const KeyOffsetVlenTuple &tuple) const {
+        return std::string_view(inline_values_).substr(tuple.offset, ValueLength(tuple.vlen));
+    }
 
-
-    std::vector<TimeStampedKeyOffsetVlenTuple> SSTable::MergeSSTables(
-        const std::vector<std::shared_ptr<SSTable>> &ss_table_list
-    ) {
-        auto cmp = [](const TimeStampedKeyOffsetVlenTuple &a, const TimeStampedKeyOffsetVlenTuple &b) {
-        return a.key_offset_vlen_tuple.key > b.key_offset_vlen_tuple.key 
-               || (a.key_offset_vlen_tuple.key == b.key_offset_vlen_tuple.key && a.time_stamp > b.time_stamp)
-               || (a.key_offset_vlen_tuple.key == b.key_offset_vlen_tuple.key && a.time_stamp == b.time_stamp && a.ss_table_index < b.ss_table_index);
-        };
-        std::priority_queue<
-            TimeStampedKeyOffsetVlenTuple,
-            std::vector<TimeStampedKeyOffsetVlenTuple>,
-            decltype(cmp)
-        > pq(cmp);
-
-        size_t ss_table_index = 0;
-        for (const auto &ss_table : ss_table_list) {
-            for (const auto &tuple : ss_table->key_offset_vlen_tuple_list()) {
-                pq.emplace(ss_table->header().time_stamp, tuple, ss_table_index);
-            }
-            ++ ss_table_index;
-        }
-
-        std::vector<TimeStampedKeyOffsetVlenTuple> merged_results;
-        while (!pq.empty()) {
-            auto current = pq.top();
-            pq.pop();
-
-            // 取出key相同的元组中，优先级最低的元组
-            while (!pq.empty() && pq.top().key_offset_vlen_tuple.key == current.key_offset_vlen_tuple.key) {
-                current = pq.top();
-                pq.pop();
-            }
-
-            merged_results.push_back(current);
+    size_t SSTable::ApproximateMemoryUsage() const {
+        size_t usage = sizeof(SSTable) + file_name_.capacity()
+            + key_offset_vlen_tuple_list_.capacity() * sizeof(KeyOffsetVlenTuple) + inline_values_.capacity();
+        if(bloom_filter_) {
+            usage += sizeof(bloom_filter::BloomFilter) + bloom_filter_->memory_usage();
         }
+        return usage;
+    }
 
-        return merged_results;
+    size_t SSTable::file_size() const {
+        return sizeof(Header) + (bloom_filter_ ? bloom_filter_->encoded_size() : 0)
+            + key_offset_vlen_tuple_list_.size() * kTupleEncodedSize
+            + (inline_values_.empty() ? 0 : inline_values_.size() + kInlineValueFooterSize);
     }
 
+
     Header SSTable::ReadSSTableHeaderDirectly(const std::string &ss_table_file_name) {
         std::ifstream fin;
         fin.open(ss_table_file_name);
@@ -145,9 +146,120 @@ namespace ss_table {
         return dir + "/level-" + std::to_string(level);
     }
 
-    std::string SSTable::BuildUniqueSSTableFileName(const std::string &dir, int level) {
-        return dir + "/level-" + std::to_string(level) + "/" + std::to_string(std::chrono::system_clock::now().time_since_epoch().count()) + ".sst";
+    std::string SSTable::ExtractBaseFileName(const std::string &file_name) {
+        return file_name.substr(file_name.find_last_of('/') + 1);
+    }
+
+    MergingIterator::MergingIterator(
+        const std::vector<std::shared_ptr<SSTable>> &ss_table_list,
+        const std::vector<int> &ss_table_levels
+    )
+        : ss_table_list_(ss_table_list),
+          ss_table_levels_(ss_table_levels)
+    {
+        ss_table_levels_.resize(ss_table_list_.size(), 0);
+        heap_.reserve(ss_table_list_.size());
+        Seek(std::numeric_limits<uint64_t>::min());
+    }
+
+    void MergingIterator::Seek(uint64_t key)
+    {
+        heap_.clear();
+        for(size_t i = 0; i < ss_table_list_.size(); ++i) {
+            const auto &tuple_list = ss_table_list_[i]->key_offset_vlen_tuple_list();
+            auto it = std::lower_bound(tuple_list.begin(), tuple_list.end(), key,
+                [](const KeyOffsetVlenTuple &tuple, uint64_t key) {
+                    return tuple.key < key;
+                }
+            );
+            if(it != tuple_list.end()) {
+                PushCursor({i, static_cast<size_t>(it - tuple_list.begin())});
+            }
+        }
+    }
+
+    bool MergingIterator::Valid() const
+    {
+        return !heap_.empty();
+    }
+
+    void MergingIterator::Next()
+    {
+        assert(Valid());
+        uint64_t key = TupleAt(heap_.front()).key;
+        // 弹出所有键为key的游标，并前移到下一个元组
+        while(!heap_.empty() && TupleAt(heap_.front()).key == key) {
+            Cursor cursor = PopCursor();
+            if(++ cursor.position < ss_table_list_[cursor.ss_table_index]->key_offset_vlen_tuple_list().size()) {
+                PushCursor(cursor);
+            }
+        }
+    }
+
+    TimeStampedKeyOffsetVlenTuple MergingIterator::current() const
+    {
+        assert(Valid());
+        const Cursor &top = heap_.front();
+        return {ss_table_list_[top.ss_table_index]->header().time_stamp, TupleAt(top), static_cast<int>(top.ss_table_index)};
+    }
+
+    const KeyOffsetVlenTuple &MergingIterator::current_tuple() const
+    {
+        assert(Valid());
+        return TupleAt(heap_.front());
     }
 
+    int MergingIterator::current_level() const
+    {
+        assert(Valid());
+        return ss_table_levels_[heap_.front().ss_table_index];
+    }
 
+    std::string_view MergingIterator::current_inline_value() const
+    {
+        assert(Valid());
+        const Cursor &top = heap_.front();
+        return ss_table_list_[top.ss_table_index]->InlineValue(TupleAt(top));
+    }
+
+    const KeyOffsetVlenTuple &MergingIterator::TupleAt(const Cursor &cursor) const
+    {
+        return ss_table_list_[cursor.ss_table_index]->key_offset_vlen_tuple_list()[cursor.position];
+    }
+
+    bool MergingIterator::CursorGreater(const Cursor &a, const Cursor &b) const
+    {
+        // 堆顶为键最小、层数最小、时间戳最大、索引最小的游标
+        uint64_t a_key = TupleAt(a).key, b_key = TupleAt(b).key;
+        if(a_key != b_key) {
+            return a_key > b_key;
+        }
+        if(ss_table_levels_[a.ss_table_index] != ss_table_levels_[b.ss_table_index]) {
+            return ss_table_levels_[a.ss_table_index] > ss_table_levels_[b.ss_table_index];
+        }
+        uint64_t a_time_stamp = ss_table_list_[a.ss_table_index]->header().time_stamp,
+                 b_time_stamp = ss_table_list_[b.ss_table_index]->header().time_stamp;
+        if(a_time_stamp != b_time_stamp) {
+            return a_time_stamp < b_time_stamp;
+        }
+        return a.ss_table_index > b.ss_table_index;
+    }
+
+    void MergingIterator::PushCursor(const Cursor &cursor)
+    {
+        heap_.push_back(cursor);
+        std::push_heap(heap_.begin(), heap_.end(), [this](const Cursor &a, const Cursor &b) {
+            return CursorGreater(a, b);
+        });
+    }
+
+    MergingIterator::Cursor MergingIterator::PopCursor()
+    {
+        std::pop_heap(heap_.begin(), heap_.end(), [this](const Cursor &a, const Cursor &b) {
+            return CursorGreater(a, b);
+        });
+        Cursor cursor = heap_.back();
+        heap_.pop_back();
+        return cursor;
+    }
 }
@@ -5,6 +5,7 @@
 #ifndef LSMKV_HANDOUT_SS_TABLE_H
 #define LSMKV_HANDOUT_SS_TABLE_H
 #include <string>
+#include <string_view>
 #include <vector>
 #include <optional>
 #include <memory>
@@ -21,10 +22,33 @@ namespace bloom_filter
 
 namespace ss_table
 {
+    // 元组在文件中占20字节，不包含结构体末尾的padding
+    static const size_t kTupleEncodedSize = 20;
+
+    // vlen的最高位为1时，值内联存储在SSTable的内联值块中，offset为值在块中的偏移量
+    static const uint32_t kInlineValueFlag = 1u << 31;
+    // 存在内联值时，文件末尾依次为内联值块、8字节块长度与4字节魔数"INL1"；没有内联值的文件与旧格式相同
+    static const uint32_t kInlineValueMagic = 0x314c4e49;
+    static const size_t kInlineValueFooterSize = sizeof(uint64_t) + sizeof(uint32_t);
+
+    inline bool IsInlineValue(uint32_t vlen)
+    {
+        return vlen & kInlineValueFlag;
+    }
+
+    /**
+     * @brief 去掉内联标志后的值长度
+     */
+    inline uint32_t ValueLength(uint32_t vlen)
+    {
+        return vlen & ~kInlineValueFlag;
+    }
+
     struct SSTableGetResult
     {
         uint64_t offset;
         uint32_t vlen;
+        std::string inline_value; // vlen带有kInlineValueFlag时为内联存储的值
     };
     struct Header
     {
@@ -66,7 +90,7 @@ namespace ss_table
     };
     struct SSTableMetaData {
         Header header;
-        std::string ss_table_file_name;
+        std::string ss_table_file_name; // 完整路径，如"data/level-0/1.sst"
     };
     class SSTable
     {
@@ -95,6 +119,21 @@ namespace ss_table
         const std::vector<KeyOffsetVlenTuple> &key_offset_vlen_tuple_list() const;
         const std::string &file_name() const;
 
+        /**
+         * @brief 内联存储的值，调用者须保证IsInlineValue(tuple.vlen)
+         */
+        std::string_view InlineValue(const KeyOffsetVlenTuple &tuple) const;
+
+        /**
+         * @brief SSTable在内存中占用的字节数（估计值），用于缓存计费
+         */
+        size_t ApproximateMemoryUsage() const;
+
+        /**
+         * @brief 按当前格式编码后的文件字节数
+         */
+        size_t file_size() const;
+
         /**
          * @brief 生成SSTable文件名
          * 
@@ -116,13 +155,12 @@ namespace ss_table
 
 
         /**
-         * @brief 生成唯一的SSTable文件名(基于UNIX时间戳)
+         * @brief 从完整路径中提取不包含路径的文件名
          * 
-         * @param dir 基准路径
-         * @param level 层数
-         * @return std::string 如"data/level-0/17000000.sst"
+         * @param file_name 完整路径，如"data/level-0/1.sst"
+         * @return std::string 如"1.sst"
          */
-        static std::string BuildUniqueSSTableFileName(const std::string &dir, int level);
+        static std::string ExtractBaseFileName(const std::string &file_name);
 
 
         /**
@@ -131,16 +169,25 @@ namespace ss_table
         void WriteToFile() const;
 
         /**
-         * @brief 在SSTable中查找键
+         * @brief 在SSTable中查找键，相当于KeyMayMatch后再Search
          *
          * @param key 查找的键
          * @return std::optional<SSTableGetResult> 查找结果，当查找成功时返回查找结果，否则返回std::nullopt
          */
         std::optional<SSTableGetResult> Get(uint64_t key) const;
 
+        /**
+         * @brief 根据键范围与Bloom过滤器判断键是否可能存在
+         * @return false 键一定不存在
+         */
+        bool KeyMayMatch(uint64_t key) const;
+
+        /**
+         * @brief 只在元组列表中二分查找键，不查询Bloom过滤器
+         */
+        std::optional<SSTableGetResult> Search(uint64_t key) const;
+
 
-        static std::vector<TimeStampedKeyOffsetVlenTuple> MergeSSTables(const std::vector<std::shared_ptr<SSTable>> &ss_table_list);
-        
         /**
          * @brief 直接读取SSTable文件的Header部分
          * 
@@ -161,8 +208,77 @@ namespace ss_table
         Header header_;
         bloom_filter::BloomFilter *bloom_filter_ = nullptr;
         std::vector<KeyOffsetVlenTuple> key_offset_vlen_tuple_list_;
+        std::string inline_values_; // 内联值块
         std::string file_name_;
     };
+
+    /**
+     * @brief 多个SSTable的k路归并迭代器
+     * @details 堆中只保存每个SSTable的游标，按键升序逐个产出元组；
+     * 键相同时只产出层数最小的元组，层数相同时产出时间戳最大的元组（时间戳相同时取ss_table_list中靠前的SSTable）。
+     * 上层的记录总是比下层新，而合并产生的SSTable时间戳为其中记录的最大时间戳，不能跨层比较。
+     * 迭代期间ss_table_list中的SSTable须保持存活。
+     */
+    class MergingIterator
+    {
+    public:
+        /**
+         * @param ss_table_list 参与归并的SSTable
+         * @param ss_table_levels 每个SSTable所在的层数，为空时视为同一层
+         */
+        explicit MergingIterator(
+            const std::vector<std::shared_ptr<SSTable>> &ss_table_list,
+            const std::vector<int> &ss_table_levels = {}
+        );
+
+        /**
+         * @brief 定位到第一个键不小于key的元组
+         */
+        void Seek(uint64_t key);
+
+        bool Valid() const;
+
+        /**
+         * @brief 移动到下一个不同的键
+         */
+        void Next();
+
+        /**
+         * @brief 当前元组，ss_table_index为其所在SSTable在ss_table_list中的索引
+         */
+        TimeStampedKeyOffsetVlenTuple current() const;
+
+        /**
+         * @brief 当前元组，不复制
+         */
+        const KeyOffsetVlenTuple &current_tuple() const;
+
+        /**
+         * @brief 当前元组所在的层数
+         */
+        int current_level() const;
+
+        /**
+         * @brief 当前元组内联存储的值，调用者须保证IsInlineValue(current().key_offset_vlen_tuple.vlen)
+         */
+        std::string_view current_inline_value() const;
+
+    private:
+        struct Cursor
+        {
+            size_t ss_table_index;
+            size_t position;
+        };
+
+        const KeyOffsetVlenTuple &TupleAt(const Cursor &cursor) const;
+        bool CursorGreater(const Cursor &a, const Cursor &b) const;
+        void PushCursor(const Cursor &cursor);
+        Cursor PopCursor();
+
+        std::vector<std::shared_ptr<SSTable>> ss_table_list_;
+        std::vector<int> ss_table_levels_;
+        std::vector<Cursor> heap_;
+    };
 }
 
 #endif // LSMKV_HANDOUT_SS_TABLE_H
@@ -3,46 +3,112 @@
 #include "bloom_filter.h"
 #include "inc.h"
 #include "utils.h"
+#include "perf_context.h"
 
 #include <limits>
+#include <algorithm>
+#include <cassert>
+#include <cstring>
 
 namespace ss_table {
+    SSTableManager::SSTableManager(size_t cache_capacity, int bloom_filter_bits_per_key)
+        : bloom_filter_bits_per_key_(bloom_filter_bits_per_key), cache_capacity_(cache_capacity) { }
+
     std::shared_ptr<SSTable> SSTableManager::FromFile(const std::string &file_name)
     {
-        if(ss_table_read_cache_.find(file_name) != ss_table_read_cache_.end()) {
-            // LOG_INFO("Cache hit for SSTable file `%s`", file_name.c_str());
-            return ss_table_read_cache_[file_name];
+        {
+            std::lock_guard<std::mutex> lock(cache_mutex_);
+            auto it = cache_index_.find(file_name);
+            if(it != cache_index_.end()) {
+                // LOG_INFO("Cache hit for SSTable file `%s`", file_name.c_str());
+                ++ hits_;
+                PERF_COUNTER_ADD(ss_table_cache_hit_count, 1);
+                lru_list_.splice(lru_list_.begin(), lru_list_, it->second);
+                return it->second->ss_table;
+            }
         }
+        ++ misses_;
+        PERF_COUNTER_ADD(ss_table_cache_miss_count, 1);
+        PERF_TIMER_GUARD(ss_table_load_nanos);
 
+        // 一次读入整个文件，再从缓冲区中解析各部分
         std::ifstream fin;
-        fin.open(file_name);
+        fin.open(file_name, std::ios::binary | std::ios::ate);
         if(!fin) {
             LOG_ERROR("Read SSTable file `%s` error", file_name.c_str());
             return nullptr;
         }
+        std::string data(fin.tellg(), '\0');
+        fin.seekg(0);
+        fin.read(data.data(), data.size());
+        fin.close();
 
         std::shared_ptr<SSTable> new_ss_table = SSTable::create();
-        fin.read(reinterpret_cast<char*>(&new_ss_table.get()->header_), sizeof(Header));
-        
-        new_ss_table.get()->bloom_filter_ = new bloom_filter::BloomFilter(BLOOM_FILTER_VECTOR_SIZE);
-        new_ss_table.get()->bloom_filter_->ReadFromFile(fin);
+        if(data.size() < sizeof(Header)) {
+            LOG_ERROR("SSTable file `%s` is too short", file_name.c_str());
+            return nullptr;
+        }
+        memcpy(&new_ss_table.get()->header_, data.data(), sizeof(Header));
+
+        // 末尾为魔数时先取出内联值块
+        size_t body_size = data.size();
+        if(body_size >= sizeof(Header) + kInlineValueFooterSize) {
+            uint64_t inline_value_size;
+            uint32_t magic;
+            memcpy(&inline_value_size, data.data() + body_size - kInlineValueFooterSize, sizeof(inline_value_size));
+            memcpy(&magic, data.data() + body_size - sizeof(magic), sizeof(magic));
+            if(magic == kInlineValueMagic
+                && inline_value_size <= body_size - sizeof(Header) - kInlineValueFooterSize) {
+                body_size -= kInlineValueFooterSize + inline_value_size;
+                new_ss_table.get()->inline_values_.assign(data.data() + body_size, inline_value_size);
+            }
+        }
 
         auto key_count = new_ss_table.get()->header_.key_count;
+        if(key_count > (body_size - sizeof(Header)) / kTupleEncodedSize) {
+            LOG_ERROR("SSTable file `%s` is too short", file_name.c_str());
+            return nullptr;
+        }
+        size_t tuple_list_size = key_count * kTupleEncodedSize;
+        size_t bloom_filter_size = body_size - sizeof(Header) - tuple_list_size;
+
+        const char *cur = data.data() + sizeof(Header) + bloom_filter_size;
+        new_ss_table.get()->key_offset_vlen_tuple_list_.reserve(key_count);
         for(uint64_t i = 0;i < key_count; ++i) {
-            new_ss_table.get()->key_offset_vlen_tuple_list_.emplace_back(&fin);
+            KeyOffsetVlenTuple tuple(0, 0, 0);
+            memcpy(&tuple.key, cur, sizeof(uint64_t));
+            memcpy(&tuple.offset, cur + sizeof(uint64_t), sizeof(uint64_t));
+            memcpy(&tuple.vlen, cur + 2 * sizeof(uint64_t), sizeof(uint32_t));
+            new_ss_table.get()->key_offset_vlen_tuple_list_.push_back(tuple);
+            cur += kTupleEncodedSize;
+        }
+
+        new_ss_table.get()->bloom_filter_ = bloom_filter::BloomFilter::Decode(
+            data.data() + sizeof(Header), bloom_filter_size);
+        if(!new_ss_table.get()->bloom_filter_) {
+            // 旧格式的逐位过滤器（或损坏的过滤器），由键重新构造
+            new_ss_table.get()->bloom_filter_ = new bloom_filter::BloomFilter(key_count, bloom_filter_bits_per_key_);
+            for(const auto &tuple: new_ss_table.get()->key_offset_vlen_tuple_list_) {
+                new_ss_table.get()->bloom_filter_->Insert(tuple.key);
+            }
         }
-        fin.close();
         new_ss_table.get()->file_name_ = file_name;
 
-        ss_table_read_cache_[file_name] = new_ss_table;
+        std::lock_guard<std::mutex> lock(cache_mutex_);
+        InsertIntoCache(new_ss_table);
         return new_ss_table;
     }
     
-    std::shared_ptr<SSTable> SSTableManager::NewSSTable(const std::string &file_name, uint64_t time_stamp, const std::vector<KeyOffsetVlenTuple> &inserted_tuples)
+    std::shared_ptr<SSTable> SSTableManager::NewSSTable(
+        const std::string &file_name,
+        uint64_t time_stamp,
+        const std::vector<KeyOffsetVlenTuple> &inserted_tuples,
+        std::string inline_values
+    )
     {
         std::shared_ptr<SSTable> new_ss_table = SSTable::create();
-        new_ss_table.get()->bloom_filter_ = new bloom_filter::BloomFilter(BLOOM_FILTER_VECTOR_SIZE);
-        
+        new_ss_table.get()->bloom_filter_ = new bloom_filter::BloomFilter(inserted_tuples.size(), bloom_filter_bits_per_key_);
+
         uint64_t min_key = std::numeric_limits<uint64_t>::max(),
                  max_key = std::numeric_limits<uint64_t>::min();
         for(const auto &tuple: inserted_tuples) {
@@ -54,9 +120,11 @@ namespace ss_table {
             new_ss_table.get()->key_offset_vlen_tuple_list_.push_back(tuple);
         }
         new_ss_table.get()->header_ = {time_stamp, inserted_tuples.size(), min_key, max_key};
+        new_ss_table.get()->inline_values_ = std::move(inline_values);
         new_ss_table.get()->file_name_ = file_name;
 
-        ss_table_read_cache_[file_name] = new_ss_table;
+        std::lock_guard<std::mutex> lock(cache_mutex_);
+        InsertIntoCache(new_ss_table);
         return new_ss_table;
     }
     
@@ -68,8 +136,17 @@ namespace ss_table {
     void SSTableManager::DeleteSSTableFiles(const std::vector<std::string> &file_name_list)
     {
         // 从缓存中删除
-        for(const auto &file_name: file_name_list) {
-            ss_table_read_cache_.erase(file_name);
+        {
+            std::lock_guard<std::mutex> lock(cache_mutex_);
+            for(const auto &file_name: file_name_list) {
+                auto it = cache_index_.find(file_name);
+                if(it == cache_index_.end()) {
+                    continue;
+                }
+                cache_usage_ -= it->second->charge;
+                lru_list_.erase(it->second);
+                cache_index_.erase(it);
+            }
         }
         // 删除磁盘文件
         if(utils::rmfiles(file_name_list) < 0) {
@@ -79,6 +156,120 @@ namespace ss_table {
     
     void SSTableManager::ResetCache()
     {
-        ss_table_read_cache_.clear();
+        std::lock_guard<std::mutex> lock(cache_mutex_);
+        lru_list_.clear();
+        cache_index_.clear();
+        cache_usage_ = 0;
+    }
+
+    CacheStatistics SSTableManager::cache_statistics() const
+    {
+        std::lock_guard<std::mutex> lock(cache_mutex_);
+        return {hits_, misses_, evictions_, cache_usage_, cache_capacity_};
+    }
+
+    void SSTableManager::InsertIntoCache(const std::shared_ptr<SSTable> &ss_table)
+    {
+        auto it = cache_index_.find(ss_table->file_name());
+        if(it != cache_index_.end()) {
+            // 并发读取同一文件时，后读取的替换先读取的
+            cache_usage_ -= it->second->charge;
+            lru_list_.erase(it->second);
+            cache_index_.erase(it);
+        }
+        size_t charge = ss_table->ApproximateMemoryUsage();
+        lru_list_.push_front({ss_table->file_name(), ss_table, charge});
+        cache_index_[ss_table->file_name()] = lru_list_.begin();
+        cache_usage_ += charge;
+        EvictIfNeeded();
+    }
+
+    void SSTableManager::EvictIfNeeded()
+    {
+        auto it = lru_list_.end();
+        while(cache_usage_ > cache_capacity_ && it != lru_list_.begin()) {
+            -- it;
+            if(it->ss_table.use_count() > 1) {
+                // 被调用者持有，跳过
+                continue;
+            }
+            cache_usage_ -= it->charge;
+            cache_index_.erase(it->file_name);
+            it = lru_list_.erase(it);
+            ++ evictions_;
+        }
+    }
+
+    LevelIterator::LevelIterator(
+        int level,
+        std::shared_ptr<const std::vector<SSTableMetaData>> files,
+        SSTableManager &ss_table_manager
+    )
+        : level_(level),
+          files_(std::move(files)),
+          ss_table_manager_(&ss_table_manager),
+          file_index_(files_->size())
+    {
+    }
+
+    void LevelIterator::Seek(uint64_t key)
+    {
+        // 文件互不重叠且按最小键排序，最大键也是升序的
+        file_index_ = std::lower_bound(files_->begin(), files_->end(), key,
+            [](const SSTableMetaData &meta_data, uint64_t key) {
+                return meta_data.header.max_key < key;
+            }
+        ) - files_->begin();
+        ss_table_.reset();
+        position_ = 0;
+        if(file_index_ < files_->size()) {
+            ss_table_ = ss_table_manager_->FromFile((*files_)[file_index_].ss_table_file_name);
+            if(ss_table_) {
+                const auto &tuple_list = ss_table_->key_offset_vlen_tuple_list();
+                position_ = std::lower_bound(tuple_list.begin(), tuple_list.end(), key,
+                    [](const KeyOffsetVlenTuple &tuple, uint64_t key) {
+                        return tuple.key < key;
+                    }
+                ) - tuple_list.begin();
+            }
+        }
+        SkipExhaustedFiles();
+    }
+
+    bool LevelIterator::Valid() const
+    {
+        return file_index_ < files_->size();
+    }
+
+    void LevelIterator::Next()
+    {
+        assert(Valid());
+        ++ position_;
+        SkipExhaustedFiles();
+    }
+
+    const KeyOffsetVlenTuple &LevelIterator::current() const
+    {
+        assert(Valid());
+        return ss_table_->key_offset_vlen_tuple_list()[position_];
+    }
+
+    std::string_view LevelIterator::current_inline_value() const
+    {
+        assert(Valid());
+        return ss_table_->InlineValue(current());
+    }
+
+    void LevelIterator::SkipExhaustedFiles()
+    {
+        while(file_index_ < files_->size()
+            && (!ss_table_ || position_ >= ss_table_->key_offset_vlen_tuple_list().size())) {
+            // 当前文件遍历完毕（或加载失败），加载下一个文件
+            ss_table_.reset();
+            position_ = 0;
+            if(++ file_index_ < files_->size()) {
+                ss_table_ = ss_table_manager_->FromFile((*files_)[file_index_].ss_table_file_name);
+            }
+        }
     }
-}
\ No newline at end of file
+}
@@ -1,25 +1,133 @@
 #ifndef SS_TABLE_MANAGER_H
 #define SS_TABLE_MANAGER_H
-#include <map>
+#include <list>
+#include <unordered_map>
+#include <mutex>
+#include <atomic>
 #include "ss_table.h"
 namespace ss_table {
+    /**
+     * @brief SSTable缓存的统计信息
+     */
+    struct CacheStatistics {
+        uint64_t hits;
+        uint64_t misses;
+        uint64_t evictions;
+        size_t usage;       // 当前缓存占用的字节数（估计值）
+        size_t capacity;    // 缓存字节预算
+    };
+
+    /**
+     * @brief 创建、读取、删除SSTable，并以LRU策略缓存已读取的SSTable
+     * @details 缓存按文件完整路径哈希索引，总占用不超过字节预算。
+     * 调用者持有的SSTable（shared_ptr引用计数大于1）视为被钉住，不会被淘汰；
+     * 若所有条目都被钉住，缓存可以暂时超出预算。
+     */
     class SSTableManager {
     public:
-        SSTableManager() = default;
+        /**
+         * @param cache_capacity 缓存的字节预算
+         * @param bloom_filter_bits_per_key 新建SSTable的Bloom过滤器中每个键占用的比特数
+         */
+        SSTableManager(size_t cache_capacity, int bloom_filter_bits_per_key);
+
         std::shared_ptr<SSTable> FromFile(const std::string &file_name);
 
+        /**
+         * @brief 创建SSTable并放入缓存，不写入文件
+         * @param inline_values 内联值块，inserted_tuples中内联元组的offset为其中的偏移量
+         */
         std::shared_ptr<SSTable> NewSSTable(
             const std::string &file_name, 
             uint64_t time_stamp, 
-            const std::vector<KeyOffsetVlenTuple> &inserted_tuples
+            const std::vector<KeyOffsetVlenTuple> &inserted_tuples,
+            std::string inline_values = std::string()
         );
 
         void WriteSSTableToFile(const std::shared_ptr<SSTable> &ss_table);
         void DeleteSSTableFiles(const std::vector<std::string> &file_name_list);
         void ResetCache();
+
+        CacheStatistics cache_statistics() const;
+    private:
+        struct CacheEntry {
+            std::string file_name;
+            std::shared_ptr<SSTable> ss_table;
+            size_t charge;
+        };
+
+        /**
+         * @brief 将SSTable放入缓存并标记为最近使用，调用者须持有cache_mutex_
+         */
+        void InsertIntoCache(const std::shared_ptr<SSTable> &ss_table);
+
+        /**
+         * @brief 从最久未使用的一端淘汰未被钉住的条目，直到占用不超过预算，调用者须持有cache_mutex_
+         */
+        void EvictIfNeeded();
+
+        int bloom_filter_bits_per_key_;
+        std::list<CacheEntry> lru_list_; // 表头为最近使用的条目
+        std::unordered_map<std::string, std::list<CacheEntry>::iterator> cache_index_;
+        size_t cache_capacity_;
+        size_t cache_usage_ = 0;
+        std::atomic<uint64_t> hits_ = 0;
+        std::atomic<uint64_t> misses_ = 0;
+        std::atomic<uint64_t> evictions_ = 0;
+        mutable std::mutex cache_mutex_; // 前台查找与后台合并会同时访问缓存
+    };
+
+    /**
+     * @brief 互不重叠的一层SSTable的串联迭代器
+     * @details 文件按最小键升序排列，只有当前文件遍历完毕时才通过SSTableManager加载下一个文件，
+     * 因此只取前N个键时加载的文件数与返回的记录数成正比，而不是与该层的文件数成正比。
+     * 迭代期间files中的SSTable文件须保持存在，加载失败的文件视为空文件。
+     */
+    class LevelIterator
+    {
+    public:
+        /**
+         * @param level 层数
+         * @param files 该层的文件列表快照，按最小键升序且互不重叠
+         * @param ss_table_manager 加载SSTable
+         */
+        LevelIterator(
+            int level,
+            std::shared_ptr<const std::vector<SSTableMetaData>> files,
+            SSTableManager &ss_table_manager
+        );
+
+        /**
+         * @brief 定位到第一个键不小于key的元组，只加载该元组所在的文件
+         */
+        void Seek(uint64_t key);
+
+        bool Valid() const;
+
+        void Next();
+
+        const KeyOffsetVlenTuple &current() const;
+
+        /**
+         * @brief 当前元组内联存储的值，调用者须保证IsInlineValue(current().vlen)
+         */
+        std::string_view current_inline_value() const;
+
+        int level() const { return level_; }
+
     private:
-        std::map<std::string, std::shared_ptr<SSTable>> ss_table_read_cache_;
+        /**
+         * @brief 从第file_index_个文件的第position_个元组开始，跳过已经遍历完毕的文件
+         */
+        void SkipExhaustedFiles();
+
+        int level_;
+        std::shared_ptr<const std::vector<SSTableMetaData>> files_;
+        SSTableManager *ss_table_manager_;
+        size_t file_index_ = 0;
+        std::shared_ptr<SSTable> ss_table_; // 第file_index_个文件，尚未加载时为nullptr
+        size_t position_ = 0;
     };
 }
 
-#endif //SS_TABLE_MANAGER_H
\ No newline at end of file
+#endif //SS_TABLE_MANAGER_H
@@ -0,0 +1,57 @@
+#include "statistics.h"
+
+namespace statistics {
+    // 与Ticker的顺序一致
+    static const char *kTickerNames[] = {
+        "lsmkv.keys.written",
+        "lsmkv.bytes.written",
+        "lsmkv.keys.read",
+        "lsmkv.memtable.hit",
+        "lsmkv.memtable.miss",
+        "lsmkv.sstable.probes",
+        "lsmkv.bloom.filter.useful",
+        "lsmkv.bloom.filter.positive",
+        "lsmkv.bloom.filter.false.positive",
+        "lsmkv.flush.count",
+        "lsmkv.flush.bytes.written",
+        "lsmkv.vlog.bytes.written",
+        "lsmkv.compaction.count",
+        "lsmkv.compaction.trivial.move.count",
+        "lsmkv.compaction.bytes.read",
+        "lsmkv.compaction.bytes.written",
+        "lsmkv.gc.count",
+        "lsmkv.gc.bytes.reclaimed",
+        "lsmkv.gc.bytes.relocated",
+    };
+    static_assert(sizeof(kTickerNames) / sizeof(kTickerNames[0]) == static_cast<size_t>(Ticker::kCount),
+        "kTickerNames does not match Ticker");
+
+    Statistics::Statistics()
+    {
+        Reset();
+    }
+
+    void Statistics::Reset()
+    {
+        for(auto &ticker: tickers_) {
+            ticker.value.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    std::string Statistics::ToString() const
+    {
+        std::string result;
+        for(int i = 0; i < static_cast<int>(Ticker::kCount); ++i) {
+            result += kTickerNames[i];
+            result += ": ";
+            result += std::to_string(ticker(static_cast<Ticker>(i)));
+            result += "\n";
+        }
+        return result;
+    }
+
+    const char *Statistics::TickerName(Ticker ticker)
+    {
+        return kTickerNames[static_cast<int>(ticker)];
+    }
+}
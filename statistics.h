@@ -0,0 +1,75 @@
+#ifndef LSMKV_HANDOUT_STATISTICS_H
+#define LSMKV_HANDOUT_STATISTICS_H
+
+#include <cstdint>
+#include <atomic>
+#include <string>
+
+namespace statistics {
+    /**
+     * @brief 计数器，字节数均为写入或读取文件的字节数
+     */
+    enum class Ticker {
+        kKeysWritten,               // put与成功的del次数
+        kBytesWritten,              // 用户写入的键值字节数，用于计算写放大
+        kKeysRead,                  // get次数
+        kMemTableHit,               // 在内存表或只读内存表中找到记录（包括删除标记）
+        kMemTableMiss,
+        kSSTableProbes,             // 查找时读取的SSTable个数
+        kBloomFilterUseful,         // Bloom过滤器判断键不存在，省去二分查找
+        kBloomFilterPositive,       // Bloom过滤器判断键可能存在
+        kBloomFilterFalsePositive,  // Bloom过滤器判断可能存在，但二分查找未找到
+        kFlushCount,
+        kFlushBytesWritten,         // 内存表写入level-0的SSTable字节数
+        kVLogBytesWritten,
+        kCompactionCount,           // 归并的合并次数，不包括直接移动
+        kTrivialMoveCount,
+        kCompactionBytesRead,
+        kCompactionBytesWritten,
+        kGcCount,
+        kGcBytesReclaimed,          // 垃圾回收释放的VLog字节数
+        kGcBytesRelocated,          // 垃圾回收重新写入的有效值字节数
+        kCount
+    };
+
+    /**
+     * @brief 引擎内部的计数器集合
+     * @details 每个计数器独占一个缓存行，多个线程并发累加时互不干扰。
+     * 计数器只在内存中累计，不持久化。
+     */
+    class Statistics
+    {
+    public:
+        Statistics();
+        Statistics(const Statistics &) = delete;
+        Statistics &operator=(const Statistics &) = delete;
+
+        void RecordTick(Ticker ticker, uint64_t count = 1)
+        {
+            tickers_[static_cast<int>(ticker)].value.fetch_add(count, std::memory_order_relaxed);
+        }
+
+        uint64_t ticker(Ticker ticker) const
+        {
+            return tickers_[static_cast<int>(ticker)].value.load(std::memory_order_relaxed);
+        }
+
+        void Reset();
+
+        /**
+         * @brief 每行输出一个计数器，形如"lsmkv.bloom.filter.useful: 12"
+         */
+        std::string ToString() const;
+
+        static const char *TickerName(Ticker ticker);
+
+    private:
+        struct alignas(64) PaddedCounter {
+            std::atomic<uint64_t> value;
+        };
+
+        PaddedCounter tickers_[static_cast<int>(Ticker::kCount)];
+    };
+}
+
+#endif //LSMKV_HANDOUT_STATISTICS_H
@@ -105,7 +105,8 @@ protected:
 	bool verbose;
 
 public:
-	Test(const std::string &dir, const std::string &vlog, bool v = true) : vlog(vlog), store(dir, vlog), verbose(v)
+	Test(const std::string &dir, const std::string &vlog, bool v = true, const KVStoreOptions &options = KVStoreOptions())
+		: vlog(vlog), store(dir, vlog, options), verbose(v)
 	{
 		nr_tests = 0;
 		nr_passed_tests = 0;
@@ -0,0 +1,523 @@
+/**
+ * @file bench.cc
+ * @brief LSM-KVStore YCSB风格负载测试
+ * @details 先加载records条记录，再按负载A~F的读写比例执行操作，结果以JSON或CSV输出到标准输出。
+ *
+ * 用法：./bench [--workload=a] [--distribution=zipfian] [--records=100000] [--operations=100000] ...
+ * 运行./bench --help查看全部参数。
+ */
+#include <iostream>
+#include <chrono>
+#include <string>
+#include <list>
+#include <vector>
+#include <map>
+#include <random>
+#include <thread>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include "../kvstore.h"
+#include "../kvstore_iterator.h"
+#include "../histogram.h"
+using namespace std::chrono;
+
+/**
+ * @brief 负载中的一种操作
+ */
+enum class Operation {
+    kRead,
+    kUpdate,
+    kInsert,
+    kScan,
+    kReadModifyWrite,
+    kCount
+};
+
+static const char *kOperationNames[] = {"read", "update", "insert", "scan", "rmw"};
+
+enum class Distribution {
+    kUniform,
+    kZipfian,
+    kLatest
+};
+
+struct BenchOptions {
+    std::string workload = "a";
+    std::string distribution; // 为空时使用负载的默认分布
+    std::string dir = "data";
+    std::string format = "json";
+    uint64_t records = 100000;
+    uint64_t operations = 100000;
+    double duration_seconds = 0; // 大于0时，到达时长后提前结束
+    int threads = 1;
+    double zipfian_theta = 0.99;
+    std::string value_size_distribution = "fixed";
+    uint32_t value_size = 100;
+    uint32_t value_size_max = 1000; // value_size_distribution为uniform时的上界
+    uint32_t scan_length_max = 100;
+    uint64_t seed = 1;
+    // 各操作的比例，小于0时使用负载的默认值
+    double proportions[static_cast<int>(Operation::kCount)] = {-1, -1, -1, -1, -1};
+    KVStoreOptions store_options; // 传给KVStore的引擎参数
+};
+
+/**
+ * @brief YCSB ZipfianGenerator：以theta为参数，在[0, items)中生成小编号更热的随机数
+ */
+class ZipfianGenerator {
+public:
+    ZipfianGenerator(uint64_t items, double theta)
+        : items_(std::max<uint64_t>(items, 1)), theta_(theta)
+    {
+        zetan_ = Zeta(items_, theta_);
+        alpha_ = 1.0 / (1.0 - theta_);
+        double zeta2 = Zeta(2, theta_);
+        eta_ = (1 - std::pow(2.0 / items_, 1 - theta_)) / (1 - zeta2 / zetan_);
+    }
+
+    uint64_t Next(std::mt19937_64 &rng) const
+    {
+        double u = std::uniform_real_distribution<double>(0.0, 1.0)(rng);
+        double uz = u * zetan_;
+        if(uz < 1.0) {
+            return 0;
+        }
+        if(uz < 1.0 + std::pow(0.5, theta_)) {
+            return 1;
+        }
+        return std::min<uint64_t>(items_ - 1, items_ * std::pow(eta_ * u - eta_ + 1, alpha_));
+    }
+
+private:
+    static double Zeta(uint64_t n, double theta)
+    {
+        double sum = 0;
+        for(uint64_t i = 0; i < n; ++i) {
+            sum += 1 / std::pow(i + 1, theta);
+        }
+        return sum;
+    }
+
+    uint64_t items_;
+    double theta_;
+    double zetan_;
+    double alpha_;
+    double eta_;
+};
+
+/**
+ * @brief 记录编号到键的映射（FNV-1a哈希），使插入顺序与键序无关
+ */
+static uint64_t RecordKey(uint64_t record)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for(int i = 0; i < 8; ++i) {
+        hash ^= (record >> (i * 8)) & 0xff;
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+/**
+ * @brief 单个线程的操作统计，每种操作一个延迟直方图（纳秒）
+ */
+struct OperationStats {
+    histogram::Histogram latency[static_cast<int>(Operation::kCount)];
+
+    void Merge(const OperationStats &other)
+    {
+        for(int i = 0; i < static_cast<int>(Operation::kCount); ++i) {
+            latency[i].Merge(other.latency[i]);
+        }
+    }
+};
+
+class Bench {
+public:
+    explicit Bench(const BenchOptions &options)
+        : options_(options),
+          store_(options.dir, options.dir + "/vlog", options.store_options),
+          zipfian_(options.records, options.zipfian_theta),
+          inserted_records_(0)
+    {
+        SetupWorkload();
+    }
+
+    /**
+     * @brief 加载records条记录
+     */
+    double Load()
+    {
+        store_.reset();
+        std::mt19937_64 rng(options_.seed);
+        auto start_time = steady_clock::now();
+        for(uint64_t i = 0; i < options_.records; ++i) {
+            store_.put(RecordKey(i), NextValue(rng));
+        }
+        inserted_records_ = options_.records;
+        return duration<double>(steady_clock::now() - start_time).count();
+    }
+
+    /**
+     * @brief 多线程执行负载，返回实际耗时（秒）
+     */
+    double Run(OperationStats &stats)
+    {
+        std::vector<OperationStats> thread_stats(options_.threads);
+        std::vector<std::thread> threads;
+        auto start_time = steady_clock::now();
+        for(int t = 0; t < options_.threads; ++t) {
+            uint64_t operations = options_.operations / options_.threads
+                + (static_cast<uint64_t>(t) < options_.operations % options_.threads ? 1 : 0);
+            threads.emplace_back(&Bench::RunThread, this, t, operations, start_time, std::ref(thread_stats[t]));
+        }
+        for(auto &thread: threads) {
+            thread.join();
+        }
+        for(const auto &thread_stat: thread_stats) {
+            stats.Merge(thread_stat);
+        }
+        return duration<double>(steady_clock::now() - start_time).count();
+    }
+
+    const BenchOptions &options() const { return options_; }
+    const KVStore &store() const { return store_; }
+    Distribution distribution() const { return distribution_; }
+    const double *proportions() const { return proportions_; }
+
+private:
+    void SetupWorkload()
+    {
+        // 各负载的默认读写比例与键分布，与YCSB core workloads一致
+        static const std::map<std::string, std::pair<std::vector<double>, Distribution>> workloads = {
+            {"a", {{0.5, 0.5, 0, 0, 0}, Distribution::kZipfian}},
+            {"b", {{0.95, 0.05, 0, 0, 0}, Distribution::kZipfian}},
+            {"c", {{1.0, 0, 0, 0, 0}, Distribution::kZipfian}},
+            {"d", {{0.95, 0, 0.05, 0, 0}, Distribution::kLatest}},
+            {"e", {{0, 0, 0.05, 0.95, 0}, Distribution::kZipfian}},
+            {"f", {{0.5, 0, 0, 0, 0.5}, Distribution::kZipfian}},
+        };
+        auto it = workloads.find(options_.workload);
+        if(it == workloads.end()) {
+            std::cerr << "unknown workload " << options_.workload << std::endl;
+            exit(1);
+        }
+        for(int i = 0; i < static_cast<int>(Operation::kCount); ++i) {
+            proportions_[i] = options_.proportions[i] >= 0 ? options_.proportions[i] : it->second.first[i];
+        }
+        distribution_ = it->second.second;
+        if(options_.distribution == "uniform") {
+            distribution_ = Distribution::kUniform;
+        } else if(options_.distribution == "zipfian") {
+            distribution_ = Distribution::kZipfian;
+        } else if(options_.distribution == "latest") {
+            distribution_ = Distribution::kLatest;
+        } else if(!options_.distribution.empty()) {
+            std::cerr << "unknown distribution " << options_.distribution << std::endl;
+            exit(1);
+        }
+    }
+
+    void RunThread(int thread_index, uint64_t operations, steady_clock::time_point start_time, OperationStats &stats)
+    {
+        std::mt19937_64 rng(options_.seed + thread_index + 1);
+        std::uniform_real_distribution<double> uniform(0.0, 1.0);
+        double total_proportion = 0;
+        for(double proportion: proportions_) {
+            total_proportion += proportion;
+        }
+
+        for(uint64_t i = 0; i < operations; ++i) {
+            if(options_.duration_seconds > 0 && i % 64 == 0
+                && duration<double>(steady_clock::now() - start_time).count() >= options_.duration_seconds) {
+                break;
+            }
+
+            // 按比例选择操作
+            double r = uniform(rng) * total_proportion;
+            int operation = 0;
+            while(operation + 1 < static_cast<int>(Operation::kCount) && r >= proportions_[operation]) {
+                r -= proportions_[operation];
+                ++ operation;
+            }
+
+            histogram::ScopedTimer timer(stats.latency[operation]);
+            DoOperation(static_cast<Operation>(operation), rng);
+        }
+    }
+
+    void DoOperation(Operation operation, std::mt19937_64 &rng)
+    {
+        switch(operation) {
+        case Operation::kRead:
+            store_.get(RecordKey(NextRecord(rng)));
+            break;
+        case Operation::kUpdate:
+            store_.put(RecordKey(NextRecord(rng)), NextValue(rng));
+            break;
+        case Operation::kInsert:
+            store_.put(RecordKey(inserted_records_++), NextValue(rng));
+            break;
+        case Operation::kScan: {
+            // 从起始键开始按键序读取若干条记录
+            uint32_t scan_length = std::uniform_int_distribution<uint32_t>(1, options_.scan_length_max)(rng);
+            auto iterator = store_.NewIterator();
+            uint32_t count = 0;
+            for(iterator->Seek(RecordKey(NextRecord(rng))); iterator->Valid() && count < scan_length; iterator->Next()) {
+                iterator->value();
+                ++ count;
+            }
+            break;
+        }
+        case Operation::kReadModifyWrite: {
+            uint64_t key = RecordKey(NextRecord(rng));
+            std::string value = store_.get(key);
+            store_.put(key, NextValue(rng));
+            break;
+        }
+        default:
+            break;
+        }
+    }
+
+    /**
+     * @brief 按键分布选择一条已插入的记录
+     */
+    uint64_t NextRecord(std::mt19937_64 &rng) const
+    {
+        uint64_t inserted_records = std::max<uint64_t>(inserted_records_.load(), 1);
+        switch(distribution_) {
+        case Distribution::kUniform:
+            return std::uniform_int_distribution<uint64_t>(0, inserted_records - 1)(rng);
+        case Distribution::kLatest: {
+            // 最近插入的记录最热
+            uint64_t offset = zipfian_.Next(rng) % inserted_records;
+            return inserted_records - 1 - offset;
+        }
+        case Distribution::kZipfian:
+        default:
+            return zipfian_.Next(rng) % inserted_records;
+        }
+    }
+
+    std::string NextValue(std::mt19937_64 &rng) const
+    {
+        uint32_t size = options_.value_size;
+        if(options_.value_size_distribution == "uniform") {
+            size = std::uniform_int_distribution<uint32_t>(options_.value_size, options_.value_size_max)(rng);
+        }
+        return std::string(size, 'a' + rng() % 26);
+    }
+
+    BenchOptions options_;
+    KVStore store_;
+    ZipfianGenerator zipfian_;
+    Distribution distribution_;
+    double proportions_[static_cast<int>(Operation::kCount)];
+    std::atomic<uint64_t> inserted_records_;
+};
+
+static const char *DistributionName(Distribution distribution)
+{
+    switch(distribution) {
+    case Distribution::kUniform:
+        return "uniform";
+    case Distribution::kLatest:
+        return "latest";
+    case Distribution::kZipfian:
+    default:
+        return "zipfian";
+    }
+}
+
+static const char *WalSyncModeName(WalSyncMode mode)
+{
+    switch(mode) {
+    case WalSyncMode::kPerBatch:
+        return "per-batch";
+    case WalSyncMode::kPeriodic:
+        return "periodic";
+    case WalSyncMode::kNone:
+    default:
+        return "none";
+    }
+}
+
+static void PrintJsonLatency(const histogram::Histogram &latency)
+{
+    printf("{\"count\": %lu, \"avg_us\": %.3f, \"p50_us\": %.3f, \"p90_us\": %.3f, "
+        "\"p99_us\": %.3f, \"p999_us\": %.3f, \"max_us\": %.3f}",
+        latency.count(), latency.Average() / 1000, latency.Percentile(50) / 1000.0, latency.Percentile(90) / 1000.0,
+        latency.Percentile(99) / 1000.0, latency.Percentile(99.9) / 1000.0, latency.max() / 1000.0);
+}
+
+static void PrintJson(const Bench &bench, double load_seconds, double run_seconds, const OperationStats &stats)
+{
+    const auto &options = bench.options();
+    uint64_t total_operations = 0;
+    for(const auto &latency: stats.latency) {
+        total_operations += latency.count();
+    }
+    printf("{\n");
+    printf("  \"workload\": \"%s\",\n", options.workload.c_str());
+    printf("  \"distribution\": \"%s\",\n", DistributionName(bench.distribution()));
+    printf("  \"records\": %lu,\n", options.records);
+    printf("  \"threads\": %d,\n", options.threads);
+    printf("  \"value_size\": \"%s:%u-%u\",\n", options.value_size_distribution.c_str(),
+        options.value_size, options.value_size_distribution == "uniform" ? options.value_size_max : options.value_size);
+    const auto &store_options = options.store_options;
+    printf("  \"store_options\": {\"use_wal\": %s, \"wal_sync_mode\": \"%s\", \"min_blob_size\": %zu, "
+        "\"ss_table_cache_capacity\": %zu, \"bloom_filter_bits_per_key\": %d, \"max_subcompactions\": %d},\n",
+        store_options.use_wal ? "true" : "false", WalSyncModeName(store_options.wal_sync_mode),
+        store_options.min_blob_size, store_options.ss_table_cache_capacity,
+        store_options.bloom_filter_bits_per_key, store_options.max_subcompactions);
+    printf("  \"load_seconds\": %.6f,\n", load_seconds);
+    printf("  \"run_seconds\": %.6f,\n", run_seconds);
+    printf("  \"operations\": %lu,\n", total_operations);
+    printf("  \"throughput_ops\": %.2f,\n", total_operations / run_seconds);
+    printf("  \"ops\": {");
+    bool first = true;
+    for(int i = 0; i < static_cast<int>(Operation::kCount); ++i) {
+        if(!stats.latency[i].count()) {
+            continue;
+        }
+        printf("%s\n    \"%s\": ", first ? "" : ",", kOperationNames[i]);
+        PrintJsonLatency(stats.latency[i]);
+        first = false;
+    }
+    // KVStore内部记录的延迟，包括加载阶段，以及后台的写入、合并
+    printf("\n  },\n  \"engine\": {");
+    for(int i = 0; i < static_cast<int>(LatencyType::kCount); ++i) {
+        printf("%s\n    \"%s\": ", i ? "," : "", LatencyTypeName(static_cast<LatencyType>(i)));
+        PrintJsonLatency(bench.store().latency_histogram(static_cast<LatencyType>(i)));
+    }
+    printf("\n  }\n}\n");
+}
+
+static void PrintCsvLatency(const Bench &bench, const char *scope, const char *name,
+    const histogram::Histogram &latency, double run_seconds)
+{
+    const auto &options = bench.options();
+    const auto &store_options = options.store_options;
+    printf("%s,%s,%lu,%d,%d,%s,%zu,%zu,%d,%d,%s,%s,%lu,%.2f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f\n", options.workload.c_str(),
+        DistributionName(bench.distribution()), options.records, options.threads,
+        store_options.use_wal, WalSyncModeName(store_options.wal_sync_mode), store_options.min_blob_size,
+        store_options.ss_table_cache_capacity, store_options.bloom_filter_bits_per_key,
+        store_options.max_subcompactions, scope, name, latency.count(),
+        latency.count() / run_seconds, latency.Average() / 1000, latency.Percentile(50) / 1000.0,
+        latency.Percentile(90) / 1000.0, latency.Percentile(99) / 1000.0, latency.Percentile(99.9) / 1000.0,
+        latency.max() / 1000.0);
+}
+
+static void PrintCsv(const Bench &bench, double load_seconds, double run_seconds, const OperationStats &stats)
+{
+    printf("workload,distribution,records,threads,use_wal,wal_sync_mode,min_blob_size,ss_table_cache_capacity,"
+        "bloom_filter_bits_per_key,max_subcompactions,scope,op,count,throughput_ops,"
+        "avg_us,p50_us,p90_us,p99_us,p999_us,max_us\n");
+    for(int i = 0; i < static_cast<int>(Operation::kCount); ++i) {
+        if(stats.latency[i].count()) {
+            PrintCsvLatency(bench, "run", kOperationNames[i], stats.latency[i], run_seconds);
+        }
+    }
+    for(int i = 0; i < static_cast<int>(LatencyType::kCount); ++i) {
+        const auto &latency = bench.store().latency_histogram(static_cast<LatencyType>(i));
+        if(latency.count()) {
+            PrintCsvLatency(bench, "engine", LatencyTypeName(static_cast<LatencyType>(i)), latency, load_seconds + run_seconds);
+        }
+    }
+}
+
+static void PrintUsage()
+{
+    std::cerr <<
+        "usage: ./bench [options]\n"
+        "  --workload=a|b|c|d|e|f        YCSB core workload (default a)\n"
+        "  --distribution=uniform|zipfian|latest  key distribution (default: workload's)\n"
+        "  --records=N                   records loaded before the run (default 100000)\n"
+        "  --operations=N                operations in the run (default 100000)\n"
+        "  --duration=SECONDS            stop the run early after SECONDS\n"
+        "  --threads=N                   client threads (default 1)\n"
+        "  --zipfian-theta=X             zipfian skew (default 0.99)\n"
+        "  --value-size=N                value size, or lower bound for uniform (default 100)\n"
+        "  --value-size-max=N            upper bound for uniform value sizes (default 1000)\n"
+        "  --value-size-distribution=fixed|uniform\n"
+        "  --scan-length=N               max records per scan (default 100)\n"
+        "  --read-proportion=X --update-proportion=X --insert-proportion=X\n"
+        "  --scan-proportion=X --rmw-proportion=X   override the workload's mix\n"
+        "  --use-wal=0|1                 write puts and deletes to the write-ahead log (default 1)\n"
+        "  --wal-sync-mode=none|per-batch|periodic  when the WAL is synced (default none)\n"
+        "  --min-blob-size=N             values shorter than N bytes are stored inline (default 0)\n"
+        "  --cache-capacity=BYTES        SSTable cache budget (default 64 MiB)\n"
+        "  --bloom-bits-per-key=N        bloom filter bits per key of new SSTables (default 10)\n"
+        "  --max-subcompactions=N        key-range partitions per compaction (default 4)\n"
+        "  --dir=PATH                    data directory (default data)\n"
+        "  --format=json|csv             output format (default json)\n"
+        "  --seed=N                      random seed (default 1)\n";
+}
+
+static bool ParseOptions(int argc, char **argv, BenchOptions &options)
+{
+    for(int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        size_t pos = arg.find('=');
+        if(arg.rfind("--", 0) != 0 || pos == std::string::npos) {
+            return false;
+        }
+        std::string name = arg.substr(2, pos - 2), value = arg.substr(pos + 1);
+        if(name == "workload") options.workload = value;
+        else if(name == "distribution") options.distribution = value;
+        else if(name == "records") options.records = std::stoull(value);
+        else if(name == "operations") options.operations = std::stoull(value);
+        else if(name == "duration") options.duration_seconds = std::stod(value);
+        else if(name == "threads") options.threads = std::max(1, std::stoi(value));
+        else if(name == "zipfian-theta") options.zipfian_theta = std::stod(value);
+        else if(name == "value-size") options.value_size = std::stoul(value);
+        else if(name == "value-size-max") options.value_size_max = std::stoul(value);
+        else if(name == "value-size-distribution") options.value_size_distribution = value;
+        else if(name == "scan-length") options.scan_length_max = std::max(1UL, std::stoul(value));
+        else if(name == "read-proportion") options.proportions[static_cast<int>(Operation::kRead)] = std::stod(value);
+        else if(name == "update-proportion") options.proportions[static_cast<int>(Operation::kUpdate)] = std::stod(value);
+        else if(name == "insert-proportion") options.proportions[static_cast<int>(Operation::kInsert)] = std::stod(value);
+        else if(name == "scan-proportion") options.proportions[static_cast<int>(Operation::kScan)] = std::stod(value);
+        else if(name == "rmw-proportion") options.proportions[static_cast<int>(Operation::kReadModifyWrite)] = std::stod(value);
+        else if(name == "use-wal") options.store_options.use_wal = std::stoi(value) != 0;
+        else if(name == "wal-sync-mode") {
+            if(value == "none") options.store_options.wal_sync_mode = WalSyncMode::kNone;
+            else if(value == "per-batch") options.store_options.wal_sync_mode = WalSyncMode::kPerBatch;
+            else if(value == "periodic") options.store_options.wal_sync_mode = WalSyncMode::kPeriodic;
+            else return false;
+        }
+        else if(name == "min-blob-size") options.store_options.min_blob_size = std::stoull(value);
+        else if(name == "cache-capacity") options.store_options.ss_table_cache_capacity = std::stoull(value);
+        else if(name == "bloom-bits-per-key") options.store_options.bloom_filter_bits_per_key = std::stoi(value);
+        else if(name == "max-subcompactions") options.store_options.max_subcompactions = std::max(1, std::stoi(value));
+        else if(name == "dir") options.dir = value;
+        else if(name == "format") options.format = value;
+        else if(name == "seed") options.seed = std::stoull(value);
+        else return false;
+    }
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    BenchOptions options;
+    if(!ParseOptions(argc, argv, options)) {
+        PrintUsage();
+        return 1;
+    }
+
+    Bench bench(options);
+    double load_seconds = bench.Load();
+    OperationStats stats;
+    double run_seconds = bench.Run(stats);
+
+    if(options.format == "csv") {
+        PrintCsv(bench, load_seconds, run_seconds, stats);
+    } else {
+        PrintJson(bench, load_seconds, run_seconds, stats);
+    }
+    return 0;
+}
@@ -12,8 +12,14 @@
 #include <chrono>
 #include <string>
 #include <list>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <cstdint>
 #include "../utils/logger.h"
 #include "../kvstore.h"
+#include "../histogram.h"
+#include "../statistics.h"
 using namespace std::chrono;
 void do_regular_test(KVStoreAPI &store, int num_operations)
 {
@@ -23,8 +29,10 @@ void do_regular_test(KVStoreAPI &store, int num_operations)
 
     LOG_INFO("Regular PUT test");
     auto start_time = high_resolution_clock::now();
+    histogram::Histogram put_latency;
     for (int i = 0; i < num_operations; ++i)
     {
+        histogram::ScopedTimer timer(put_latency);
         store.put(i, "value" + std::to_string(i));
     }
     auto end_time = high_resolution_clock::now();
@@ -32,11 +40,14 @@ void do_regular_test(KVStoreAPI &store, int num_operations)
     double throughput = num_operations / elapsed.count();
     double avg_latency = elapsed.count() / num_operations;
     LOG_INFO("PUT Throughput: %f KOs/sec, Avg Latency: %f ms/op", throughput / 1000, avg_latency * 1000);
+    LOG_INFO("PUT Latency: %s", put_latency.ToString().c_str());
 
     LOG_INFO("Regular GET test");
     start_time = high_resolution_clock::now();
+    histogram::Histogram get_latency;
     for (int i = 0; i < num_operations; ++i)
     {
+        histogram::ScopedTimer timer(get_latency);
         store.get(i);
     }
     end_time = high_resolution_clock::now();
@@ -44,11 +55,14 @@ void do_regular_test(KVStoreAPI &store, int num_operations)
     throughput = num_operations / elapsed.count();
     avg_latency = elapsed.count() / num_operations;
     LOG_INFO("GET Throughput: %f KOps/sec, Avg Latency: %f ms/op", throughput / 1000, avg_latency * 1000);
+    LOG_INFO("GET Latency: %s", get_latency.ToString().c_str());
 
     LOG_INFO("Regular SCAN test");
     start_time = high_resolution_clock::now();
+    histogram::Histogram scan_latency;
     for (int i = 0; i < num_operations; ++i)
     {
+        histogram::ScopedTimer timer(scan_latency);
         std::list<std::pair<uint64_t, std::string>> list;
         store.scan(i, i + 100, list);
     }
@@ -57,11 +71,14 @@ void do_regular_test(KVStoreAPI &store, int num_operations)
     throughput = num_operations / elapsed.count();
     avg_latency = elapsed.count() / num_operations;
     LOG_INFO("SCAN Throughput: %f KOps/sec, Avg Latency: %f ms/op", throughput / 1000, avg_latency * 1000);
+    LOG_INFO("SCAN Latency: %s", scan_latency.ToString().c_str());
 
     LOG_INFO("Regular DEL test");
     start_time = high_resolution_clock::now();
+    histogram::Histogram del_latency;
     for (int i = 0; i < num_operations; ++i)
     {
+        histogram::ScopedTimer timer(del_latency);
         store.del(i);
     }
     end_time = high_resolution_clock::now();
@@ -69,31 +86,109 @@ void do_regular_test(KVStoreAPI &store, int num_operations)
     throughput = num_operations / elapsed.count();
     avg_latency = elapsed.count() / num_operations;
     LOG_INFO("DEL Throughput: %f KOps/sec, Avg Latency: %f ms/op", throughput / 1000, avg_latency * 1000);
+    LOG_INFO("DEL Latency: %s", del_latency.ToString().c_str());
 
     LOG_INFO("=== Regular test finished ===");
 }
 
-void do_compaction_test(KVStoreAPI &store, size_t duration_seconds)
+void do_concurrent_put_test(KVStoreAPI &store, int num_operations)
 {
+    // 写入经过预写日志，组提交之后各线程并发写入内存表
+    LOG_INFO("=== Concurrent PUT test (WAL on) ===");
+    double base_throughput = 0;
+    for (int num_threads = 1; num_threads <= 8; num_threads *= 2)
+    {
+        store.reset();
+        auto start_time = high_resolution_clock::now();
+        std::vector<std::thread> threads;
+        for (int t = 0; t < num_threads; ++t)
+        {
+            threads.emplace_back([&store, t, num_threads, num_operations] {
+                for (int i = t; i < num_operations; i += num_threads)
+                {
+                    store.put(i, "value" + std::to_string(i));
+                }
+            });
+        }
+        for (auto &thread : threads)
+        {
+            thread.join();
+        }
+        duration<double> elapsed = high_resolution_clock::now() - start_time;
+        double throughput = num_operations / elapsed.count();
+        if (num_threads == 1)
+        {
+            base_throughput = throughput;
+        }
+        LOG_INFO("%d threads: PUT Throughput: %f KOps/sec, Speedup: %fx",
+                 num_threads, throughput / 1000, throughput / base_throughput);
+
+        for (int i = 0; i < num_operations; ++i)
+        {
+            if (store.get(i) != "value" + std::to_string(i))
+            {
+                LOG_ERROR("%d threads: wrong value for key %d", num_threads, i);
+                break;
+            }
+        }
+    }
+    LOG_INFO("=== Concurrent PUT test finished ===");
+}
+
+void do_compaction_test(KVStore &store, size_t duration_seconds)
+{
+    // 逐秒统计写入吞吐量，并记录每秒内发生的刷盘与合并次数，
+    // 后台刷盘与合并期间前台吞吐量应保持平稳
     LOG_INFO("=== Compaction test ===");
     store.reset();
-    std::vector<size_t> throughput;
+    struct Interval
+    {
+        size_t put_count;
+        uint64_t flush_count;
+        uint64_t compaction_count;
+        uint64_t trivial_move_count;
+        double p99_latency_us;
+        double max_latency_us;
+    };
+    std::vector<Interval> intervals;
+    const statistics::Statistics &stats = store.statistics();
     auto start_time = std::chrono::steady_clock::now();
-    size_t put_count = 0;
 
     for (size_t i = 0; i < duration_seconds; ++i) {
         auto next_second = start_time + std::chrono::seconds(i + 1);
+        uint64_t flush_count = stats.ticker(statistics::Ticker::kFlushCount);
+        uint64_t compaction_count = stats.ticker(statistics::Ticker::kCompactionCount);
+        uint64_t trivial_move_count = stats.ticker(statistics::Ticker::kTrivialMoveCount);
+        histogram::Histogram put_latency;
+        size_t put_count = 0;
         while (std::chrono::steady_clock::now() < next_second) {
+            histogram::ScopedTimer timer(put_latency);
             store.put(i * 1000000 + put_count, "value");
             ++put_count;
         }
-        throughput.push_back(put_count);
-        put_count = 0;
+        intervals.push_back({put_count,
+                             stats.ticker(statistics::Ticker::kFlushCount) - flush_count,
+                             stats.ticker(statistics::Ticker::kCompactionCount) - compaction_count,
+                             stats.ticker(statistics::Ticker::kTrivialMoveCount) - trivial_move_count,
+                             put_latency.Percentile(99) / 1000.0,
+                             put_latency.max() / 1000.0});
     }
 
-
-    for(size_t i = 0; i < throughput.size(); ++i) {
-        LOG_INFO("Second %zu: %zu PUT requests", i, throughput[i]);
+    size_t min_count = SIZE_MAX, max_count = 0, total_count = 0;
+    for (size_t i = 0; i < intervals.size(); ++i) {
+        const Interval &interval = intervals[i];
+        LOG_INFO("Second %zu: %zu PUT requests, %f KOps/sec, P99 Latency: %f us, Max Latency: %f us, "
+                 "flushes: %lu, compactions: %lu, trivial moves: %lu",
+                 i, interval.put_count, interval.put_count / 1000.0,
+                 interval.p99_latency_us, interval.max_latency_us,
+                 interval.flush_count, interval.compaction_count, interval.trivial_move_count);
+        min_count = std::min(min_count, interval.put_count);
+        max_count = std::max(max_count, interval.put_count);
+        total_count += interval.put_count;
+    }
+    if (!intervals.empty()) {
+        LOG_INFO("PUT Throughput per second: min %f KOps/sec, avg %f KOps/sec, max %f KOps/sec",
+                 min_count / 1000.0, total_count / 1000.0 / intervals.size(), max_count / 1000.0);
     }
 
     LOG_INFO("=== Compaction test finished ===");
@@ -104,6 +199,7 @@ int main()
     int compaction_test_duration_seconds = 60;
     KVStore store("data", "data/vlog");
     do_regular_test(store, regular_test_num_operations);
+    do_concurrent_put_test(store, regular_test_num_operations);
     do_compaction_test(store, compaction_test_duration_seconds);
     return 0;
 }
@@ -105,6 +105,66 @@ namespace utils
         return ::unlink(path.c_str());
     }
     
+    /**
+     * Create a hard link to a file
+     * @param path existing file.
+     * @param new_path path of the new link.
+     * @return 0 if link successfully, -1 otherwise.
+     */
+    static inline int linkfile(const std::string &path, const std::string &new_path)
+    {
+        return ::link(path.c_str(), new_path.c_str());
+    }
+
+    /**
+     * Flush the data of a file to disk
+     * @param path file to be synced.
+     * @return 0 if sync successfully, -1 otherwise.
+     */
+    static inline int syncFile(const std::string &path)
+    {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            perror("open");
+            return -1;
+        }
+        int ret = fdatasync(fd);
+        close(fd);
+        return ret;
+    }
+
+    /**
+     * Flush a directory to disk, so that files created, linked or renamed in it survive a power loss
+     * @param path directory to be synced.
+     * @return 0 if sync successfully, -1 otherwise.
+     */
+    static inline int syncDir(const std::string &path)
+    {
+        int fd = open(path.c_str(), O_RDONLY | O_DIRECTORY);
+        if (fd < 0)
+        {
+            perror("open");
+            return -1;
+        }
+        int ret = fsync(fd);
+        close(fd);
+        return ret;
+    }
+
+    /**
+     * Get the size of a file
+     * @param path file path.
+     * @return file size in bytes, -1 if the file does not exist.
+     */
+    static inline int64_t fileSize(const std::string &path)
+    {
+        struct stat st;
+        if (stat(path.c_str(), &st) != 0)
+            return -1;
+        return st.st_size;
+    }
+
     /**
      * Delete files
      * @param files files to be deleted.
@@ -148,6 +208,7 @@ namespace utils
         if (fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, offset, len) < 0)
         {
             perror("fallocate");
+            close(fd);
             return -2;
         }
 
@@ -205,13 +266,14 @@ namespace utils
     /**
      * generate crc16
      * @param data binary data used to generate crc16.
+     * @param length number of bytes in data.
      * @return generated crc16.
      */
-    static inline uint16_t crc16(const std::vector<unsigned char> &data)
+    static inline uint16_t crc16(const unsigned char *data, size_t length)
     {
         static const std::shared_ptr<uint16_t[]> crc16_table = generate_crc16_table();
         uint16_t crc = 0xFFFF;
-        size_t i = 0, length = data.size();
+        size_t i = 0;
         while (i < length)
         {
             crc = (crc << 8) ^ crc16_table[((crc >> 8) ^ data[i++]) & 0xFF];
@@ -219,6 +281,16 @@ namespace utils
         return crc;
     }
 
+    /**
+     * generate crc16
+     * @param data binary data used to generate crc16.
+     * @return generated crc16.
+     */
+    static inline uint16_t crc16(const std::vector<unsigned char> &data)
+    {
+        return crc16(data.data(), data.size());
+    }
+
     /**
      * @brief 随机函数
      * @return 0-1之间的随机数
@@ -4,24 +4,42 @@
 #include "v_log.h"
 #include "utils.h"
 #include "utils/logger.h"
+#include "perf_context.h"
+#include "async_io.h"
 
 #include <fstream>
+#include <algorithm>
 #include <vector>
 #include <iostream>
+#include <cerrno>
+#include <sys/mman.h>
 
-v_log::VLog::VLog(const std::string &v_log_file_name): file_name_(v_log_file_name) {
-    // TODO: 使用别的方式检查VLog文件是否存在
+v_log::VLog::VLog(const std::string &v_log_file_name, bool use_mmap, unsigned io_queue_depth)
+    : file_name_(v_log_file_name), use_mmap_(use_mmap) {
+    OpenFiles();
+    if(io_queue_depth && !use_mmap_) {
+        async_reader_ = async_io::NewAsyncReader(io_queue_depth);
+        LOG_INFO("VLog async reader: %s", async_reader_->name());
+    }
     std::ifstream fin;
     fin.open(file_name_, std::ios::binary);
     if (!fin) {
-        std::ofstream fout;
-        fout.open(file_name_, std::ios::binary);
-        fout.close();
+        LOG_ERROR("Failed to open VLog file");
+        head_ = 0;
         tail_ = 0;
         return ;
     }
 
-    tail_ = utils::seek_data_block(file_name_);
+    fin.seekg(0, std::ios::end);
+    head_ = fin.tellg();
+    off_t data_offset = utils::seek_data_block(file_name_);
+    if(data_offset < 0) {
+        // 空文件，或者所有数据均已被回收
+        tail_ = head_;
+        fin.close();
+        return ;
+    }
+    tail_ = data_offset;
     LOG_INFO("VLog tail: %lu", tail_);
     fin.seekg(tail_);
     VLogEntry v_log_entry;
@@ -42,72 +60,264 @@ v_log::VLog::VLog(const std::string &v_log_file_name): file_name_(v_log_file_nam
     fin.close();
 }
 
-uint64_t v_log::VLog::Insert(uint64_t key, const std::string &val) {
-    std::ofstream fout;
+v_log::VLog::~VLog() {
+    Flush();
+    if(write_fd_ >= 0) {
+        close(write_fd_);
+    }
+    if(read_fd_ >= 0) {
+        close(read_fd_);
+    }
+}
+
+void v_log::VLog::OpenFiles() {
+    if(write_fd_ >= 0) {
+        close(write_fd_);
+    }
+    if(read_fd_ >= 0) {
+        close(read_fd_);
+    }
+    write_fd_ = open(file_name_.c_str(), O_WRONLY | O_CREAT, 0644);
+    if(write_fd_ < 0) {
+        perror("open");
+    }
+    read_fd_ = open(file_name_.c_str(), O_RDONLY);
+    if(read_fd_ < 0) {
+        perror("open");
+    }
+    std::lock_guard<std::mutex> lock(mapping_mutex_);
+    mapping_.reset();
+}
 
-    fout.open(file_name_, std::ios::app | std::ios::binary);
+uint64_t v_log::VLog::Insert(uint64_t key, const std::string &val) {
+    uint64_t offset = Append(key, val);
+    Flush();
+    return offset;
+}
 
-    // 写入Magic byte
-    fout.write(&kMagic, 1);
+uint64_t v_log::VLog::Append(uint64_t key, std::string_view val) {
+    // 写入Magic byte，并为校验和预留位置
+    write_buffer_.push_back(kMagic);
+    size_t check_sum_pos = write_buffer_.size();
+    write_buffer_.append(sizeof(uint16_t), '\0');
 
     // 拼接key-vlen-value字符串
-    std::string data_str;
+    size_t data_pos = write_buffer_.size();
     uint32_t vlen = val.size();
-    data_str.append(reinterpret_cast<const char*> (&key), sizeof (uint64_t));
-    data_str.append(reinterpret_cast<const char*> (&vlen), sizeof (uint32_t));
-    data_str.append(val);
+    write_buffer_.append(reinterpret_cast<const char*> (&key), sizeof (uint64_t));
+    write_buffer_.append(reinterpret_cast<const char*> (&vlen), sizeof (uint32_t));
+    uint64_t offset = head_ + write_buffer_.size();
+    write_buffer_.append(val);
 
-    // 调用crc16函数，写入校验和
-    std::vector<unsigned char> data(data_str.begin(), data_str.end());
-    uint16_t check_sum = utils::crc16(data);
-
-    fout.write(reinterpret_cast<const char*>(&check_sum), 2);
+    // 计算key-vlen-value部分的校验和，回填到预留位置
+    uint16_t check_sum = utils::crc16(
+        reinterpret_cast<const unsigned char*>(write_buffer_.data() + data_pos),
+        write_buffer_.size() - data_pos
+    );
+    memcpy(write_buffer_.data() + check_sum_pos, &check_sum, sizeof(check_sum));
 
-    // 写入key-vlen-value拼接结果
-    fout.write(reinterpret_cast<const char*> (&key), sizeof (uint64_t));
-    fout.write(reinterpret_cast<const char*> (&vlen), sizeof (uint32_t));
-    uint64_t offset;
-    offset = fout.tellp();
-    offset = fout.tellp();
-    fout.write(val.c_str(), val.size());
+    return offset;
+}
 
-    fout.close();
+bool v_log::VLog::Flush() {
+    size_t written = 0;
+    while(written < write_buffer_.size()) {
+        ssize_t res = pwrite(write_fd_, write_buffer_.data() + written,
+                             write_buffer_.size() - written, head_ + written);
+        if(res < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            perror("pwrite");
+            LOG_ERROR("Failed to write VLog entries");
+            return false;
+        }
+        written += res;
+    }
+    head_ += written;
+    write_buffer_.clear();
+    return true;
+}
 
-    
-    return offset;
+bool v_log::VLog::Sync() {
+    if(write_fd_ < 0 || fdatasync(write_fd_) < 0) {
+        LOG_ERROR("Failed to sync VLog");
+        return false;
+    }
+    return true;
 }
 
 std::string v_log::VLog::Get(uint64_t offset, uint32_t vlen) {
-    std::ifstream fin;
-    fin.open(file_name_, std::ios::binary);
-    if(!fin) {
-        // 无法打开文件，返回空字符串
+    if(use_mmap_) {
+        VLogValueView view = GetView(offset, vlen);
+        if(view.mapping) {
+            return std::string(view.val);
+        }
+    }
+
+    // 直接读入返回值的缓冲区，值中可以包含'\0'
+    std::string val(vlen, '\0');
+    if(!Get(offset, vlen, val.data())) {
         return "";
     }
-    
-    fin.seekg(offset);
-    std::string val = "";
-    char* val_c_str = new char[vlen + 1];
-    val_c_str[vlen] = '\0';
-    fin.read(val_c_str, vlen);
-    val = val_c_str;
-
-    delete [] val_c_str;
-    fin.close();
     return val;
 }
 
+bool v_log::VLog::Get(uint64_t offset, uint32_t vlen, char *buffer) {
+    PERF_TIMER_GUARD(v_log_read_nanos);
+    PERF_COUNTER_ADD(v_log_read_count, 1);
+    PERF_COUNTER_ADD(v_log_read_bytes, vlen);
+    size_t read_size = 0;
+    while(read_size < vlen) {
+        ssize_t res = pread(read_fd_, buffer + read_size, vlen - read_size, offset + read_size);
+        if(res < 0 && errno == EINTR) {
+            continue;
+        }
+        if(res <= 0) {
+            // 读取失败，或者超出文件末尾
+            return false;
+        }
+        read_size += res;
+    }
+    return true;
+}
+
+void v_log::VLog::MultiGet(std::vector<VLogReadRequest> &requests) {
+    // 相邻两个值之间至少隔着下一个entry的头部，间隔较小时多读的字节比一次额外的系统调用更便宜
+    static const uint64_t kMaxCoalesceGap = 4096;
+    static const uint64_t kMaxCoalesceBytes = 1 << 20;
+
+    if(use_mmap_) {
+        // 内存映射没有系统调用开销，无须合并
+        for(auto &request: requests) {
+            *request.val = Get(request.offset, request.vlen);
+        }
+        return ;
+    }
+
+    std::sort(requests.begin(), requests.end(), [](const VLogReadRequest &a, const VLogReadRequest &b) {
+        return a.offset < b.offset;
+    });
+    // 第i个合并的读取覆盖requests[run_begins[i], run_begins[i + 1])
+    std::vector<size_t> run_begins;
+    std::vector<async_io::ReadRequest> reads;
+    size_t begin = 0;
+    while(begin < requests.size()) {
+        uint64_t run_begin = requests[begin].offset;
+        uint64_t run_end = run_begin + requests[begin].vlen;
+        size_t end = begin + 1;
+        while(end < requests.size()
+            && requests[end].offset <= run_end + kMaxCoalesceGap
+            && std::max(run_end, requests[end].offset + requests[end].vlen) - run_begin <= kMaxCoalesceBytes) {
+            run_end = std::max(run_end, requests[end].offset + requests[end].vlen);
+            ++ end;
+        }
+        run_begins.push_back(begin);
+        reads.push_back({read_fd_, run_begin, static_cast<uint32_t>(run_end - run_begin), nullptr});
+        begin = end;
+    }
+    run_begins.push_back(requests.size());
+
+    // 只有一个值的读取直接读入结果，否则读入缓冲区后再切分
+    std::vector<std::string> buffers(reads.size());
+    for(size_t i = 0; i < reads.size(); ++i) {
+        std::string *destination = run_begins[i + 1] - run_begins[i] == 1 ? requests[run_begins[i]].val : &buffers[i];
+        destination->resize(reads[i].len);
+        reads[i].buffer = destination->data();
+    }
+    if(async_reader_ && reads.size() > 1) {
+        PERF_TIMER_GUARD(v_log_read_nanos);
+        PERF_COUNTER_ADD(v_log_read_count, reads.size());
+        for(const auto &read: reads) {
+            PERF_COUNTER_ADD(v_log_read_bytes, read.len);
+        }
+        async_reader_->ReadAll(reads);
+    } else {
+        for(auto &read: reads) {
+            read.ok = Get(read.offset, read.len, read.buffer);
+        }
+    }
+
+    for(size_t i = 0; i < reads.size(); ++i) {
+        for(size_t j = run_begins[i]; j < run_begins[i + 1]; ++j) {
+            VLogReadRequest &request = requests[j];
+            if(!reads[i].ok) {
+                // 逐个重试，失败的值为""
+                *request.val = Get(request.offset, request.vlen);
+            } else if(run_begins[i + 1] - run_begins[i] > 1) {
+                request.val->assign(buffers[i].data() + (request.offset - reads[i].offset), request.vlen);
+            }
+        }
+    }
+}
+
+v_log::VLogValueView v_log::VLog::GetView(uint64_t offset, uint32_t vlen) {
+    PERF_TIMER_GUARD(v_log_read_nanos);
+    PERF_COUNTER_ADD(v_log_read_count, 1);
+    PERF_COUNTER_ADD(v_log_read_bytes, vlen);
+    std::lock_guard<std::mutex> lock(mapping_mutex_);
+    if(!mapping_ || offset + vlen > mapping_->size) {
+        // 文件在上次映射之后增长了
+        Remap();
+    }
+    if(!mapping_ || offset + vlen > mapping_->size) {
+        return {};
+    }
+    return {std::string_view(mapping_->data + offset, vlen), mapping_};
+}
+
+void v_log::VLog::Remap() {
+    struct stat st;
+    if(fstat(read_fd_, &st) < 0 || st.st_size == 0) {
+        return ;
+    }
+    void *data = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, read_fd_, 0);
+    if(data == MAP_FAILED) {
+        perror("mmap");
+        return ;
+    }
+    // 旧映射在所有视图释放后才会解除
+    mapping_ = std::make_shared<const VLogMapping>(static_cast<const char*>(data), st.st_size);
+}
+
+v_log::VLogMapping::~VLogMapping() {
+    munmap(const_cast<char*>(data), size);
+}
+
 void v_log::VLog::Reset() {
+    head_ = 0;
     tail_ = 0;
+    write_buffer_.clear();
     if(utils::rmfile(file_name_) < 0) {
         LOG_WARNING("Failed to remove VLog file");
     }
+    OpenFiles();
 }
 
-bool v_log::VLog::DeallocSpace(
-    uint64_t chunck_size, 
-    std::vector<v_log::DeallocVLogEntryInfo> &dealloc_entry_list
+void v_log::VLog::Recover(uint64_t head, uint64_t tail) {
+    if(head_ > head) {
+        LOG_WARNING("Truncate %lu unreferenced byte(s) at VLog head", head_.load() - head);
+        if(truncate(file_name_.c_str(), head) < 0) {
+            perror("truncate");
+        } else {
+            head_ = head;
+        }
+    }
+    if(tail_ < tail) {
+        // 崩溃可能发生在MANIFEST记录新的尾指针之后、打洞之前
+        DeallocSpace(std::min(tail, head_.load()));
+    }
+    if(tail_ > head_) {
+        tail_ = head_;
+    }
+}
+
+bool v_log::VLog::ReadTailChunk(
+    uint64_t chunk_size,
+    std::vector<v_log::DeallocVLogEntryInfo> &dealloc_entry_list,
+    uint64_t &chunk_end
 ) {
+    chunk_end = tail_;
     std::ifstream fin;
     fin.open(file_name_);
     if(!fin) {
@@ -116,15 +326,15 @@ bool v_log::VLog::DeallocSpace(
     }
 
     fin.seekg(tail_);
-    uint64_t read_chunck_size = 0;
-
-    while(read_chunck_size < chunck_size) {
+    while(chunk_end - tail_ < chunk_size) {
         VLogEntry v_log_entry;
         uint64_t val_offset;
 
         if(!(val_offset = v_log_entry.ReadFromFile(fin))) {
             break;
         }
+        // 校验失败的entry同样被回收
+        chunk_end = val_offset + v_log_entry.vlen;
 
         if(!v_log_entry.InspectChecksum()) {
             // LOG_WARNING("Inspect checksum failed, try next...");
@@ -132,13 +342,18 @@ bool v_log::VLog::DeallocSpace(
         }
 
         dealloc_entry_list.emplace_back(v_log_entry.key, val_offset, v_log_entry.val);
-        read_chunck_size += v_log_entry.size();
     }
+    return true;
+}
 
+void v_log::VLog::DeallocSpace(uint64_t new_tail) {
+    if(new_tail <= tail_) {
+        // 长度为0时fallocate返回EINVAL
+        return ;
+    }
     // 文件打洞
-    utils::de_alloc_file(file_name_, tail_, read_chunck_size);
-    tail_ += read_chunck_size;
-    return true;
+    utils::de_alloc_file(file_name_, tail_, new_tail - tail_);
+    tail_ = new_tail;
 }
 
 uint64_t v_log::VLogEntry::ReadFromFile(std::ifstream &fin) {
@@ -174,11 +389,8 @@ uint64_t v_log::VLogEntry::ReadFromFile(std::ifstream &fin) {
     }
     uint64_t val_offset;
     val_offset = fin.tellg();
-    char *v_log_entry_val_c_str = new char[vlen + 1];
-    v_log_entry_val_c_str[vlen] = '\0';
-    fin.read(v_log_entry_val_c_str, vlen);
-    val = std::string(v_log_entry_val_c_str);
-    delete [] v_log_entry_val_c_str;
+    val.resize(vlen);
+    fin.read(val.data(), vlen);
 
     if(!fin) {
         LOG_ERROR("Read Value error");
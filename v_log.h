@@ -5,8 +5,16 @@
 #ifndef LSMKV_HANDOUT_V_LOG_H
 #define LSMKV_HANDOUT_V_LOG_H
 #include <string>
+#include <string_view>
 #include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
 
+namespace async_io
+{
+    class AsyncReader;
+}
 namespace v_log
 {
     const char kMagic = 0xff;
@@ -20,6 +28,40 @@ namespace v_log
             : key(key), offset(offset), val(val) {}
     };
 
+    /**
+     * @brief VLog文件的只读内存映射，析构时解除映射
+     */
+    struct VLogMapping
+    {
+        const char *data;
+        size_t size;
+
+        VLogMapping(const char *data, size_t size): data(data), size(size) {}
+        VLogMapping(const VLogMapping &) = delete;
+        VLogMapping &operator=(const VLogMapping &) = delete;
+        ~VLogMapping();
+    };
+
+    /**
+     * @brief 指向内存映射中某个值的零拷贝视图
+     * @details 视图持有映射的引用，即使VLog重新映射，视图在其生命周期内仍然有效
+     */
+    struct VLogValueView
+    {
+        std::string_view val;
+        std::shared_ptr<const VLogMapping> mapping;
+    };
+
+    /**
+     * @brief 批量读取中的一个请求
+     */
+    struct VLogReadRequest
+    {
+        uint64_t offset;
+        uint32_t vlen;
+        std::string *val; // 读取结果写入的位置，读取失败时为""
+    };
+
     struct VLogEntry
     {
         uint16_t check_sum;
@@ -54,15 +96,45 @@ namespace v_log
     class VLog
     {
     public:
-        VLog(const std::string &v_log_file_name);
         /**
-         * @brief 向VLog文件尾部插入键值对
+         * @param v_log_file_name VLog文件路径
+         * @param use_mmap 读取值时是否使用只读内存映射（否则使用pread）
+         * @param io_queue_depth 批量读取时同时在途的最大请求数，为0或使用内存映射时同步读取
+         */
+        VLog(const std::string &v_log_file_name, bool use_mmap = false, unsigned io_queue_depth = 0);
+        ~VLog();
+
+        /**
+         * @brief 向VLog文件尾部插入键值对，并立即写入文件
          * @param key
          * @param val
          * @return 插入的值在文件中的偏移量
          */
         uint64_t Insert(uint64_t key, const std::string &val);
 
+        /**
+         * @brief 将键值对追加到写缓冲区，调用Flush后才写入文件
+         * @details 只允许一个线程写入VLog
+         * @param key
+         * @param val
+         * @return 插入的值在文件中的偏移量
+         */
+        uint64_t Append(uint64_t key, std::string_view val);
+
+        /**
+         * @brief 将写缓冲区中的所有entry通过一次write写入文件，并前移头指针
+         * @return true 写入成功
+         * @return false 写入失败
+         */
+        bool Flush();
+
+        /**
+         * @brief 将已写入文件的entry落盘
+         * @details 须在引用这些entry的SSTable记录到MANIFEST之前调用
+         * @return false 同步失败
+         */
+        bool Sync();
+
 
         /**
          * @brief 从VLog文件中读取值
@@ -73,6 +145,35 @@ namespace v_log
          */
         std::string Get(uint64_t offset, uint32_t vlen);
 
+        /**
+         * @brief 从VLog文件中读取值到调用者提供的缓冲区
+         *
+         * @param offset 偏移量
+         * @param vlen 值的长度
+         * @param buffer 至少vlen字节的缓冲区
+         * @return true 读取成功
+         * @return false 读取失败或文件长度不足
+         */
+        bool Get(uint64_t offset, uint32_t vlen, char *buffer);
+
+        /**
+         * @brief 批量读取值
+         * @details 按偏移量排序后，将间隔不超过kMaxCoalesceGap的相邻请求合并为一次读取，
+         * 合并后单次读取不超过kMaxCoalesceBytes；合并后的多个读取一次性提交给异步读取引擎
+         *
+         * @param requests 读取请求，会被按偏移量重新排序
+         */
+        void MultiGet(std::vector<VLogReadRequest> &requests);
+
+        /**
+         * @brief 通过只读内存映射获取值的零拷贝视图
+         *
+         * @param offset 偏移量
+         * @param vlen 值的长度
+         * @return VLogValueView 读取失败时val为空且mapping为nullptr
+         */
+        VLogValueView GetView(uint64_t offset, uint32_t vlen);
+
         /**
          * @brief 重置尾指针，删除VLog文件
          * 
@@ -81,25 +182,76 @@ namespace v_log
 
 
         /**
-         * @brief 回收VLog尾部空间
+         * @brief 从尾指针开始读取至少chunk_size字节的entry，不修改文件与尾指针
          * 
-         * @param chunk_size 至少回收的字节数
-         * @param dealloc_entry_list 返回已经回收的entry信息列表
-         * @return true 
-         * @return false 
+         * @param chunk_size 至少读取的字节数
+         * @param dealloc_entry_list 返回校验通过的entry信息列表
+         * @param chunk_end 返回读取范围的末尾，即回收后的尾指针
+         * @return false 打开VLog文件失败
          */
-        bool DeallocSpace(
+        bool ReadTailChunk(
             uint64_t chunk_size,
-            std::vector<DeallocVLogEntryInfo> &dealloc_entry_list);
+            std::vector<DeallocVLogEntryInfo> &dealloc_entry_list,
+            uint64_t &chunk_end);
+
+        /**
+         * @brief 对[尾指针, new_tail)打洞，并将尾指针前移到new_tail
+         * @details 调用者须保证其中仍然有效的值已经重新写入，且新的位置已经持久化
+         */
+        void DeallocSpace(uint64_t new_tail);
+
 
+        /**
+         * @brief 根据MANIFEST中记录的头尾指针恢复VLog
+         * @details 截断head之后未被任何SSTable引用的数据（崩溃时写了一半的flush），
+         * 并保证尾指针不落后于已经回收的位置。
+         *
+         * @param head MANIFEST记录的头指针
+         * @param tail MANIFEST记录的尾指针
+         */
+        void Recover(uint64_t head, uint64_t tail);
 
         const std::string &file_name() const
         {
             return file_name_;
         }
 
+        /**
+         * @brief 头指针，即下一个entry写入的偏移量
+         */
+        uint64_t head() const
+        {
+            return head_;
+        }
+
+        /**
+         * @brief 尾指针，即第一个未被回收的entry的偏移量
+         */
+        uint64_t tail() const
+        {
+            return tail_;
+        }
+
     private:
+        /**
+         * @brief 打开长期持有的读、写文件描述符（文件不存在时创建），并丢弃旧的内存映射
+         */
+        void OpenFiles();
+
+        /**
+         * @brief 按当前文件长度重新建立内存映射，调用者须持有mapping_mutex_
+         */
+        void Remap();
+
         std::string file_name_;
+        int write_fd_ = -1;
+        int read_fd_ = -1;
+        bool use_mmap_;
+        std::unique_ptr<async_io::AsyncReader> async_reader_; // 批量读取引擎，同步读取时为nullptr
+        std::shared_ptr<const VLogMapping> mapping_;
+        std::mutex mapping_mutex_;
+        std::string write_buffer_; // 尚未写入文件的entry，起始于头指针
+        std::atomic<uint64_t> head_; // 后台线程写入时，前台可能同时读取
         uint64_t tail_;
     };
 }
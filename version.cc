@@ -0,0 +1,415 @@
+#include "version.h"
+#include "utils.h"
+#include "utils/logger.h"
+
+#include <algorithm>
+#include <unordered_set>
+
+namespace version {
+    enum EditTag : char {
+        kAddFile = 1,
+        kDeleteFile = 2,
+        kVLogHead = 3,
+        kVLogTail = 4,
+        kNextSequence = 5,
+        kCompactPointer = 6,
+        kLogNumber = 7
+    };
+
+    template <typename T>
+    static void PutFixed(std::string &dst, T value)
+    {
+        dst.append(reinterpret_cast<const char*>(&value), sizeof(T));
+    }
+
+    static void PutString(std::string &dst, const std::string &str)
+    {
+        PutFixed<uint32_t>(dst, str.size());
+        dst.append(str);
+    }
+
+    template <typename T>
+    static bool GetFixed(const char *&cur, const char *end, T &value)
+    {
+        if(end - cur < static_cast<ptrdiff_t>(sizeof(T))) {
+            return false;
+        }
+        memcpy(&value, cur, sizeof(T));
+        cur += sizeof(T);
+        return true;
+    }
+
+    static bool GetString(const char *&cur, const char *end, std::string &str)
+    {
+        uint32_t len;
+        if(!GetFixed(cur, end, len) || end - cur < static_cast<ptrdiff_t>(len)) {
+            return false;
+        }
+        str.assign(cur, len);
+        cur += len;
+        return true;
+    }
+
+    void VersionEdit::AddFile(int level, const ss_table::Header &header, const std::string &base_file_name)
+    {
+        added_files.push_back({level, header, base_file_name});
+    }
+
+    void VersionEdit::DeleteFile(int level, const std::string &base_file_name)
+    {
+        deleted_files.push_back({level, base_file_name});
+    }
+
+    void VersionEdit::SetCompactPointer(int level, uint64_t key)
+    {
+        compact_pointers.emplace_back(level, key);
+    }
+
+    void VersionEdit::EncodeTo(std::string &dst) const
+    {
+        for(const auto &file: deleted_files) {
+            dst.push_back(kDeleteFile);
+            PutFixed<int32_t>(dst, file.level);
+            PutString(dst, file.base_file_name);
+        }
+        for(const auto &file: added_files) {
+            dst.push_back(kAddFile);
+            PutFixed<int32_t>(dst, file.level);
+            PutFixed(dst, file.header);
+            PutString(dst, file.base_file_name);
+        }
+        if(v_log_head) {
+            dst.push_back(kVLogHead);
+            PutFixed(dst, *v_log_head);
+        }
+        if(v_log_tail) {
+            dst.push_back(kVLogTail);
+            PutFixed(dst, *v_log_tail);
+        }
+        if(next_sequence) {
+            dst.push_back(kNextSequence);
+            PutFixed(dst, *next_sequence);
+        }
+        if(log_number) {
+            dst.push_back(kLogNumber);
+            PutFixed(dst, *log_number);
+        }
+        for(const auto &[level, key]: compact_pointers) {
+            dst.push_back(kCompactPointer);
+            PutFixed<int32_t>(dst, level);
+            PutFixed(dst, key);
+        }
+    }
+
+    bool VersionEdit::DecodeFrom(const char *data, size_t size)
+    {
+        const char *cur = data, *end = data + size;
+        while(cur < end) {
+            char tag = *cur++;
+            int32_t level;
+            uint64_t value;
+            switch (tag)
+            {
+            case kAddFile: {
+                AddedFile file;
+                if(!GetFixed(cur, end, level) || !GetFixed(cur, end, file.header)
+                    || !GetString(cur, end, file.base_file_name)) {
+                    return false;
+                }
+                file.level = level;
+                added_files.push_back(std::move(file));
+                break;
+            }
+            case kDeleteFile: {
+                DeletedFile file;
+                if(!GetFixed(cur, end, level) || !GetString(cur, end, file.base_file_name)) {
+                    return false;
+                }
+                file.level = level;
+                deleted_files.push_back(std::move(file));
+                break;
+            }
+            case kVLogHead:
+                if(!GetFixed(cur, end, value)) {
+                    return false;
+                }
+                v_log_head = value;
+                break;
+            case kVLogTail:
+                if(!GetFixed(cur, end, value)) {
+                    return false;
+                }
+                v_log_tail = value;
+                break;
+            case kNextSequence:
+                if(!GetFixed(cur, end, value)) {
+                    return false;
+                }
+                next_sequence = value;
+                break;
+            case kLogNumber:
+                if(!GetFixed(cur, end, value)) {
+                    return false;
+                }
+                log_number = value;
+                break;
+            case kCompactPointer:
+                if(!GetFixed(cur, end, level) || !GetFixed(cur, end, value)) {
+                    return false;
+                }
+                compact_pointers.emplace_back(level, value);
+                break;
+            default:
+                LOG_ERROR("Unknown version edit tag %d", tag);
+                return false;
+            }
+        }
+        return true;
+    }
+
+    Version::Version(const std::string &dir): dir_(dir) { }
+
+    void Version::LoadFromDirectory()
+    {
+        Clear();
+        int level = 0;
+        while(utils::dirExists(ss_table::SSTable::BuildSSTableDirName(dir_, level))) {
+            std::vector<std::string> base_file_name_list;
+            utils::scanDir(ss_table::SSTable::BuildSSTableDirName(dir_, level), base_file_name_list);
+            for(const auto &base_file_name: base_file_name_list) {
+                if(!base_file_name.ends_with(".sst")) {
+                    LOG_WARNING("Invalid file in level-%d: %s found", level, base_file_name.c_str());
+                    continue;
+                }
+                auto file_name = ss_table::SSTable::BuildSSTableFileName(dir_, level, base_file_name);
+                auto header = ss_table::SSTable::ReadSSTableHeaderDirectly(file_name);
+                if(header.key_count == 0) {
+                    // 读取SSTable文件header失败
+                    continue;
+                }
+                AddFile(level, {header, file_name});
+
+                // 旧数据目录以UNIX时间戳命名SSTable，序列号须大于所有已有的时间戳
+                uint64_t file_number = std::strtoull(base_file_name.c_str(), nullptr, 10);
+                next_sequence_ = std::max({next_sequence_.load(), header.time_stamp + 1, file_number + 1});
+            }
+            ++ level;
+        }
+    }
+
+    int Version::level_count() const
+    {
+        return levels_.size();
+    }
+
+    const std::vector<ss_table::SSTableMetaData> &Version::files(int level) const
+    {
+        static const std::vector<ss_table::SSTableMetaData> empty_level;
+        if(level < 0 || level >= static_cast<int>(levels_.size())) {
+            return empty_level;
+        }
+        return *levels_[level];
+    }
+
+    std::shared_ptr<const std::vector<ss_table::SSTableMetaData>> Version::files_snapshot(int level) const
+    {
+        static const auto empty_level = std::make_shared<const std::vector<ss_table::SSTableMetaData>>();
+        if(level < 0 || level >= static_cast<int>(levels_.size())) {
+            return empty_level;
+        }
+        return levels_[level];
+    }
+
+    std::vector<ss_table::SSTableMetaData> &Version::MutableFiles(int level)
+    {
+        if(levels_[level].use_count() > 1) {
+            // 快照仍在使用旧列表，复制后再修改
+            levels_[level] = std::make_shared<std::vector<ss_table::SSTableMetaData>>(*levels_[level]);
+        }
+        return *levels_[level];
+    }
+
+    size_t Version::file_count(int level) const
+    {
+        return files(level).size();
+    }
+
+    bool Version::IsDisjoint(int level) const
+    {
+        if(level <= 0 || level >= static_cast<int>(levels_.size())) {
+            return level > 0;
+        }
+        return disjoint_[level];
+    }
+
+    const ss_table::SSTableMetaData *Version::FindFile(int level, uint64_t key) const
+    {
+        const auto &level_files = files(level);
+        // 文件互不重叠且按最小键排序，因此最大键也是升序的
+        auto it = std::lower_bound(level_files.begin(), level_files.end(), key,
+            [](const ss_table::SSTableMetaData &meta_data, uint64_t key) {
+                return meta_data.header.max_key < key;
+            }
+        );
+        if(it == level_files.end() || it->header.min_key > key) {
+            return nullptr;
+        }
+        return &*it;
+    }
+
+    size_t Version::CountOverlappingFiles(int level, uint64_t min_key, uint64_t max_key) const
+    {
+        const auto &level_files = files(level);
+        auto first = std::lower_bound(level_files.begin(), level_files.end(), min_key,
+            [](const ss_table::SSTableMetaData &meta_data, uint64_t key) {
+                return meta_data.header.max_key < key;
+            }
+        );
+        auto last = std::upper_bound(first, level_files.end(), max_key,
+            [](uint64_t key, const ss_table::SSTableMetaData &meta_data) {
+                return key < meta_data.header.min_key;
+            }
+        );
+        return last - first;
+    }
+
+    std::optional<uint64_t> Version::compact_pointer(int level) const
+    {
+        if(level < 0 || level >= static_cast<int>(compact_pointers_.size())) {
+            return std::nullopt;
+        }
+        return compact_pointers_[level];
+    }
+
+    void Version::AddFile(int level, const ss_table::SSTableMetaData &meta_data)
+    {
+        while(level >= static_cast<int>(levels_.size())) {
+            levels_.push_back(std::make_shared<std::vector<ss_table::SSTableMetaData>>());
+            disjoint_.push_back(true);
+        }
+        auto &level_files = MutableFiles(level);
+        if(level == 0) {
+            level_files.push_back(meta_data);
+            return ;
+        }
+
+        auto it = std::upper_bound(level_files.begin(), level_files.end(), meta_data,
+            [](const ss_table::SSTableMetaData &a, const ss_table::SSTableMetaData &b) {
+                return a.header.min_key < b.header.min_key;
+            }
+        );
+        // 只需检查与相邻文件是否重叠
+        if((it != level_files.begin() && std::prev(it)->header.max_key >= meta_data.header.min_key)
+            || (it != level_files.end() && it->header.min_key <= meta_data.header.max_key)) {
+            disjoint_[level] = false;
+        }
+        level_files.insert(it, meta_data);
+    }
+
+    void Version::UpdateDisjoint(int level)
+    {
+        const auto &level_files = *levels_[level];
+        disjoint_[level] = true;
+        for(size_t i = 1; i < level_files.size(); ++i) {
+            if(level_files[i - 1].header.max_key >= level_files[i].header.min_key) {
+                disjoint_[level] = false;
+                break;
+            }
+        }
+    }
+
+    void Version::RemoveFiles(int level, const std::vector<std::string> &file_name_list)
+    {
+        if(level < 0 || level >= static_cast<int>(levels_.size()) || file_name_list.empty()) {
+            return ;
+        }
+        std::unordered_set<std::string> removed(file_name_list.begin(), file_name_list.end());
+        auto &level_files = MutableFiles(level);
+        level_files.erase(
+            std::remove_if(level_files.begin(), level_files.end(),
+                [&removed](const ss_table::SSTableMetaData &meta_data) {
+                    return removed.count(meta_data.ss_table_file_name);
+                }
+            ),
+            level_files.end()
+        );
+        if(!disjoint_[level]) {
+            // 旧数据目录中重叠的层，可能因删除而恢复有序
+            UpdateDisjoint(level);
+        }
+    }
+
+    void Version::Apply(const VersionEdit &edit)
+    {
+        // 按层归并删除，避免大量文件时逐个查找
+        std::vector<std::vector<std::string>> removed_by_level;
+        for(const auto &file: edit.deleted_files) {
+            if(file.level >= static_cast<int>(removed_by_level.size())) {
+                removed_by_level.resize(file.level + 1);
+            }
+            removed_by_level[file.level].push_back(
+                ss_table::SSTable::BuildSSTableFileName(dir_, file.level, file.base_file_name));
+        }
+        for(size_t level = 0; level < removed_by_level.size(); ++level) {
+            RemoveFiles(level, removed_by_level[level]);
+        }
+
+        for(const auto &file: edit.added_files) {
+            AddFile(file.level, {
+                file.header,
+                ss_table::SSTable::BuildSSTableFileName(dir_, file.level, file.base_file_name)
+            });
+        }
+        if(edit.v_log_head) {
+            v_log_head_ = *edit.v_log_head;
+        }
+        if(edit.v_log_tail) {
+            v_log_tail_ = *edit.v_log_tail;
+        }
+        if(edit.next_sequence) {
+            next_sequence_ = std::max(next_sequence_.load(), *edit.next_sequence);
+        }
+        if(edit.log_number) {
+            log_number_ = std::max(log_number_, *edit.log_number);
+        }
+        for(const auto &[level, key]: edit.compact_pointers) {
+            if(level >= static_cast<int>(compact_pointers_.size())) {
+                compact_pointers_.resize(level + 1);
+            }
+            compact_pointers_[level] = key;
+        }
+    }
+
+    VersionEdit Version::BuildSnapshot() const
+    {
+        VersionEdit edit;
+        for(size_t level = 0; level < levels_.size(); ++level) {
+            for(const auto &meta_data: *levels_[level]) {
+                edit.AddFile(level, meta_data.header,
+                    ss_table::SSTable::ExtractBaseFileName(meta_data.ss_table_file_name));
+            }
+        }
+        edit.v_log_head = v_log_head_;
+        edit.v_log_tail = v_log_tail_;
+        edit.next_sequence = next_sequence_;
+        edit.log_number = log_number_;
+        for(size_t level = 0; level < compact_pointers_.size(); ++level) {
+            if(compact_pointers_[level]) {
+                edit.SetCompactPointer(level, *compact_pointers_[level]);
+            }
+        }
+        return edit;
+    }
+
+    void Version::Clear()
+    {
+        levels_.clear();
+        disjoint_.clear();
+        compact_pointers_.clear();
+    }
+
+    uint64_t Version::AllocateSequence()
+    {
+        return next_sequence_++;
+    }
+}
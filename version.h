@@ -0,0 +1,183 @@
+#ifndef VERSION_H
+#define VERSION_H
+#include <string>
+#include <vector>
+#include <optional>
+#include <atomic>
+#include <memory>
+#include "ss_table.h"
+
+namespace version {
+    /**
+     * @brief 对层级清单的一次修改，是MANIFEST日志中的一条记录
+     * @details 文件名均为不包含路径的文件名，如"1.sst"
+     */
+    struct VersionEdit
+    {
+        struct AddedFile {
+            int level;
+            ss_table::Header header;
+            std::string base_file_name;
+        };
+        struct DeletedFile {
+            int level;
+            std::string base_file_name;
+        };
+
+        std::vector<AddedFile> added_files;
+        std::vector<DeletedFile> deleted_files;
+        std::optional<uint64_t> v_log_head;
+        std::optional<uint64_t> v_log_tail;
+        std::optional<uint64_t> next_sequence;
+        std::optional<uint64_t> log_number; // 编号小于该值的预写日志已全部写入SSTable
+        std::vector<std::pair<int, uint64_t>> compact_pointers; // 每层下一次合并的起始键
+
+        void AddFile(int level, const ss_table::Header &header, const std::string &base_file_name);
+        void DeleteFile(int level, const std::string &base_file_name);
+        void SetCompactPointer(int level, uint64_t key);
+
+        /**
+         * @brief 将修改编码追加到dst末尾
+         */
+        void EncodeTo(std::string &dst) const;
+
+        /**
+         * @brief 从二进制数据中解码修改
+         *
+         * @return true 解码成功
+         * @return false 数据不完整或包含未知字段
+         */
+        bool DecodeFrom(const char *data, size_t size);
+    };
+
+    /**
+     * @brief 内存中的SSTable层级清单
+     * @details 记录每一层所有存活的SSTable文件及其Header，以及VLog头尾指针和下一个序列号，
+     * 查找、扫描、合并时只读取该清单，不再扫描目录或读取文件头。
+     * level-0按加入顺序保存，文件之间可以重叠；level≥1按最小键升序保存，
+     * 合并保证其中的文件互不重叠（旧数据目录中的层可能重叠，见IsDisjoint）。
+     */
+    class Version {
+    public:
+        /**
+         * @param dir SSTable文件存储目录，如"data"
+         */
+        explicit Version(const std::string &dir);
+
+        /**
+         * @brief 扫描dir下的level-N目录，读取所有SSTable文件的Header，构造清单
+         * @details 仅用于不存在MANIFEST文件的旧数据目录
+         */
+        void LoadFromDirectory();
+
+        /**
+         * @brief 层数（最深一层的层号+1）
+         */
+        int level_count() const;
+
+        /**
+         * @brief 第level层的所有SSTable元数据，level超出范围时返回空列表
+         */
+        const std::vector<ss_table::SSTableMetaData> &files(int level) const;
+
+        /**
+         * @brief 第level层文件列表的只读快照，之后对清单的修改不影响快照（写时复制）
+         * @details 调用者须持有与修改清单互斥的锁，取得快照后可以在锁外使用
+         */
+        std::shared_ptr<const std::vector<ss_table::SSTableMetaData>> files_snapshot(int level) const;
+
+        /**
+         * @brief 第level层的SSTable文件个数
+         */
+        size_t file_count(int level) const;
+
+        /**
+         * @brief 第level层的文件是否按最小键排序且互不重叠，level-0总是返回false
+         */
+        bool IsDisjoint(int level) const;
+
+        /**
+         * @brief 在互不重叠的第level层中二分查找键范围包含key的文件
+         * @details 调用者须保证IsDisjoint(level)
+         * 
+         * @return 文件元数据，不存在时返回nullptr
+         */
+        const ss_table::SSTableMetaData *FindFile(int level, uint64_t key) const;
+
+        /**
+         * @brief 互不重叠的第level层中键范围与[min_key, max_key]相交的文件个数
+         * @details 调用者须保证IsDisjoint(level)
+         */
+        size_t CountOverlappingFiles(int level, uint64_t min_key, uint64_t max_key) const;
+
+        /**
+         * @brief 第level层下一次合并的起始键，即上一次合并的最大键，尚未合并过时返回std::nullopt
+         */
+        std::optional<uint64_t> compact_pointer(int level) const;
+
+        /**
+         * @brief 向第level层加入一个SSTable文件
+         * @details level≥1时按最小键插入到有序位置
+         *
+         * @param level 层数
+         * @param meta_data SSTable元数据（文件名为完整路径）
+         */
+        void AddFile(int level, const ss_table::SSTableMetaData &meta_data);
+
+        /**
+         * @brief 从第level层删除SSTable文件
+         *
+         * @param level 层数
+         * @param file_name_list 被删除的SSTable文件名列表（完整路径）
+         */
+        void RemoveFiles(int level, const std::vector<std::string> &file_name_list);
+
+        /**
+         * @brief 应用一次修改
+         */
+        void Apply(const VersionEdit &edit);
+
+        /**
+         * @brief 生成包含当前完整状态的修改，用于写入MANIFEST快照
+         */
+        VersionEdit BuildSnapshot() const;
+
+        /**
+         * @brief 清空所有层的SSTable文件
+         */
+        void Clear();
+
+        /**
+         * @brief 分配一个新的序列号，用作SSTable时间戳和文件名（线程安全）
+         */
+        uint64_t AllocateSequence();
+
+        uint64_t next_sequence() const { return next_sequence_; }
+        uint64_t log_number() const { return log_number_; }
+        uint64_t v_log_head() const { return v_log_head_; }
+        uint64_t v_log_tail() const { return v_log_tail_; }
+        const std::string &dir() const { return dir_; }
+
+    private:
+        /**
+         * @brief 重新检查第level层的文件是否互不重叠
+         */
+        void UpdateDisjoint(int level);
+
+        /**
+         * @brief 第level层可修改的文件列表，列表仍被快照共享时先复制一份
+         */
+        std::vector<ss_table::SSTableMetaData> &MutableFiles(int level);
+
+        std::string dir_;
+        std::vector<std::shared_ptr<std::vector<ss_table::SSTableMetaData>>> levels_; // 每层的文件列表，可能被快照共享
+        std::vector<bool> disjoint_; // 每层的文件是否互不重叠
+        std::vector<std::optional<uint64_t>> compact_pointers_;
+        std::atomic<uint64_t> next_sequence_ = 1;
+        uint64_t v_log_head_ = 0;
+        uint64_t v_log_tail_ = 0;
+        uint64_t log_number_ = 0;
+    };
+}
+
+#endif //VERSION_H
@@ -0,0 +1,220 @@
+#include "wal.h"
+#include "utils.h"
+#include "utils/logger.h"
+
+#include <cstring>
+#include <cerrno>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+
+namespace wal {
+    static const size_t kRecordHeaderSize = sizeof(uint32_t) + sizeof(uint16_t);
+    // 一组提交的字节数上限，避免单个领导者替过多线程写入而拉长自身延迟
+    static const size_t kMaxGroupBytes = 1 << 20;
+
+    void EncodeEntry(std::string &payload, uint64_t key, std::string_view val)
+    {
+        uint32_t vlen = val.size();
+        payload.append(reinterpret_cast<const char*>(&key), sizeof(key));
+        payload.append(reinterpret_cast<const char*>(&vlen), sizeof(vlen));
+        payload.append(val);
+    }
+
+    bool DecodeEntries(std::string_view payload, const std::function<void(uint64_t, std::string_view)> &handler)
+    {
+        size_t pos = 0;
+        while(pos < payload.size()) {
+            uint64_t key;
+            uint32_t vlen;
+            if(payload.size() - pos < sizeof(key) + sizeof(vlen)) {
+                return false;
+            }
+            memcpy(&key, payload.data() + pos, sizeof(key));
+            memcpy(&vlen, payload.data() + pos + sizeof(key), sizeof(vlen));
+            pos += sizeof(key) + sizeof(vlen);
+            if(payload.size() - pos < vlen) {
+                return false;
+            }
+            handler(key, payload.substr(pos, vlen));
+            pos += vlen;
+        }
+        return true;
+    }
+
+    LogWriter::LogWriter(const std::string &file_name, WalSyncMode sync_mode, unsigned sync_period_ms)
+        : file_name_(file_name), sync_mode_(sync_mode), sync_period_ms_(sync_period_ms)
+    {
+        fd_ = open(file_name_.c_str(), O_WRONLY | O_APPEND | O_CREAT, 0644);
+        if(fd_ < 0) {
+            perror("open");
+        } else if(sync_mode_ != WalSyncMode::kNone) {
+            // 新建的日志文件记录在目录中，目录落盘后fdatasync过的记录才不会随文件一起丢失
+            size_t slash = file_name_.find_last_of('/');
+            utils::syncDir(slash == std::string::npos ? "." : file_name_.substr(0, slash));
+        }
+        if(sync_mode_ == WalSyncMode::kPeriodic) {
+            sync_thread_ = std::thread(&LogWriter::SyncLoop, this);
+        }
+    }
+
+    LogWriter::~LogWriter()
+    {
+        if(sync_thread_.joinable()) {
+            {
+                std::lock_guard<std::mutex> lock(sync_mutex_);
+                closing_ = true;
+            }
+            sync_cv_.notify_one();
+            sync_thread_.join();
+        }
+        if(fd_ >= 0) {
+            if(sync_mode_ != WalSyncMode::kNone) {
+                Sync();
+            }
+            close(fd_);
+        }
+    }
+
+    bool LogWriter::AddRecord(std::string_view payload, const std::function<void(uint64_t)> &apply)
+    {
+        Writer writer;
+        writer.payload = payload;
+        std::unique_lock<std::mutex> lock(mutex_);
+        writers_.push_back(&writer);
+        writer.cv.wait(lock, [this, &writer] { return writer.done || &writer == writers_.front(); });
+        if(!writer.done) {
+            // 成为领导者，将队列中的记录编码为一组，并按日志顺序分配序列号
+            group_buffer_.clear();
+            group_size_ = 0;
+            for(Writer *member: writers_) {
+                if(group_size_ && group_buffer_.size() + member->payload.size() > kMaxGroupBytes) {
+                    break;
+                }
+                uint32_t len = member->payload.size();
+                uint16_t check_sum = utils::crc16(
+                    reinterpret_cast<const unsigned char*>(member->payload.data()), member->payload.size());
+                group_buffer_.append(reinterpret_cast<const char*>(&len), sizeof(len));
+                group_buffer_.append(reinterpret_cast<const char*>(&check_sum), sizeof(check_sum));
+                group_buffer_.append(member->payload);
+                member->sequence = ++ last_sequence_;
+                ++ group_size_;
+            }
+
+            // 写入期间放开锁，后来的线程可以继续排队
+            lock.unlock();
+            bool ok = fd_ >= 0;
+            size_t written = 0;
+            while(ok && written < group_buffer_.size()) {
+                ssize_t res = write(fd_, group_buffer_.data() + written, group_buffer_.size() - written);
+                if(res < 0 && errno == EINTR) {
+                    continue;
+                }
+                if(res <= 0) {
+                    LOG_ERROR("Failed to append WAL record");
+                    ok = false;
+                    break;
+                }
+                written += res;
+            }
+            if(ok) {
+                if(sync_mode_ == WalSyncMode::kPerBatch) {
+                    ok = fdatasync(fd_) == 0;
+                } else {
+                    dirty_ = true;
+                }
+            }
+            lock.lock();
+
+            for(size_t i = 0; i < group_size_; ++i) {
+                Writer *member = writers_.front();
+                writers_.pop_front();
+                member->ok = ok;
+                member->done = true;
+                if(member != &writer) {
+                    member->cv.notify_one();
+                }
+            }
+            if(!writers_.empty()) {
+                // 唤醒下一组的领导者，其写入与本组的apply重叠
+                writers_.front()->cv.notify_one();
+            }
+        }
+        lock.unlock();
+
+        // 组内的线程并发执行各自的apply，新旧由序列号决定
+        if(apply) {
+            apply(writer.sequence);
+        }
+        return writer.ok;
+    }
+
+    bool LogWriter::Sync()
+    {
+        dirty_ = false;
+        return fd_ >= 0 && fdatasync(fd_) == 0;
+    }
+
+    void LogWriter::SyncLoop()
+    {
+        std::unique_lock<std::mutex> lock(sync_mutex_);
+        while(!closing_) {
+            sync_cv_.wait_for(lock, std::chrono::milliseconds(sync_period_ms_), [this] { return closing_; });
+            if(dirty_) {
+                Sync();
+            }
+        }
+    }
+
+    bool ReadLog(const std::string &file_name, const std::function<void(std::string_view)> &handler)
+    {
+        std::ifstream fin(file_name, std::ios::binary);
+        if(!fin) {
+            return false;
+        }
+        std::stringstream buffer;
+        buffer << fin.rdbuf();
+        fin.close();
+        std::string content = buffer.str();
+
+        size_t pos = 0;
+        while(content.size() - pos >= kRecordHeaderSize) {
+            uint32_t len;
+            uint16_t check_sum;
+            memcpy(&len, content.data() + pos, sizeof(len));
+            memcpy(&check_sum, content.data() + pos + sizeof(len), sizeof(check_sum));
+            if(content.size() - pos - kRecordHeaderSize < len) {
+                LOG_WARNING("Truncated WAL record at offset %zu in `%s`", pos, file_name.c_str());
+                break;
+            }
+            const char *payload = content.data() + pos + kRecordHeaderSize;
+            if(utils::crc16(reinterpret_cast<const unsigned char*>(payload), len) != check_sum) {
+                LOG_WARNING("Corrupted WAL record at offset %zu in `%s`", pos, file_name.c_str());
+                break;
+            }
+            handler(std::string_view(payload, len));
+            pos += kRecordHeaderSize + len;
+        }
+        return true;
+    }
+
+    std::string BuildLogFileName(const std::string &dir, uint64_t number)
+    {
+        return dir + "/" + std::to_string(number) + ".log";
+    }
+
+    bool ParseLogFileName(const std::string &base_file_name, uint64_t &number)
+    {
+        static const std::string kSuffix = ".log";
+        if(base_file_name.size() <= kSuffix.size()
+            || base_file_name.compare(base_file_name.size() - kSuffix.size(), kSuffix.size(), kSuffix) != 0) {
+            return false;
+        }
+        std::string stem = base_file_name.substr(0, base_file_name.size() - kSuffix.size());
+        if(stem.find_first_not_of("0123456789") != std::string::npos) {
+            return false;
+        }
+        number = std::stoull(stem);
+        return true;
+    }
+}
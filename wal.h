@@ -0,0 +1,127 @@
+#ifndef LSMKV_HANDOUT_WAL_H
+#define LSMKV_HANDOUT_WAL_H
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <functional>
+#include <deque>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include "kvstore_options.h"
+
+namespace wal {
+    /**
+     * @brief 将一条键值对编码追加到记录的负载中
+     * @details 负载由若干条 [8字节键][4字节值长度][值] 组成，删除以值DELETED表示
+     */
+    void EncodeEntry(std::string &payload, uint64_t key, std::string_view val);
+
+    /**
+     * @brief 依次解码负载中的键值对
+     * @return true 解码成功
+     * @return false 负载不完整
+     */
+    bool DecodeEntries(std::string_view payload, const std::function<void(uint64_t, std::string_view)> &handler);
+
+    /**
+     * @brief 预写日志的写入者，每个内存表对应一个日志文件
+     * @details 记录格式与MANIFEST相同：[4字节长度][2字节crc16校验和][负载]。
+     * 多个线程并发调用AddRecord时组提交：排在队首的线程作为领导者，按日志顺序为组内的记录分配递增的序列号，
+     * 将队列中所有记录通过一次write写入，并按同步模式至多调用一次fdatasync，其余线程等待其完成。
+     * 写入完成后组内每个线程各自并发地调用自己的apply，apply的执行顺序不确定，须按序列号而非执行顺序决定新旧。
+     */
+    class LogWriter
+    {
+    public:
+        /**
+         * @param file_name 日志文件路径，如"data/12.log"，文件已存在时追加
+         * @param sync_mode 同步模式
+         * @param sync_period_ms sync_mode为kPeriodic时的同步间隔（毫秒）
+         */
+        LogWriter(const std::string &file_name, WalSyncMode sync_mode, unsigned sync_period_ms);
+
+        /**
+         * @brief 同步并关闭日志文件
+         */
+        ~LogWriter();
+
+        LogWriter(const LogWriter &) = delete;
+        LogWriter &operator=(const LogWriter &) = delete;
+
+        /**
+         * @brief 追加一条记录，返回时记录已写入文件（kPerBatch模式下已落盘），apply也已执行
+         * @details 线程安全。apply在本线程中调用，与同组其他记录的apply并发执行；写入文件失败时仍会调用apply
+         *
+         * @param payload 记录的负载
+         * @param apply 记录写入文件后执行的操作（如写入内存表），参数为记录的序列号，可以为空
+         * @return false 打开或写入文件失败
+         */
+        bool AddRecord(std::string_view payload, const std::function<void(uint64_t)> &apply = nullptr);
+
+        /**
+         * @brief 将已写入的记录落盘
+         */
+        bool Sync();
+
+        const std::string &file_name() const { return file_name_; }
+
+    private:
+        struct Writer {
+            std::string_view payload;
+            uint64_t sequence = 0;
+            bool done = false;
+            bool ok = false;
+            std::condition_variable cv;
+        };
+
+        /**
+         * @brief kPeriodic模式的后台同步线程
+         */
+        void SyncLoop();
+
+        std::string file_name_;
+        WalSyncMode sync_mode_;
+        unsigned sync_period_ms_;
+        int fd_ = -1;
+
+        std::mutex mutex_;
+        std::deque<Writer*> writers_; // 等待写入的线程，队首为领导者
+        std::string group_buffer_;   // 领导者编码一组记录的缓冲区
+        size_t group_size_ = 0;      // 领导者正在写入的一组记录数，均位于writers_队首
+        uint64_t last_sequence_ = 0; // 最后一条记录的序列号，从1开始
+
+        std::atomic<bool> dirty_ = false; // 是否有尚未落盘的记录
+        std::mutex sync_mutex_;
+        std::condition_variable sync_cv_;
+        bool closing_ = false;
+        std::thread sync_thread_;
+    };
+
+    /**
+     * @brief 依次读取日志文件中的所有记录
+     * @details 遇到不完整或校验失败的记录时停止读取（崩溃时写了一半的记录）
+     *
+     * @param file_name 日志文件路径
+     * @param handler 对每条记录的负载调用
+     * @return false 日志文件无法读取
+     */
+    bool ReadLog(const std::string &file_name, const std::function<void(std::string_view)> &handler);
+
+    /**
+     * @brief 生成日志文件名
+     * @return std::string 如"data/12.log"
+     */
+    std::string BuildLogFileName(const std::string &dir, uint64_t number);
+
+    /**
+     * @brief 解析不包含路径的日志文件名中的编号
+     * @return true base_file_name形如"12.log"
+     */
+    bool ParseLogFileName(const std::string &base_file_name, uint64_t &number);
+}
+
+#endif //LSMKV_HANDOUT_WAL_H
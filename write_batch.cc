@@ -0,0 +1,31 @@
+#include "write_batch.h"
+#include "wal.h"
+#include "inc.h"
+
+WriteBatch::WriteBatch(size_t reserved_bytes)
+{
+    rep_.reserve(reserved_bytes);
+}
+
+void WriteBatch::Put(uint64_t key, std::string_view s)
+{
+    wal::EncodeEntry(rep_, key, s);
+    ++ count_;
+}
+
+void WriteBatch::Delete(uint64_t key)
+{
+    wal::EncodeEntry(rep_, key, DELETED);
+    ++ count_;
+}
+
+void WriteBatch::Clear()
+{
+    rep_.clear();
+    count_ = 0;
+}
+
+void WriteBatch::Iterate(const std::function<void(uint64_t, std::string_view)> &handler) const
+{
+    wal::DecodeEntries(rep_, handler);
+}
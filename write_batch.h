@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <functional>
+
+/**
+ * @brief 一组按顺序执行的写入与删除，由KVStore::Write原子地应用
+ * @details 记录编码为预写日志的负载格式，整个批次作为一条日志记录写入。
+ * 同一批次中对同一个键的多次修改，以最后一次为准。
+ */
+class WriteBatch
+{
+public:
+	/**
+	 * @param reserved_bytes 预先分配的缓冲区字节数，每条记录占12字节加上值的长度
+	 */
+	explicit WriteBatch(size_t reserved_bytes = 0);
+
+	/**
+	 * @brief 写入键值对，s不能为空
+	 */
+	void Put(uint64_t key, std::string_view s);
+
+	/**
+	 * @brief 删除键，与KVStore::del不同，不检查键是否存在
+	 */
+	void Delete(uint64_t key);
+
+	/**
+	 * @brief 清空批次，保留已分配的缓冲区
+	 */
+	void Clear();
+
+	/**
+	 * @brief 批次中的记录数
+	 */
+	size_t Count() const { return count_; }
+
+	/**
+	 * @brief 编码后的字节数
+	 */
+	size_t ApproximateSize() const { return rep_.size(); }
+
+	/**
+	 * @brief 按写入顺序遍历批次中的记录，删除的值为DELETED
+	 */
+	void Iterate(const std::function<void(uint64_t, std::string_view)> &handler) const;
+
+	/**
+	 * @brief 编码后的记录，即预写日志记录的负载
+	 */
+	std::string_view rep() const { return rep_; }
+
+private:
+	std::string rep_;
+	size_t count_ = 0;
+};